@@ -0,0 +1,79 @@
+#ifndef _DEVICE_ID_SET_H
+#define _DEVICE_ID_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Small open addressed hash set of 16-bit device IDs, for checking whether a
+ * device is one of a handful (e.g., the gateway device IDs) in constant time.
+ */
+class DeviceIdSet {
+public:
+  template <typename Iterator, typename GetId>
+  DeviceIdSet(Iterator begin, Iterator end, GetId getId)
+    : count(0)
+  {
+    size_t numSlots = 4;
+    for (Iterator itr = begin; itr != end; ++itr) {
+      if (numSlots < ++count * 2) {
+        numSlots <<= 1;
+      }
+    }
+
+    mask = numSlots - 1;
+    slots.assign(numSlots, Slot());
+    count = 0;
+
+    for (Iterator itr = begin; itr != end; ++itr) {
+      add(getId(*itr));
+    }
+  }
+
+  bool contains(uint16_t id) const {
+    for (size_t slot = hash(id); slots[slot].used; slot = (slot + 1) & mask) {
+      if (slots[slot].id == id) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+private:
+  struct Slot {
+    Slot() : id(0), used(false) { }
+
+    uint16_t id;
+    bool used;
+  };
+
+  std::vector<Slot> slots;
+  size_t mask;
+  size_t count;
+
+  void add(uint16_t id) {
+    size_t slot = hash(id);
+
+    for (; slots[slot].used; slot = (slot + 1) & mask) {
+      if (slots[slot].id == id) {
+        return;
+      }
+    }
+
+    slots[slot].id = id;
+    slots[slot].used = true;
+    count++;
+  }
+
+  size_t hash(uint16_t id) const {
+    return ((id * 40503U) >> 4) & mask;
+  }
+};
+
+#endif
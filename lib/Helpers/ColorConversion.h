@@ -0,0 +1,74 @@
+#include <inttypes.h>
+
+#ifndef _COLOR_CONVERSION_H
+#define _COLOR_CONVERSION_H
+
+/**
+ * Integer RGB <-> HSV conversion.  The ESP8266 has no FPU, so this replaces
+ * RGBConverter's double math for everything that converts colors (color commands,
+ * transitions, computed_color).
+ *
+ * Hue is in degrees [0, 360], saturation in percent [0, 100], and r/g/b/value are
+ * in [0, 255], matching what GroupState and ParsedColor store.  Every result is
+ * the exact rational value, rounded as described on each method.  That agrees
+ * with RGBConverter except where the exact value lands on a rounding boundary;
+ * there RGBConverter's floating point error can make it come out one lower.
+ */
+class ColorConversion {
+public:
+  // Hue and saturation are rounded to nearest, with halves rounded up (same as
+  // round() on the RGBConverter result).  As with RGBConverter, hues just below
+  // red round up to 360 rather than wrapping to 0.
+  static void rgbToHsv(uint8_t r, uint8_t g, uint8_t b, uint16_t& hue, uint8_t& saturation) {
+    const uint8_t max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+    const uint8_t min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+    const int32_t delta = max - min;
+
+    saturation = max == 0 ? 0 : roundedQuotient(100 * delta, max);
+
+    if (delta == 0) {
+      hue = 0;
+      return;
+    }
+
+    // 60 * delta * hue / 60, offset to the sextant the max channel starts
+    int32_t scaledHue;
+    if (max == r) {
+      scaledHue = 60 * (g - b) + (g < b ? 360 * delta : 0);
+    } else if (max == g) {
+      scaledHue = 60 * (b - r) + 120 * delta;
+    } else {
+      scaledHue = 60 * (r - g) + 240 * delta;
+    }
+
+    hue = roundedQuotient(scaledHue, delta);
+  }
+
+  // Channels are truncated (same as RGBConverter's conversion to byte).
+  static void hsvToRgb(uint16_t hue, uint8_t saturation, uint8_t value, uint8_t rgb[3]) {
+    hue %= 360;
+
+    const uint32_t offset = hue % 60;
+    // value * (1 - s), value * (1 - s*f), value * (1 - s*(1 - f)) with f = offset / 60
+    const uint8_t p = (uint32_t(value) * (100 - saturation)) / 100;
+    const uint8_t q = (uint32_t(value) * (6000 - offset * saturation)) / 6000;
+    const uint8_t t = (uint32_t(value) * (6000 - (60 - offset) * saturation)) / 6000;
+
+    switch (hue / 60) {
+      case 0:  rgb[0] = value; rgb[1] = t;     rgb[2] = p;     break;
+      case 1:  rgb[0] = q;     rgb[1] = value; rgb[2] = p;     break;
+      case 2:  rgb[0] = p;     rgb[1] = value; rgb[2] = t;     break;
+      case 3:  rgb[0] = p;     rgb[1] = q;     rgb[2] = value; break;
+      case 4:  rgb[0] = t;     rgb[1] = p;     rgb[2] = value; break;
+      default: rgb[0] = value; rgb[1] = p;     rgb[2] = q;     break;
+    }
+  }
+
+private:
+  // numerator / denominator rounded to nearest, halves up.  Both must be positive.
+  static uint32_t roundedQuotient(uint32_t numerator, uint32_t denominator) {
+    return (2 * numerator + denominator) / (2 * denominator);
+  }
+};
+
+#endif
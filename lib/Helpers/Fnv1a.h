@@ -0,0 +1,28 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef _FNV1A_H
+#define _FNV1A_H
+
+#define FNV1A_OFFSET_BASIS 2166136261UL
+#define FNV1A_PRIME 16777619UL
+
+// 32-bit FNV-1a.  Pass a previous result as `hash` to continue hashing across
+// several buffers.
+inline uint32_t fnv1a(const char* str, uint32_t hash = FNV1A_OFFSET_BASIS) {
+  while (*str) {
+    hash = (hash ^ static_cast<uint8_t>(*str++)) * FNV1A_PRIME;
+  }
+
+  return hash;
+}
+
+inline uint32_t fnv1a(const uint8_t* data, size_t length, uint32_t hash = FNV1A_OFFSET_BASIS) {
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ data[i]) * FNV1A_PRIME;
+  }
+
+  return hash;
+}
+
+#endif
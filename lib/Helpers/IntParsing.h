@@ -41,6 +41,15 @@ const T parseInt(const String& s) {
   }
 }
 
+template <typename T>
+const T parseInt(const char* s) {
+  if (0 == strncmp(s, "0x", 2)) {
+    return strToHex<T>(s + 2, strlen(s + 2));
+  } else {
+    return atol(s);
+  }
+}
+
 template <typename T>
 void hexStrToBytes(const char* s, const size_t sLen, T* buffer, size_t maxLen) {
   int idx = 0;
@@ -1,13 +1,23 @@
 #include <BulbStateUpdater.h>
+#include <MiLightCommands.h>
 
 BulbStateUpdater::BulbStateUpdater(Settings& settings, MqttClient& mqttClient, GroupStateStore& stateStore)
   : settings(settings),
     mqttClient(mqttClient),
     stateStore(stateStore),
     lastFlush(0),
-    lastQueue(0),
     enabled(true)
-{ }
+{
+  if (mqttClient.hasDeviceStateTopic()) {
+    deviceStateBuffer.resize(MILIGHT_DEVICE_STATE_JSON_SIZE);
+
+    for (GroupStateField field : settings.groupStateFields) {
+      if (field != GroupStateField::DEVICE_ID && field != GroupStateField::GROUP_ID && field != GroupStateField::DEVICE_TYPE) {
+        deviceStateFields.push_back(field);
+      }
+    }
+  }
+}
 
 void BulbStateUpdater::enable() {
   this->enabled = true;
@@ -18,53 +28,162 @@ void BulbStateUpdater::disable() {
 }
 
 void BulbStateUpdater::enqueueUpdate(BulbId bulbId, GroupState& groupState) {
-  staleGroups.push(bulbId);
-  //Remember time, when queue was added for debounce delay
-  lastQueue = millis();
+  const unsigned long now = millis();
+
+  if (staleGroups.add(bulbId, now)) {
+    return;
+  }
 
+  if (canFlush()) {
+    // Out of room.  Publish the group that's been waiting longest rather than
+    // losing track of it.
+    BulbId oldest;
+    staleGroups.popOldest(oldest);
+    flush(oldest);
+    staleGroups.add(bulbId, now);
+  } else {
+    // Mid-update or rate limited, when publishing would send half-applied
+    // state.  Keep the group and let loop() publish it.
+    staleGroups.addOverflow(bulbId, now);
+  }
 }
 
 void BulbStateUpdater::loop() {
-  while (canFlush() && staleGroups.size() > 0) {
-    BulbId bulbId = staleGroups.shift();
-    GroupState* groupState = stateStore.get(bulbId);
+  BulbId bulbId;
+
+  while (canFlush() && staleGroups.popReady(millis(), settings.mqttDebounceDelay, settings.mqttStateMaxStaleness, bulbId)) {
+    flush(bulbId);
+  }
+}
+
+inline GroupStateWriter::Format BulbStateUpdater::payloadFormat() const {
+  return settings.mqttPayloadFormat == MqttPayloadFormat::MSGPACK ? GroupStateWriter::MSGPACK : GroupStateWriter::JSON;
+}
 
-    if (groupState->isMqttDirty()) {
-      flushGroup(bulbId, *groupState);
-      groupState->clearMqttDirty();
+inline void BulbStateUpdater::flush(const BulbId& first) {
+  BulbId bulbIds[MILIGHT_MAX_STALE_MQTT_GROUPS];
+  size_t count = 0;
+  bulbIds[count++] = first;
+
+  // Other groups of the same device that are also ready go in the same
+  // device state message
+  if (mqttClient.hasDeviceStateTopic()) {
+    const unsigned long now = millis();
+
+    while (count < MILIGHT_MAX_STALE_MQTT_GROUPS
+      && staleGroups.popReadySibling(first, now, settings.mqttDebounceDelay, settings.mqttStateMaxStaleness, bulbIds[count])) {
+      ++count;
+    }
+  }
+
+  size_t dirty = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    GroupState* groupState = stateStore.get(bulbIds[i]);
+
+    if (groupState != NULL && groupState->isMqttDirty()) {
+      if (mqttClient.hasStateTopic()) {
+        flushGroup(bulbIds[i], *groupState);
+      }
+      bulbIds[dirty++] = bulbIds[i];
     }
   }
+
+  if (dirty > 0 && mqttClient.hasDeviceStateTopic()) {
+    flushDevice(bulbIds, dirty);
+  }
+
+  for (size_t i = 0; i < dirty; i++) {
+    stateStore.get(bulbIds[i])->clearMqttDirty();
+  }
 }
 
 inline void BulbStateUpdater::flushGroup(BulbId bulbId, GroupState& state) {
-  char buffer[200];
-  StaticJsonDocument<200> json;
-  JsonObject message = json.to<JsonObject>();
+  char buffer[MILIGHT_STATE_JSON_SIZE];
+  GroupStateWriter writer(buffer, sizeof(buffer), payloadFormat());
 
-  state.applyState(message, bulbId, settings.groupStateFields);
-  serializeJson(json, buffer);
+  writer.beginObject();
+  writeGroupState(writer, bulbId, state, settings.groupStateFields);
+  writer.endObject();
 
-  //<Added by HC, send night mode state>
-  if (state.isNightMode()) {
-    mqttClient.sendState(*MiLightRemoteConfig::fromType(bulbId.deviceType),
-                          bulbId.deviceId,
-                          bulbId.groupId,
-                          "{\"state\": \"ON\", \"effect\": \"night_mode\"}"
-                          );
+  const size_t length = writer.finish();
+
+  if (length == 0) {
+    Serial.println(F("ERROR: group state is too large to publish"));
     return;
   }
-  //</Added by HC>
 
   mqttClient.sendState(
     *MiLightRemoteConfig::fromType(bulbId.deviceType),
     bulbId.deviceId,
     bulbId.groupId,
-    buffer
+    reinterpret_cast<const uint8_t*>(buffer),
+    length
   );
 
   lastFlush = millis();
 }
 
+// {"device_id":..., "device_type":..., "groups":[{"group_id":..., ...}, ...]}
+inline void BulbStateUpdater::flushDevice(const BulbId* bulbIds, size_t count) {
+  const BulbId& device = bulbIds[0];
+  GroupStateWriter writer(deviceStateBuffer.data(), deviceStateBuffer.size(), payloadFormat());
+
+  writer.beginObject();
+  writer.writeKey(GroupStateField::DEVICE_ID);
+  writer.writeValue(device.deviceId);
+  writer.writeKey(GroupStateField::DEVICE_TYPE);
+  writer.writeValue(MiLightRemoteTypeHelpers::remoteTypeName(device.deviceType));
+  writer.writeKey("groups");
+  writer.beginArray();
+
+  for (size_t i = 0; i < count; i++) {
+    writer.beginObject();
+    writer.writeKey(GroupStateField::GROUP_ID);
+    writer.writeValue(bulbIds[i].groupId);
+    writeGroupState(writer, bulbIds[i], *stateStore.get(bulbIds[i]), deviceStateFields);
+    writer.endObject();
+  }
+
+  writer.endArray();
+  writer.endObject();
+
+  const size_t length = writer.finish();
+
+  if (length == 0) {
+    Serial.println(F("ERROR: device state is too large to publish"));
+    return;
+  }
+
+  mqttClient.sendDeviceState(
+    *MiLightRemoteConfig::fromType(device.deviceType),
+    device.deviceId,
+    reinterpret_cast<const uint8_t*>(deviceStateBuffer.data()),
+    length
+  );
+
+  lastFlush = millis();
+}
+
+inline void BulbStateUpdater::writeGroupState(
+  GroupStateWriter& writer,
+  const BulbId& bulbId,
+  const GroupState& state,
+  const std::vector<GroupStateField>& fields
+) {
+  //<Added by HC, send night mode state>
+  if (state.isNightMode()) {
+    writer.writeKey(GroupStateField::STATE);
+    writer.writeValue("ON");
+    writer.writeKey(GroupStateField::EFFECT);
+    writer.writeValue(MiLightCommandNames::NIGHT_MODE);
+    return;
+  }
+  //</Added by HC>
+
+  state.writeState(writer, bulbId, fields);
+}
+
 inline bool BulbStateUpdater::canFlush() const {
-  return enabled && (millis() > (lastFlush + settings.mqttStateRateLimit) && millis() > (lastQueue + settings.mqttDebounceDelay));
+  return enabled && millis() - lastFlush >= settings.mqttStateRateLimit;
 }
@@ -4,12 +4,17 @@
 
 #include <stddef.h>
 #include <MqttClient.h>
-#include <CircularBuffer.h>
+#include <StaleGroupSet.h>
 #include <Settings.h>
 
 #ifndef BULB_STATE_UPDATER
 #define BULB_STATE_UPDATER
 
+// Enough for the states of every group of a device, with room to spare
+#ifndef MILIGHT_DEVICE_STATE_JSON_SIZE
+#define MILIGHT_DEVICE_STATE_JSON_SIZE 1024
+#endif
+
 class BulbStateUpdater {
 public:
   BulbStateUpdater(Settings& settings, MqttClient& mqttClient, GroupStateStore& stateStore);
@@ -23,12 +28,21 @@ private:
   Settings& settings;
   MqttClient& mqttClient;
   GroupStateStore& stateStore;
-  CircularBuffer<BulbId, MILIGHT_MAX_STALE_MQTT_GROUPS> staleGroups;
+  StaleGroupSet staleGroups;
   unsigned long lastFlush;
-  unsigned long lastQueue;
   bool enabled;
 
+  // Only allocated if the device state topic is configured
+  std::vector<char> deviceStateBuffer;
+  // groupStateFields without the ones identifying the group, which device
+  // states include once for the device, and once for each group
+  std::vector<GroupStateField> deviceStateFields;
+
+  inline GroupStateWriter::Format payloadFormat() const;
+  inline void flush(const BulbId& bulbId);
   inline void flushGroup(BulbId bulbId, GroupState& state);
+  inline void flushDevice(const BulbId* bulbIds, size_t count);
+  inline void writeGroupState(GroupStateWriter& writer, const BulbId& bulbId, const GroupState& state, const std::vector<GroupStateField>& fields);
   inline bool canFlush() const;
 };
 
@@ -0,0 +1,184 @@
+#include <CommandDelta.h>
+#include <GroupStateField.h>
+#include <MiLightCommands.h>
+#include <ParsedColor.h>
+#include <Units.h>
+
+#include <algorithm>
+
+// Kept in sync with RGB_WHITE_THRESHOLD in MiLightClient
+#define COMMAND_DELTA_WHITE_THRESHOLD 10
+
+CommandDelta::CommandDelta()
+  : fields(0),
+    numSteps(0),
+    hue(0),
+    saturation(0),
+    temperature(0),
+    mode(0),
+    level(0),
+    status(OFF)
+{ }
+
+CommandDelta CommandDelta::fromJson(JsonObject command) {
+  CommandDelta delta;
+
+  if (command.containsKey("repeats") && command["repeats"] == "NO") {
+    return delta;
+  }
+
+  if (command.containsKey("transition")) {
+    return delta;
+  }
+
+  // Fields are read in the order MiLightClient::update applies them, so the
+  // same field wins when a command sets it more than once, and is replayed
+  // where update() last sent it.
+  const char* effect = command[GroupStateFieldNames::EFFECT];
+  const bool isNightMode = effect != NULL && 0 == strcmp(effect, MiLightCommandNames::NIGHT_MODE);
+  bool hasStatus = false;
+
+  // update() ignores the status of a night mode command
+  if (isNightMode) {
+    hasStatus = false;
+  } else if (command.containsKey(GroupStateFieldNames::STATUS)) {
+    delta.status = parseMilightStatus(command[GroupStateFieldNames::STATUS]);
+    hasStatus = true;
+  } else if (command.containsKey(GroupStateFieldNames::STATE)) {
+    delta.status = parseMilightStatus(command[GroupStateFieldNames::STATE]);
+    hasStatus = true;
+  }
+
+  // update() switches to white ahead of everything else when an effect comes
+  // with a temperature
+  if (command.containsKey(GroupStateFieldNames::EFFECT)
+    && (command.containsKey(GroupStateFieldNames::COLOR_TEMP) || command.containsKey(GroupStateFieldNames::TEMPERATURE))) {
+    delta.set(WHITE);
+  }
+
+  // Always on first
+  if (hasStatus && delta.status == ON) {
+    delta.set(STATUS);
+  }
+
+  if (command.containsKey(GroupStateFieldNames::HUE)) {
+    delta.hue = command[GroupStateFieldNames::HUE];
+    delta.set(HUE);
+  }
+
+  if (command.containsKey(GroupStateFieldNames::SATURATION)) {
+    delta.saturation = command[GroupStateFieldNames::SATURATION];
+    delta.set(SATURATION);
+  }
+
+  if (command.containsKey(GroupStateFieldNames::KELVIN)) {
+    delta.temperature = command[GroupStateFieldNames::KELVIN];
+    delta.set(TEMPERATURE);
+  }
+
+  if (command.containsKey(GroupStateFieldNames::TEMPERATURE)) {
+    delta.temperature = command[GroupStateFieldNames::TEMPERATURE];
+    delta.set(TEMPERATURE);
+  }
+
+  if (command.containsKey(GroupStateFieldNames::COLOR_TEMP)) {
+    delta.temperature = Units::miredsToWhiteVal(command[GroupStateFieldNames::COLOR_TEMP], 100);
+    delta.set(TEMPERATURE);
+  }
+
+  if (command.containsKey(GroupStateFieldNames::MODE)) {
+    delta.mode = command[GroupStateFieldNames::MODE];
+    delta.set(MODE);
+  }
+
+  // The white effects are dropped by update(), since color_temp already sets white
+  if (effect != NULL) {
+    if (isNightMode) {
+      delta.set(NIGHT_MODE);
+    } else if (0 != strcmp(effect, "white") && 0 != strcmp(effect, "white_mode")) {
+      delta.mode = atoi(effect);
+      delta.set(MODE);
+    }
+  }
+
+  if (command.containsKey(GroupStateFieldNames::COLOR)) {
+    ParsedColor color = ParsedColor::fromJson(command[GroupStateFieldNames::COLOR]);
+
+    if (color.success) {
+      if ( abs(color.r - color.g) < COMMAND_DELTA_WHITE_THRESHOLD
+        && abs(color.g - color.b) < COMMAND_DELTA_WHITE_THRESHOLD
+        && abs(color.r - color.b) < COMMAND_DELTA_WHITE_THRESHOLD) {
+        delta.set(WHITE);
+      } else {
+        delta.hue = color.hue;
+        delta.saturation = color.saturation;
+        delta.set(HUE);
+        delta.set(SATURATION);
+      }
+    }
+  }
+
+  if (command.containsKey(GroupStateFieldNames::LEVEL)) {
+    delta.level = command[GroupStateFieldNames::LEVEL];
+    delta.set(LEVEL);
+  }
+
+  if (command.containsKey(GroupStateFieldNames::BRIGHTNESS)) {
+    delta.level = Units::rescale<uint16_t, uint16_t>(command[GroupStateFieldNames::BRIGHTNESS], 100, 255);
+    delta.set(LEVEL);
+  }
+
+  if (command.containsKey(GroupStateFieldNames::COMMAND)) {
+    delta.parseCommand(command[GroupStateFieldNames::COMMAND]);
+  }
+
+  if (command.containsKey(GroupStateFieldNames::COMMANDS)) {
+    JsonArray commands = command[GroupStateFieldNames::COMMANDS];
+
+    for (JsonVariant command : commands) {
+      delta.parseCommand(command);
+    }
+  }
+
+  // Always off last
+  if (hasStatus && delta.status == OFF) {
+    delta.set(STATUS);
+  }
+
+  return delta;
+}
+
+bool CommandDelta::has(Field field) const {
+  return fields & field;
+}
+
+bool CommandDelta::isEmpty() const {
+  return fields == 0;
+}
+
+void CommandDelta::set(Field field) {
+  if (has(field)) {
+    Field* end = std::remove(steps, steps + numSteps, field);
+    numSteps = end - steps;
+  }
+
+  steps[numSteps++] = field;
+  fields |= field;
+}
+
+void CommandDelta::parseCommand(JsonVariant command) {
+  const char* name = command.is<JsonObject>()
+    ? command[GroupStateFieldNames::COMMAND].as<const char*>()
+    : command.as<const char*>();
+
+  if (name == NULL) {
+    return;
+  }
+
+  // Only commands which set an absolute state are worth repeating
+  if (0 == strcmp(name, MiLightCommandNames::SET_WHITE)) {
+    set(WHITE);
+  } else if (0 == strcmp(name, MiLightCommandNames::NIGHT_MODE)) {
+    set(NIGHT_MODE);
+  }
+}
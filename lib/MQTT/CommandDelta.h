@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include <ArduinoJson.h>
+#include <MiLightStatus.h>
+
+#ifndef _COMMAND_DELTA_H
+#define _COMMAND_DELTA_H
+
+/**
+ * The absolute settings from a command, parsed once so that the command can
+ * be sent again without going back through JSON.
+ *
+ * Relative and one-off commands (level_up, pair, raw button presses, etc.)
+ * and commands with a transition aren't included, since sending those a
+ * second time would change the result rather than reinforce it.
+ */
+struct CommandDelta {
+  enum Field : uint16_t {
+    STATUS      = 1 << 0,
+    HUE         = 1 << 1,
+    SATURATION  = 1 << 2,
+    TEMPERATURE = 1 << 3,
+    MODE        = 1 << 4,
+    WHITE       = 1 << 5,
+    NIGHT_MODE  = 1 << 6,
+    LEVEL       = 1 << 7
+  };
+
+  static const uint8_t NUM_FIELDS = 8;
+
+  uint16_t fields;
+  // Fields in the order MiLightClient::update sends them.  A field set more
+  // than once keeps the position of its last setting.
+  Field steps[NUM_FIELDS];
+  uint8_t numSteps;
+  uint16_t hue;
+  uint8_t saturation;
+  // 0-100, as accepted by MiLightClient::updateTemperature
+  uint8_t temperature;
+  uint8_t mode;
+  // 0-100, as accepted by MiLightClient::updateBrightness
+  uint8_t level;
+  MiLightStatus status;
+
+  CommandDelta();
+
+  // Reads a command in the format accepted by MiLightClient::update
+  static CommandDelta fromJson(JsonObject command);
+
+  bool has(Field field) const;
+  bool isEmpty() const;
+
+  // Sends the command again through the setters of `client`, which is
+  // usually a MiLightClient prepared for the target bulb.
+  template <typename Client>
+  void apply(Client& client) const {
+    for (size_t i = 0; i < numSteps; i++) {
+      switch (steps[i]) {
+        case STATUS:
+          client.updateStatus(status);
+          break;
+        case HUE:
+          client.updateHue(hue);
+          break;
+        case SATURATION:
+          client.updateSaturation(saturation);
+          break;
+        case TEMPERATURE:
+          client.updateTemperature(temperature);
+          break;
+        case MODE:
+          client.updateMode(mode);
+          break;
+        case WHITE:
+          client.updateColorWhite();
+          break;
+        case NIGHT_MODE:
+          client.enableNightMode();
+          break;
+        case LEVEL:
+          client.updateBrightness(level);
+          break;
+      }
+    }
+  }
+
+private:
+  void set(Field field);
+  void parseCommand(JsonVariant command);
+};
+
+#endif
@@ -0,0 +1,65 @@
+#include <CommandRepeatQueue.h>
+
+CommandRepeatQueue::CommandRepeatQueue()
+  : count(0)
+{ }
+
+void CommandRepeatQueue::put(const BulbId& bulbId, const CommandDelta& delta) {
+  const int index = indexOf(bulbId);
+
+  if (index >= 0) {
+    entries[index].delta = delta;
+    return;
+  }
+
+  if (count == MILIGHT_MAX_REPEATED_MQTT_COMMANDS) {
+    removeAt(0);
+  }
+
+  Entry& entry = entries[count++];
+  entry.bulbId = bulbId;
+  entry.delta = delta;
+}
+
+void CommandRepeatQueue::remove(const BulbId& bulbId) {
+  const int index = indexOf(bulbId);
+
+  if (index >= 0) {
+    removeAt(index);
+  }
+}
+
+bool CommandRepeatQueue::pop(BulbId& bulbId, CommandDelta& delta) {
+  if (count == 0) {
+    return false;
+  }
+
+  bulbId = entries[0].bulbId;
+  delta = entries[0].delta;
+  removeAt(0);
+
+  return true;
+}
+
+size_t CommandRepeatQueue::size() const {
+  return count;
+}
+
+int CommandRepeatQueue::indexOf(const BulbId& bulbId) const {
+  const uint32_t id = bulbId.getCompactId();
+
+  for (size_t i = 0; i < count; i++) {
+    if (entries[i].bulbId.getCompactId() == id) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+void CommandRepeatQueue::removeAt(size_t index) {
+  for (size_t i = index + 1; i < count; i++) {
+    entries[i - 1] = entries[i];
+  }
+  count--;
+}
@@ -0,0 +1,42 @@
+#include <stddef.h>
+#include <BulbId.h>
+#include <CommandDelta.h>
+
+#ifndef _COMMAND_REPEAT_QUEUE_H
+#define _COMMAND_REPEAT_QUEUE_H
+
+#ifndef MILIGHT_MAX_REPEATED_MQTT_COMMANDS
+#define MILIGHT_MAX_REPEATED_MQTT_COMMANDS 16
+#endif
+
+/**
+ * Commands waiting to be sent a second time, at most one per group.
+ *
+ * A newer command for a group replaces the one that's waiting, keeping its
+ * place in line.  When full, the oldest command is dropped, since it's already
+ * been sent once.
+ */
+class CommandRepeatQueue {
+public:
+  CommandRepeatQueue();
+
+  void put(const BulbId& bulbId, const CommandDelta& delta);
+  void remove(const BulbId& bulbId);
+  bool pop(BulbId& bulbId, CommandDelta& delta);
+
+  size_t size() const;
+
+private:
+  struct Entry {
+    BulbId bulbId;
+    CommandDelta delta;
+  };
+
+  Entry entries[MILIGHT_MAX_REPEATED_MQTT_COMMANDS];
+  size_t count;
+
+  int indexOf(const BulbId& bulbId) const;
+  void removeAt(size_t index);
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include <DeferredCommandQueue.h>
+
+DeferredCommandQueue::DeferredCommandQueue()
+  : deferred(0),
+    merged(0),
+    dropped(0)
+{ }
+
+void DeferredCommandQueue::put(const BulbId& bulbId, const uint8_t* payload, size_t length) {
+  const int index = indexOf(bulbId);
+  ++deferred;
+
+  if (index >= 0) {
+    commands[index].payload.assign(payload, payload + length);
+    ++merged;
+    return;
+  }
+
+  if (commands.size() >= MILIGHT_MAX_DEFERRED_MQTT_COMMANDS) {
+    commands.erase(commands.begin());
+    ++dropped;
+  }
+
+  commands.push_back({ bulbId, std::vector<uint8_t>(payload, payload + length) });
+}
+
+void DeferredCommandQueue::supersede(const BulbId& bulbId) {
+  const int index = indexOf(bulbId);
+
+  if (index >= 0) {
+    commands.erase(commands.begin() + index);
+    ++dropped;
+  }
+}
+
+bool DeferredCommandQueue::pop(Command& command) {
+  if (commands.empty()) {
+    return false;
+  }
+
+  command = std::move(commands.front());
+  commands.erase(commands.begin());
+
+  return true;
+}
+
+size_t DeferredCommandQueue::size() const {
+  return commands.size();
+}
+
+size_t DeferredCommandQueue::deferredCommands() const {
+  return deferred;
+}
+
+size_t DeferredCommandQueue::mergedCommands() const {
+  return merged;
+}
+
+size_t DeferredCommandQueue::droppedCommands() const {
+  return dropped;
+}
+
+int DeferredCommandQueue::indexOf(const BulbId& bulbId) const {
+  const uint32_t id = bulbId.getCompactId();
+
+  for (size_t i = 0; i < commands.size(); i++) {
+    if (commands[i].bulbId.getCompactId() == id) {
+      return i;
+    }
+  }
+
+  return -1;
+}
@@ -0,0 +1,50 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <BulbId.h>
+
+#ifndef _DEFERRED_COMMAND_QUEUE_H
+#define _DEFERRED_COMMAND_QUEUE_H
+
+#ifndef MILIGHT_MAX_DEFERRED_MQTT_COMMANDS
+#define MILIGHT_MAX_DEFERRED_MQTT_COMMANDS 8
+#endif
+
+/**
+ * Commands received while a wall switch button is held, to be run once the
+ * button is released.  At most one command is kept per group.
+ *
+ * A newer command for a group replaces the one that's waiting, keeping its
+ * place in line.  Commands for a group the button changed are dropped, since
+ * the button press is newer.  When full, the oldest command is dropped.
+ */
+class DeferredCommandQueue {
+public:
+  struct Command {
+    BulbId bulbId;
+    // Raw payload as received, JSON or MessagePack
+    std::vector<uint8_t> payload;
+  };
+
+  DeferredCommandQueue();
+
+  void put(const BulbId& bulbId, const uint8_t* payload, size_t length);
+  // Drops the command waiting for this group, if any
+  void supersede(const BulbId& bulbId);
+  bool pop(Command& command);
+
+  size_t size() const;
+  size_t deferredCommands() const;
+  size_t mergedCommands() const;
+  size_t droppedCommands() const;
+
+private:
+  std::vector<Command> commands;
+  size_t deferred;
+  size_t merged;
+  size_t dropped;
+
+  int indexOf(const BulbId& bulbId) const;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include <GroupAliasIndex.h>
+#include <Fnv1a.h>
+
+const uint16_t GroupAliasIndex::EMPTY_SLOT;
+
+GroupAliasIndex::GroupAliasIndex(const std::map<String, BulbId>& aliases) {
+  size_t numSlots = 4;
+
+  // Keep tables at most half full, so probe sequences stay short
+  while (numSlots < aliases.size() * 2) {
+    numSlots <<= 1;
+  }
+
+  mask = numSlots - 1;
+  byAlias.assign(numSlots, EMPTY_SLOT);
+  byBulbId.assign(numSlots, EMPTY_SLOT);
+
+  for (auto itr = aliases.begin(); itr != aliases.end() && entries.size() < EMPTY_SLOT; ++itr) {
+    const uint16_t index = entries.size();
+    entries.push_back({ itr->first, itr->second });
+
+    // Aliases are unique, since they're map keys
+    size_t slot = hash(itr->first.c_str()) & mask;
+    while (byAlias[slot] != EMPTY_SLOT) {
+      slot = (slot + 1) & mask;
+    }
+    byAlias[slot] = index;
+
+    // The map is sorted, so the first alias seen for a group sorts first
+    const uint32_t compactId = itr->second.getCompactId();
+    slot = hash(itr->second) & mask;
+    while (byBulbId[slot] != EMPTY_SLOT && entries[byBulbId[slot]].bulbId.getCompactId() != compactId) {
+      slot = (slot + 1) & mask;
+    }
+    if (byBulbId[slot] == EMPTY_SLOT) {
+      byBulbId[slot] = index;
+    }
+  }
+}
+
+const BulbId* GroupAliasIndex::find(const char* alias) const {
+  for (size_t slot = hash(alias) & mask; byAlias[slot] != EMPTY_SLOT; slot = (slot + 1) & mask) {
+    const Entry& entry = entries[byAlias[slot]];
+
+    if (0 == strcmp(entry.alias.c_str(), alias)) {
+      return &entry.bulbId;
+    }
+  }
+
+  return NULL;
+}
+
+const char* GroupAliasIndex::findAlias(const BulbId& bulbId) const {
+  const uint32_t compactId = bulbId.getCompactId();
+
+  for (size_t slot = hash(bulbId) & mask; byBulbId[slot] != EMPTY_SLOT; slot = (slot + 1) & mask) {
+    const Entry& entry = entries[byBulbId[slot]];
+
+    if (entry.bulbId.getCompactId() == compactId) {
+      return entry.alias.c_str();
+    }
+  }
+
+  return NULL;
+}
+
+size_t GroupAliasIndex::size() const {
+  return entries.size();
+}
+
+uint32_t GroupAliasIndex::hash(const char* alias) {
+  return fnv1a(alias);
+}
+
+uint32_t GroupAliasIndex::hash(const BulbId& bulbId) {
+  // Fibonacci hashing, taking the high bits since the low ones are poorly mixed
+  const uint32_t hash = bulbId.getCompactId() * 2654435761UL;
+  return (hash >> 16) | (hash << 16);
+}
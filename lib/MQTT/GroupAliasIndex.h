@@ -0,0 +1,47 @@
+#include <Arduino.h>
+#include <BulbId.h>
+#include <map>
+#include <vector>
+
+#ifndef _GROUP_ALIAS_INDEX_H
+#define _GROUP_ALIAS_INDEX_H
+
+/**
+ * Hash indexes over the group aliases in settings, in both directions, so that
+ * binding and matching MQTT topics don't have to walk the alias map.
+ *
+ * Built once from a copy of the aliases, so it's unaffected by later changes
+ * to settings.
+ */
+class GroupAliasIndex {
+public:
+  GroupAliasIndex(const std::map<String, BulbId>& aliases);
+
+  // NULL if there's no such alias
+  const BulbId* find(const char* alias) const;
+
+  // NULL if the group doesn't have an alias.  If it has several, returns the
+  // one that sorts first.
+  const char* findAlias(const BulbId& bulbId) const;
+
+  size_t size() const;
+
+private:
+  static const uint16_t EMPTY_SLOT = 0xFFFF;
+
+  struct Entry {
+    String alias;
+    BulbId bulbId;
+  };
+
+  std::vector<Entry> entries;
+  // Indexes into entries, open addressed with linear probing
+  std::vector<uint16_t> byAlias;
+  std::vector<uint16_t> byBulbId;
+  size_t mask;
+
+  static uint32_t hash(const char* alias);
+  static uint32_t hash(const BulbId& bulbId);
+};
+
+#endif
@@ -11,8 +11,12 @@ void HomeAssistantDiscoveryClient::sendDiscoverableDevices(const std::map<String
   Serial.println(F("HomeAssistantDiscoveryClient: Sending discoverable devices..."));
 #endif
 
+  // Replaces any work left over from a previous connection
+  pendingAdditions.clear();
+  pendingAdditions.reserve(aliases.size());
+
   for (auto itr = aliases.begin(); itr != aliases.end(); ++itr) {
-    addConfig(itr->first.c_str(), itr->second);
+    pendingAdditions.push_back(std::make_pair(itr->first, itr->second));
   }
 }
 
@@ -22,8 +26,37 @@ void HomeAssistantDiscoveryClient::removeOldDevices(const std::map<uint32_t, Bul
 #endif
 
   for (auto itr = aliases.begin(); itr != aliases.end(); ++itr) {
-    removeConfig(itr->second);
+    pendingRemovals.push_back(itr->second);
+  }
+}
+
+void HomeAssistantDiscoveryClient::handleClient() {
+  if (isIdle()) {
+    return;
+  }
+
+  // Published configs are retained, so don't let them pile up in the outbox
+  // while the broker is away or still catching up
+  if (! mqttClient->isConnected() || ! mqttClient->getOutbox().isEmpty()) {
+    return;
   }
+
+  const unsigned long start = micros();
+
+  do {
+    if (! pendingRemovals.empty()) {
+      removeConfig(pendingRemovals.back());
+      pendingRemovals.pop_back();
+    } else {
+      const std::pair<String, BulbId>& next = pendingAdditions.back();
+      addConfig(next.first.c_str(), next.second);
+      pendingAdditions.pop_back();
+    }
+  } while (! isIdle() && micros() - start < MQTT_DISCOVERY_LOOP_BUDGET_US);
+}
+
+bool HomeAssistantDiscoveryClient::isIdle() const {
+  return pendingRemovals.empty() && pendingAdditions.empty();
 }
 
 void HomeAssistantDiscoveryClient::removeConfig(const BulbId& bulbId) {
@@ -124,7 +157,6 @@ void HomeAssistantDiscoveryClient::addConfig(const char* alias, const BulbId& bu
   Serial.printf_P(PSTR("  topic: %s\nconfig: %s\n"), topic.c_str(), message.c_str());
 #endif
 
-
   mqttClient->send(topic.c_str(), message.c_str(), true);
 }
 
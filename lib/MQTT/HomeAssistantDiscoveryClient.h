@@ -3,7 +3,20 @@
 #include <BulbId.h>
 #include <MqttClient.h>
 #include <map>
+#include <vector>
 
+// Time spent publishing discovery configs per call to handleClient().  At least
+// one config is always sent, so progress is made even if a single publish is slow.
+#ifndef MQTT_DISCOVERY_LOOP_BUDGET_US
+#define MQTT_DISCOVERY_LOOP_BUDGET_US 3000
+#endif
+
+/**
+ * Publishes Home Assistant discovery configs incrementally.  Calls to
+ * sendDiscoverableDevices() and removeOldDevices() only queue the work, which
+ * handleClient() drains from the main loop within a time budget.  Every config is
+ * published on each connection, since a broker without persistence loses them.
+ */
 class HomeAssistantDiscoveryClient {
 public:
   HomeAssistantDiscoveryClient(Settings& settings, MqttClient* mqttClient);
@@ -14,11 +27,19 @@ public:
   void sendDiscoverableDevices(const std::map<String, BulbId>& aliases);
   void removeOldDevices(const std::map<uint32_t, BulbId>& aliases);
 
+  void handleClient();
+  bool isIdle() const;
+
 private:
   Settings& settings;
   MqttClient* mqttClient;
 
+  // Removals are sent before additions, so a group that was deleted and re-added
+  // ends up with a config
+  std::vector<BulbId> pendingRemovals;
+  std::vector<std::pair<String, BulbId>> pendingAdditions;
+
   String buildTopic(const BulbId& bulbId);
   String bindTopicVariables(const String& topic, const char* alias, const BulbId& bulbId);
   void addNumberedEffects(JsonArray& effectList, uint8_t start, uint8_t end);
-};
\ No newline at end of file
+};
@@ -0,0 +1,143 @@
+#include <HubSync.h>
+#include <GroupStateField.h>
+#include <MiLightCommands.h>
+#include <string.h>
+
+static const char* HUB_ID_KEY = "hub_id";
+static const char* VERSION_KEY = "version";
+static const char* GROUP_STATE_KEY = "group_state";
+
+// Written in a form GroupState::patch and MiLightClient::update both accept.
+// writeState skips the ones that don't apply to the bulb's mode.
+static const std::vector<GroupStateField> SYNC_FIELDS = {
+  GroupStateField::STATE,
+  GroupStateField::BRIGHTNESS,
+  GroupStateField::HUE,
+  GroupStateField::SATURATION,
+  GroupStateField::MODE,
+  GroupStateField::COLOR_TEMP
+};
+
+bool HubSync::Stamp::isNewerThan(const Stamp& other) const {
+  return version > other.version || (version == other.version && hubId > other.hubId);
+}
+
+HubSync::HubSync(uint32_t hubId, const DeviceIdSet& ownedDeviceIds)
+  : hubId(hubId),
+    ownedDeviceIds(ownedDeviceIds),
+    clock(0),
+    count(0)
+{ }
+
+void HubSync::writeMessage(GroupStateWriter& writer, const BulbId& bulbId, const GroupState& state) {
+  const Stamp stamp = { ++clock, hubId };
+  record(bulbId.getCompactId(), stamp);
+
+  writer.beginObject();
+  writer.writeKey(HUB_ID_KEY);
+  writer.writeValue(stamp.hubId);
+  writer.writeKey(VERSION_KEY);
+  writer.writeValue(stamp.version);
+  writer.writeKey(GroupStateField::DEVICE_ID);
+  writer.writeValue(bulbId.deviceId);
+  writer.writeKey(GroupStateField::DEVICE_TYPE);
+  writer.writeValue(MiLightRemoteTypeHelpers::remoteTypeName(bulbId.deviceType));
+  writer.writeKey(GroupStateField::GROUP_ID);
+  writer.writeValue(bulbId.groupId);
+
+  writer.writeKey(GROUP_STATE_KEY);
+  writer.beginObject();
+  state.writeState(writer, bulbId, SYNC_FIELDS);
+
+  // Night mode has no field of its own that patch() reads
+  if (state.isSetBulbMode() && state.getBulbMode() == BULB_MODE_NIGHT) {
+    writer.writeKey(GroupStateFieldNames::COMMAND);
+    writer.writeValue(MiLightCommandNames::NIGHT_MODE);
+  }
+
+  writer.endObject();
+  writer.endObject();
+}
+
+HubSync::Result HubSync::handleMessage(JsonObject message, GroupStateStore& stateStore, BulbId& bulbId, JsonObject& state) {
+  state = message[GROUP_STATE_KEY];
+  const char* deviceType = message[GroupStateFieldNames::DEVICE_TYPE];
+
+  if (state.isNull() || deviceType == NULL
+    || ! message.containsKey(HUB_ID_KEY) || ! message.containsKey(VERSION_KEY)
+    || ! message.containsKey(GroupStateFieldNames::DEVICE_ID) || ! message.containsKey(GroupStateFieldNames::GROUP_ID)) {
+    return INVALID;
+  }
+
+  bulbId = BulbId(
+    message[GroupStateFieldNames::DEVICE_ID].as<uint16_t>(),
+    message[GroupStateFieldNames::GROUP_ID].as<uint8_t>(),
+    MiLightRemoteTypeHelpers::remoteTypeFromString(deviceType)
+  );
+
+  if (bulbId.deviceType == REMOTE_TYPE_UNKNOWN) {
+    return INVALID;
+  }
+
+  const Stamp stamp = { message[VERSION_KEY].as<uint32_t>(), message[HUB_ID_KEY].as<uint32_t>() };
+  const uint32_t id = bulbId.getCompactId();
+  const int previous = find(id);
+
+  // Lamport clock: the next local change is newer than anything seen so far
+  if (stamp.version > clock) {
+    clock = stamp.version;
+  }
+
+  const bool isNewer = previous < 0 || stamp.isNewerThan(entries[previous].stamp);
+
+  if (isNewer) {
+    record(id, stamp);
+  }
+
+  // Includes retained messages sent before this hub restarted.  Its own state
+  // already reflects them.
+  if (stamp.hubId == hubId) {
+    return OWN_MESSAGE;
+  }
+
+  if (! isNewer) {
+    return STALE;
+  }
+
+  const GroupState* current = stateStore.get(bulbId);
+  GroupState merged = current != NULL ? *current : GroupState::defaultState(bulbId.deviceType);
+
+  if (! merged.patch(state)) {
+    return UNCHANGED;
+  }
+
+  stateStore.set(bulbId, merged);
+
+  // Without a previous version, this could be a retained message older than
+  // a change that was never announced, e.g. one from before a restart
+  return previous >= 0 && ownedDeviceIds.contains(bulbId.deviceId) ? TRANSMIT : STORED;
+}
+
+size_t HubSync::size() const {
+  return count;
+}
+
+int HubSync::find(uint32_t id) const {
+  for (size_t i = 0; i < count; i++) {
+    if (entries[i].id == id) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+void HubSync::record(uint32_t id, const Stamp& stamp) {
+  const int index = find(id);
+  const size_t shifted = index >= 0
+    ? index
+    : (count < MILIGHT_HUB_SYNC_TABLE_SIZE ? count++ : MILIGHT_HUB_SYNC_TABLE_SIZE - 1);
+
+  memmove(&entries[1], &entries[0], shifted * sizeof(Entry));
+  entries[0] = { id, stamp };
+}
@@ -0,0 +1,95 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <ArduinoJson.h>
+#include <BulbId.h>
+#include <DeviceIdSet.h>
+#include <GroupState.h>
+#include <GroupStateStore.h>
+#include <GroupStateWriter.h>
+
+#ifndef _HUB_SYNC_H
+#define _HUB_SYNC_H
+
+// Groups whose latest version is remembered.  Each entry is 12 bytes.
+#ifndef MILIGHT_HUB_SYNC_TABLE_SIZE
+#define MILIGHT_HUB_SYNC_TABLE_SIZE 32
+#endif
+
+/**
+ * Keeps group states in sync between hubs that share bulbs.
+ *
+ * Each change made at a hub is stamped with a version from a Lamport clock
+ * and the hub's ID.  For each group, the message with the newest stamp wins
+ * no matter what order messages arrive in, and ties between hubs are broken
+ * by hub ID.  Messages carry the whole state of the group, so applying one
+ * twice, or skipping one that's been superseded, doesn't matter.
+ *
+ * Versions are kept for the most recently changed groups only.  A message
+ * for a group without a version (forgotten, or replayed by the broker after
+ * a restart) is applied to the state as if it were newer, but never resent
+ * over RF, since it may be older than what the bulb last received.  Hubs
+ * announce every change to the groups they control, so the retained message
+ * for a group is its latest state.
+ *
+ * A hub only resends a change over RF if it controls the bulb (the device ID
+ * is one of its gateway device IDs), it remembers a version for the group,
+ * and the change isn't already reflected in its state.
+ */
+class HubSync {
+public:
+  enum Result {
+    // Sent by this hub, and only used to catch up the clock
+    OWN_MESSAGE,
+    INVALID,
+    // Not newer than the last message applied to the same group
+    STALE,
+    // Newer, but the state already matched
+    UNCHANGED,
+    // State updated.  The bulb is controlled by another hub, or the message
+    // may be stale.
+    STORED,
+    // State updated, and should be sent to the bulb
+    TRANSMIT
+  };
+
+  struct Stamp {
+    uint32_t version;
+    uint32_t hubId;
+
+    bool isNewerThan(const Stamp& other) const;
+  };
+
+  HubSync(uint32_t hubId, const DeviceIdSet& ownedDeviceIds);
+
+  // Stamps a change made at this hub and writes the message announcing it
+  void writeMessage(GroupStateWriter& writer, const BulbId& bulbId, const GroupState& state);
+
+  // Merges a message from another hub into stateStore.  Sets bulbId to the
+  // group the message is for, and state to the group's state from the
+  // message, which is also the command to send for TRANSMIT.
+  Result handleMessage(JsonObject message, GroupStateStore& stateStore, BulbId& bulbId, JsonObject& state);
+
+  // Number of groups whose version is remembered
+  size_t size() const;
+
+private:
+  const uint32_t hubId;
+  const DeviceIdSet& ownedDeviceIds;
+  uint32_t clock;
+
+  struct Entry {
+    // BulbId compact ID
+    uint32_t id;
+    Stamp stamp;
+  };
+
+  // Most recently used first
+  Entry entries[MILIGHT_HUB_SYNC_TABLE_SIZE];
+  size_t count;
+
+  int find(uint32_t id) const;
+  // Makes stamp the newest for id, dropping the least recently used group if full
+  void record(uint32_t id, const Stamp& stamp);
+};
+
+#endif
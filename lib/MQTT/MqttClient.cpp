@@ -1,7 +1,5 @@
 #include <stddef.h>
 #include <MqttClient.h>
-#include <TokenIterator.h>
-#include <UrlTokenBindings.h>
 #include <IntParsing.h>
 #include <ArduinoJson.h>
 #include <WiFiClient.h>
@@ -13,10 +11,24 @@ static const char* STATUS_CONNECTED = "connected";
 static const char* STATUS_DISCONNECTED = "disconnected_clean";
 static const char* STATUS_LWT_DISCONNECTED = "disconnected_unclean";
 
-MqttClient::MqttClient(Settings& settings, MiLightClient*& milightClient)
+MqttClient::MqttClient(Settings& settings, MiLightClient*& milightClient, GroupStateStore*& stateStore)
   : mqttClient(tcpClient),
     milightClient(milightClient),
+    stateStore(stateStore),
     settings(settings),
+    lastCommandTime(0),
+    commandTopic(settings.mqttTopicPattern),
+    updateTopic(settings.mqttUpdateTopicPattern),
+    stateTopic(settings.mqttStateTopicPattern),
+    deviceStateTopic(settings.mqttDeviceStateTopicPattern),
+    commandTopicMatcher(settings.mqttTopicPattern),
+    aliases(settings.groupIdAliases),
+    gatewayDeviceIds(
+      settings.gatewayConfigs.begin(),
+      settings.gatewayConfigs.end(),
+      [](const std::shared_ptr<GatewayConfig>& config) { return config->deviceId; }
+    ),
+    hubSync(ESP.getChipId(), gatewayDeviceIds),
     lastConnectAttempt(0)
 {
   String strDomain = settings.mqttServer();
@@ -41,6 +53,18 @@ void MqttClient::disableReceive() {
   this->enabledReceive = false;
 }
 
+bool MqttClient::isReceiveEnabled() const {
+  return this->enabledReceive;
+}
+
+void MqttClient::supersedeDeferredCommand(const BulbId& bulbId) {
+  deferredCommands.supersede(bulbId);
+}
+
+const DeferredCommandQueue& MqttClient::getDeferredCommands() const {
+  return deferredCommands;
+}
+
 void MqttClient::onConnect(OnConnectFn fn) {
   this->onConnectFn = fn;
 }
@@ -151,42 +175,89 @@ void MqttClient::handleClient() {
     this->connected = false;
   }
 
-  //<Added by HC: send command multiple after a second to ensure lamps received the command>
-  while (millis() - lastCommandTime > repeatTimer && bulbIds.Count() > 0) {
-    
-    BulbId bulbId = bulbIds.First();
-    bulbIds.RemoveFirst();
-    Command command = commands.First();
-    commands.RemoveFirst();
-
-    StaticJsonDocument<400> buffer;
-    deserializeJson(buffer, command.command);
-    JsonObject obj = buffer.as<JsonObject>();
-
-    if (obj.containsKey("repeats")) {
-      if (obj["repeats"] == "NO") {
-        continue;
-      }
-    }
+  if (this->connected) {
+    flushOutbox();
+  }
 
-    if (bulbIds.Count() == 0) {
-      commands.Clear();
-    }
-    
+  //<Added by HC: run commands that arrived while a button was held, one per loop>
+  DeferredCommandQueue::Command deferred;
+
+  if (this->enabledReceive == true && deferredCommands.pop(deferred)) {
+    handleCommand(deferred.bulbId, deferred.payload.data(), deferred.payload.size());
+  }
+
+  //send command multiple after a second to ensure lamps received the command
+  BulbId bulbId;
+  CommandDelta delta;
+
+  while (millis() - lastCommandTime > repeatTimer && repeatQueue.pop(bulbId, delta)) {
     if (this->enabledReceive == true) {
-      milightClient->prepare(bulbId.deviceType, bulbId.deviceId, bulbId.groupId);
-      milightClient->update(obj);
+      repeatCommand(bulbId, delta);
     }
   }
   //</Added by HC
 }
 
 void MqttClient::sendUpdate(const MiLightRemoteConfig& remoteConfig, uint16_t deviceId, uint16_t groupId, const char* update) {
-  publish(settings.mqttUpdateTopicPattern, remoteConfig, deviceId, groupId, update, false);
+  sendUpdate(remoteConfig, deviceId, groupId, reinterpret_cast<const uint8_t*>(update), strlen(update));
+}
+
+void MqttClient::sendUpdate(const MiLightRemoteConfig& remoteConfig, uint16_t deviceId, uint16_t groupId, const uint8_t* update, size_t length) {
+  publish(updateTopic, remoteConfig, deviceId, groupId, update, length, false);
 }
 
 void MqttClient::sendState(const MiLightRemoteConfig& remoteConfig, uint16_t deviceId, uint16_t groupId, const char* update) {
-  publish(settings.mqttStateTopicPattern, remoteConfig, deviceId, groupId, update, true);
+  sendState(remoteConfig, deviceId, groupId, reinterpret_cast<const uint8_t*>(update), strlen(update));
+}
+
+void MqttClient::sendState(const MiLightRemoteConfig& remoteConfig, uint16_t deviceId, uint16_t groupId, const uint8_t* update, size_t length) {
+  publish(stateTopic, remoteConfig, deviceId, groupId, update, length, true);
+}
+
+void MqttClient::sendDeviceState(const MiLightRemoteConfig& remoteConfig, uint16_t deviceId, const uint8_t* update, size_t length) {
+  // Only some of the device's groups are included, so retaining this would be misleading
+  publish(deviceStateTopic, remoteConfig, deviceId, 0, update, length, false);
+}
+
+bool MqttClient::hasStateTopic() const {
+  return ! stateTopic.isEmpty();
+}
+
+bool MqttClient::hasDeviceStateTopic() const {
+  return ! deviceStateTopic.isEmpty();
+}
+
+void MqttClient::sendSync(const BulbId& bulbId, const GroupState& state) {
+  char topic[MQTT_MAX_TOPIC_LENGTH];
+  snprintf_P(
+    topic,
+    sizeof(topic),
+    PSTR("%s/%s/%s/%u"),
+    settings.mqttSyncTopicPrefix.c_str(),
+    bulbId.getHexDeviceId().c_str(),
+    MiLightRemoteTypeHelpers::remoteTypeName(bulbId.deviceType),
+    bulbId.groupId
+  );
+
+  char buffer[MILIGHT_STATE_JSON_SIZE];
+  GroupStateWriter writer(buffer, sizeof(buffer));
+  hubSync.writeMessage(writer, bulbId, state);
+
+  if (writer.finish() == 0) {
+    Serial.println(F("MqttClient - ERROR: sync message is too large to send"));
+    return;
+  }
+
+  // Retained, so a hub that restarts catches up on versions it missed
+  send(topic, buffer, true);
+}
+
+bool MqttClient::hasSyncTopic() const {
+  return settings.mqttSyncTopicPrefix.length() > 0;
+}
+
+void MqttClient::sendCommand(const MiLightRemoteConfig& remoteConfig, uint16_t deviceId, uint16_t groupId, const char* command) {
+  publish(commandTopic, remoteConfig, deviceId, groupId, reinterpret_cast<const uint8_t*>(command), strlen(command), false);
 }
 
 void MqttClient::subscribe() {
@@ -204,20 +275,38 @@ void MqttClient::subscribe() {
 #endif
 
   mqttClient.subscribe(topic.c_str());
+
+  if (hasSyncTopic()) {
+    String syncTopic = settings.mqttSyncTopicPrefix + "/#";
+    mqttClient.subscribe(syncTopic.c_str());
+  }
 }
 
 void MqttClient::send(const char* topic, const char* message, const bool retain) {
+  send(topic, reinterpret_cast<const uint8_t*>(message), strlen(message), retain);
+}
 
-  if (!mqttClient.connected()) return;
+void MqttClient::send(const char* topic, const uint8_t* payload, size_t length, const bool retain) {
+  // Anything already waiting goes first, so that messages stay in order
+  if (! outbox.isEmpty() || ! publishNow(topic, payload, length, retain)) {
+    outbox.push(topic, payload, length, retain);
+  }
+}
+
+bool MqttClient::publishNow(const char* topic, const uint8_t* payload, size_t length, const bool retain) {
+  if (!mqttClient.connected()) return false;
 
-  size_t len = strlen(message);
+  size_t len = length;
   size_t topicLen = strlen(topic);
 
   if ((topicLen + len + 10) < MQTT_MAX_PACKET_SIZE ) {
-    mqttClient.publish(topic, message, retain);
+    return mqttClient.publish(topic, payload, len, retain);
   } else {
-    const uint8_t* messageBuffer = reinterpret_cast<const uint8_t*>(message);
-    mqttClient.beginPublish(topic, len, retain);
+    const uint8_t* messageBuffer = payload;
+
+    if (! mqttClient.beginPublish(topic, len, retain)) {
+      return false;
+    }
 
 #ifdef MQTT_DEBUG
     Serial.printf_P(PSTR("Printing message in parts because it's too large for the packet buffer (%d bytes)"), len);
@@ -231,86 +320,108 @@ void MqttClient::send(const char* topic, const char* message, const bool retain)
 #endif
     }
 
-    mqttClient.endPublish();
+    return mqttClient.endPublish();
+  }
+}
+
+void MqttClient::flushOutbox() {
+  // Limit how much is sent per loop after a reconnect, so radio and HTTP
+  // handling isn't held up behind a backlog
+  for (size_t i = 0; i < MQTT_OUTBOX_FLUSH_BATCH_SIZE && ! outbox.isEmpty(); i++) {
+    const MqttOutbox::Message& message = outbox.front();
+
+    if (! publishNow(message.topic.c_str(), message.payload.data(), message.payload.size(), message.retain)) {
+      break;
+    }
+
+    outbox.pop();
   }
 }
 
+const MqttOutbox& MqttClient::getOutbox() const {
+  return outbox;
+}
+
+bool MqttClient::isConnected() {
+  return mqttClient.connected();
+}
+
 void MqttClient::publish(
-  const String& _topic,
+  const MqttTopicTemplate& topicTemplate,
   const MiLightRemoteConfig &remoteConfig,
   uint16_t deviceId,
   uint16_t groupId,
-  const char* message,
+  const uint8_t* payload,
+  size_t length,
   const bool _retain
 ) {
-  if (_topic.length() == 0) {
+  if (topicTemplate.isEmpty()) {
     return;
   }
 
   BulbId bulbId(deviceId, groupId, remoteConfig.type);
-  String topic = bindTopicString(_topic, bulbId);
+  const char* alias = topicTemplate.usesAlias() ? aliases.findAlias(bulbId) : NULL;
+  char topic[MQTT_MAX_TOPIC_LENGTH];
   const bool retain = _retain && this->settings.mqttRetain;
 
+  if (topicTemplate.render(topic, sizeof(topic), bulbId, alias) == 0) {
+    Serial.println(F("MqttClient - ERROR: topic is too long"));
+    return;
+  }
+
 #ifdef MQTT_DEBUG
-  printf("MqttClient - publishing update to %s\n", topic.c_str());
+  printf("MqttClient - publishing update to %s\n", topic);
 #endif
 
-  send(topic.c_str(), message, retain);
+  send(topic, payload, length, retain);
 }
 
 void MqttClient::publishCallback(char* topic, byte* payload, int length) {
-  
-  //<Added by HC>
-  if (this->enabledReceive == false) return;
-   //</Added by HC> 
-
   uint16_t deviceId = 0;
   uint8_t groupId = 0;
   const MiLightRemoteConfig* config = &FUT092Config;
-  char cstrPayload[length + 1];
-  cstrPayload[length] = 0;
-  memcpy(cstrPayload, payload, sizeof(byte)*length);
 
 #ifdef MQTT_DEBUG
-  printf("MqttClient - Got message on topic: %s\n%s\n", topic, cstrPayload);
+  printf("MqttClient - Got message on topic: %s\n%.*s\n", topic, length, reinterpret_cast<const char*>(payload));
 #endif
 
-  char topicPattern[settings.mqttTopicPattern.length()];
-  strcpy(topicPattern, settings.mqttTopicPattern.c_str());
+  if (isSyncTopic(topic)) {
+    handleSyncMessage(payload, length);
+    return;
+  }
 
-  TokenIterator patternIterator(topicPattern, settings.mqttTopicPattern.length(), '/');
-  TokenIterator topicIterator(topic, strlen(topic), '/');
-  UrlTokenBindings tokenBindings(patternIterator, topicIterator);
+  MqttTopicMatcher::Bindings bindings;
+  commandTopicMatcher.match(topic, bindings);
 
-  if (tokenBindings.hasBinding("device_alias")) {
-    String alias = tokenBindings.get("device_alias");
-    auto itr = settings.groupIdAliases.find(alias);
+  if (bindings.get(MqttTopicMatcher::DEVICE_ALIAS) != NULL) {
+    const char* alias = bindings.get(MqttTopicMatcher::DEVICE_ALIAS);
+    const BulbId* bulbId = aliases.find(alias);
 
-    if (itr == settings.groupIdAliases.end()) {
-      Serial.printf_P(PSTR("MqttClient - WARNING: could not find device alias: `%s'. Ignoring packet.\n"), alias.c_str());
+    if (bulbId == NULL) {
+      Serial.printf_P(PSTR("MqttClient - WARNING: could not find device alias: `%s'. Ignoring packet.\n"), alias);
       return;
     } else {
-      BulbId bulbId = itr->second;
-
-      deviceId = bulbId.deviceId;
-      config = MiLightRemoteConfig::fromType(bulbId.deviceType);
-      groupId = bulbId.groupId;
+      deviceId = bulbId->deviceId;
+      config = MiLightRemoteConfig::fromType(bulbId->deviceType);
+      groupId = bulbId->groupId;
     }
   } else {
-    if (tokenBindings.hasBinding(GroupStateFieldNames::DEVICE_ID)) {
-      deviceId = parseInt<uint16_t>(tokenBindings.get(GroupStateFieldNames::DEVICE_ID));
-    } else if (tokenBindings.hasBinding("hex_device_id")) {
-      deviceId = parseInt<uint16_t>(tokenBindings.get("hex_device_id"));
-    } else if (tokenBindings.hasBinding("dec_device_id")) {
-      deviceId = parseInt<uint16_t>(tokenBindings.get("dec_device_id"));
+    if (bindings.get(MqttTopicMatcher::DEVICE_ID) != NULL) {
+      deviceId = parseInt<uint16_t>(bindings.get(MqttTopicMatcher::DEVICE_ID));
+    } else if (bindings.get(MqttTopicMatcher::HEX_DEVICE_ID) != NULL) {
+      deviceId = parseInt<uint16_t>(bindings.get(MqttTopicMatcher::HEX_DEVICE_ID));
+    } else if (bindings.get(MqttTopicMatcher::DEC_DEVICE_ID) != NULL) {
+      deviceId = parseInt<uint16_t>(bindings.get(MqttTopicMatcher::DEC_DEVICE_ID));
     }
 
-    if (tokenBindings.hasBinding(GroupStateFieldNames::GROUP_ID)) {
-      groupId = parseInt<uint16_t>(tokenBindings.get(GroupStateFieldNames::GROUP_ID));
+    if (bindings.get(MqttTopicMatcher::GROUP_ID) != NULL) {
+      groupId = parseInt<uint16_t>(bindings.get(MqttTopicMatcher::GROUP_ID));
     }
 
-    if (tokenBindings.hasBinding(GroupStateFieldNames::DEVICE_TYPE)) {
-      config = MiLightRemoteConfig::fromType(tokenBindings.get(GroupStateFieldNames::DEVICE_TYPE));
+    if (bindings.get(MqttTopicMatcher::DEVICE_TYPE) != NULL) {
+      config = MiLightRemoteConfig::fromType(
+        MiLightRemoteTypeHelpers::remoteTypeFromString(bindings.get(MqttTopicMatcher::DEVICE_TYPE))
+      );
     } else {
       Serial.println(F("MqttClient - WARNING: could not find device_type token.  Defaulting to FUT092.\n"));
     }
@@ -323,55 +434,112 @@ void MqttClient::publishCallback(char* topic, byte* payload, int length) {
 
   //<changed by HC
   //accept incoming MQTT command only when deviceId is in use as UDP device
-  for (size_t i = 0; i < settings.gatewayConfigs.size(); i++) {
-    if (deviceId == settings.gatewayConfigs[i]->deviceId) {
-
-      #ifdef MQTT_DEBUG
-      printf("MqttClient - device %04X, group %u\n", deviceId, groupId);
-      #endif
-
-      StaticJsonDocument<400> buffer;
-      deserializeJson(buffer, cstrPayload);
-      JsonObject obj = buffer.as<JsonObject>();
-
-      milightClient->prepare(config, deviceId, groupId);
-      milightClient->update(obj);
-
-      BulbId bulbId(deviceId, groupId, config->type);
-      Command command = Command();
-      serializeJson(obj, command.command);
-
-      int pos = bulbIds.IndexOf(bulbId);
-      if (pos > -1) {
-        commands.Replace(pos, command);
-      } else {
-        bulbIds.Add(bulbId);
-        commands.Add(command);
-      }
-      lastCommandTime = millis();
+  if (gatewayDeviceIds.contains(deviceId)) {
+
+    #ifdef MQTT_DEBUG
+    printf("MqttClient - device %04X, group %u\n", deviceId, groupId);
+    #endif
+
+    BulbId bulbId(deviceId, groupId, config->type);
+
+    // A wall switch button is held.  Run the command once it's released.
+    if (this->enabledReceive == false) {
+      deferredCommands.put(bulbId, payload, length);
+      return;
     }
+
+    handleCommand(bulbId, payload, length);
   }
   //<changed by HC
 }
 
-String MqttClient::bindTopicString(const String& topicPattern, const BulbId& bulbId) {
-  String boundTopic = topicPattern;
-  String deviceIdHex = bulbId.getHexDeviceId();
-
-  boundTopic.replace(":device_id", deviceIdHex);
-  boundTopic.replace(":hex_device_id", deviceIdHex);
-  boundTopic.replace(":dec_device_id", String(bulbId.deviceId));
-  boundTopic.replace(":group_id", String(bulbId.groupId));
-  boundTopic.replace(":device_type", MiLightRemoteTypeHelpers::remoteTypeToString(bulbId.deviceType));
-
-  auto it = settings.findAlias(bulbId.deviceType, bulbId.deviceId, bulbId.groupId);
-  if (it != settings.groupIdAliases.end()) {
-    boundTopic.replace(":device_alias", it->first);
+void MqttClient::handleCommand(const BulbId& bulbId, const uint8_t* payload, size_t length) {
+  char cstrPayload[length + 1];
+  cstrPayload[length] = 0;
+  memcpy(cstrPayload, payload, length);
+
+  StaticJsonDocument<400> buffer;
+
+  // JSON objects start with '{', so anything starting with a MessagePack map
+  // header can be told apart without a setting
+  const uint8_t first = length > 0 ? payload[0] : 0;
+  if ((first & 0xF0) == 0x80 || first == 0xDE || first == 0xDF) {
+    deserializeMsgPack(buffer, cstrPayload, length);
+  } else {
+    deserializeJson(buffer, cstrPayload);
+  }
+  JsonObject obj = buffer.as<JsonObject>();
+
+  milightClient->prepare(bulbId.deviceType, bulbId.deviceId, bulbId.groupId);
+  milightClient->update(obj);
+
+  // Read after update(), which drops fields it ignores.  The newest command
+  // for a group replaces any that's waiting, even if it won't be repeated.
+  CommandDelta delta = CommandDelta::fromJson(obj);
+
+  if (delta.isEmpty()) {
+    repeatQueue.remove(bulbId);
   } else {
-    boundTopic.replace(":device_alias", "__unnamed_group");
+    repeatQueue.put(bulbId, delta);
   }
+  lastCommandTime = millis();
+}
+
+bool MqttClient::isSyncTopic(const char* topic) const {
+  const size_t length = settings.mqttSyncTopicPrefix.length();
+
+  return length > 0
+    && strncmp(topic, settings.mqttSyncTopicPrefix.c_str(), length) == 0
+    && topic[length] == '/';
+}
 
-  return boundTopic;
+void MqttClient::handleSyncMessage(const uint8_t* payload, size_t length) {
+  char cstrPayload[length + 1];
+  cstrPayload[length] = 0;
+  memcpy(cstrPayload, payload, length);
+
+  StaticJsonDocument<400> buffer;
+
+  if (deserializeJson(buffer, cstrPayload)) {
+    Serial.println(F("MqttClient - ERROR: could not parse sync message"));
+    return;
+  }
+
+  JsonObject message = buffer.as<JsonObject>();
+  BulbId bulbId;
+  JsonObject state;
+  const HubSync::Result result = hubSync.handleMessage(message, *stateStore, bulbId, state);
+
+#ifdef MQTT_DEBUG
+  printf_P(PSTR("MqttClient - sync message for %04X/%u, result %d\n"), bulbId.deviceId, bulbId.groupId, result);
+#endif
+
+  if (result == HubSync::INVALID) {
+    Serial.println(F("MqttClient - WARNING: ignoring invalid sync message"));
+  } else if (result == HubSync::TRANSMIT && this->enabledReceive == false) {
+    // A wall switch button is held and using the formatter.  Send the state
+    // once it's released, like any other command.  It's already been sent
+    // by the hub the change came from, so it isn't repeated.
+    state["repeats"] = "NO";
+
+    char command[MILIGHT_STATE_JSON_SIZE];
+    const size_t length = serializeJson(state, command, sizeof(command));
+    deferredCommands.put(bulbId, reinterpret_cast<const uint8_t*>(command), length);
+  } else if (result == HubSync::TRANSMIT) {
+    milightClient->prepare(bulbId.deviceType, bulbId.deviceId, bulbId.groupId);
+    milightClient->update(state);
+  }
+}
+
+void MqttClient::repeatCommand(const BulbId& bulbId, const CommandDelta& delta) {
+  milightClient->prepare(bulbId.deviceType, bulbId.deviceId, bulbId.groupId);
+
+  delta.apply(*milightClient);
+}
+
+String MqttClient::bindTopicString(const String& topicPattern, const BulbId& bulbId) {
+  MqttTopicTemplate topicTemplate(topicPattern);
+  return topicTemplate.render(bulbId, topicTemplate.usesAlias() ? aliases.findAlias(bulbId) : NULL);
 }
 
 String MqttClient::generateConnectionStatusMessage(const char* connectionStatus) {
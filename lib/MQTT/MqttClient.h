@@ -3,7 +3,14 @@
 #include <PubSubClient.h>
 #include <WiFiClient.h>
 #include <MiLightRadioConfig.h>
-#include "ListLib.h"
+#include <MqttTopicTemplate.h>
+#include <MqttTopicMatcher.h>
+#include <GroupAliasIndex.h>
+#include <DeviceIdSet.h>
+#include <CommandRepeatQueue.h>
+#include <MqttOutbox.h>
+#include <DeferredCommandQueue.h>
+#include <HubSync.h>
 
 #ifndef MQTT_CONNECTION_ATTEMPT_FREQUENCY
 #define MQTT_CONNECTION_ATTEMPT_FREQUENCY 5000
@@ -13,31 +20,52 @@
 #define MQTT_PACKET_CHUNK_SIZE 128
 #endif
 
+// Number of queued messages sent per loop once connected
+#ifndef MQTT_OUTBOX_FLUSH_BATCH_SIZE
+#define MQTT_OUTBOX_FLUSH_BATCH_SIZE 4
+#endif
+
 #ifndef _MQTT_CLIENT_H
 #define _MQTT_CLIENT_H
 
-struct Command {
-  char command[200];
-};
-
 class MqttClient {
 public:
   using OnConnectFn = std::function<void()>;
 
-  MqttClient(Settings& settings, MiLightClient*& milightClient);
+  MqttClient(Settings& settings, MiLightClient*& milightClient, GroupStateStore*& stateStore);
   ~MqttClient();
 
   void begin();
   void handleClient();
   void reconnect();
   void sendUpdate(const MiLightRemoteConfig& remoteConfig, uint16_t deviceId, uint16_t groupId, const char* update);
+  void sendUpdate(const MiLightRemoteConfig& remoteConfig, uint16_t deviceId, uint16_t groupId, const uint8_t* update, size_t length);
   void sendState(const MiLightRemoteConfig& remoteConfig, uint16_t deviceId, uint16_t groupId, const char* update);
+  void sendState(const MiLightRemoteConfig& remoteConfig, uint16_t deviceId, uint16_t groupId, const uint8_t* update, size_t length);
+  // States of several groups of one device, published together
+  void sendDeviceState(const MiLightRemoteConfig& remoteConfig, uint16_t deviceId, const uint8_t* update, size_t length);
+  bool hasStateTopic() const;
+  bool hasDeviceStateTopic() const;
+  void sendCommand(const MiLightRemoteConfig& remoteConfig, uint16_t deviceId, uint16_t groupId, const char* command);
+  // Announces a change made at this hub to the other hubs (see HubSync)
+  void sendSync(const BulbId& bulbId, const GroupState& state);
+  bool hasSyncTopic() const;
   void send(const char* topic, const char* message, const bool retain = false);
+  void send(const char* topic, const uint8_t* payload, size_t length, const bool retain = false);
   void onConnect(OnConnectFn fn);
+  bool isConnected();
+
+  // Messages held while the broker was unreachable
+  const MqttOutbox& getOutbox() const;
 
   //<Added by HC>
+  // While disabled, commands are deferred and run once receiving is enabled again
   void enableReceive();
   void disableReceive();
+  bool isReceiveEnabled() const;
+  // Drops a deferred command for a group that was changed locally since
+  void supersedeDeferredCommand(const BulbId& bulbId);
+  const DeferredCommandQueue& getDeferredCommands() const;
   //</Added by HC>
 
   String bindTopicString(const String& topicPattern, const BulbId& bulbId);
@@ -46,16 +74,31 @@ private:
   WiFiClient tcpClient;
   PubSubClient mqttClient;
   MiLightClient*& milightClient;
+  GroupStateStore*& stateStore;
   Settings& settings;
 
   //<Added by HC>
   unsigned long lastCommandTime;
   unsigned int repeatTimer = 0;
   bool enabledReceive;
-  List<BulbId> bulbIds;
-  List<Command> commands;
+  CommandRepeatQueue repeatQueue;
+  DeferredCommandQueue deferredCommands;
   //</Added by HC
+
+  MqttOutbox outbox;
   
+  // Compiled from the topic patterns in settings, which don't change for the
+  // lifetime of this client
+  MqttTopicTemplate commandTopic;
+  MqttTopicTemplate updateTopic;
+  MqttTopicTemplate stateTopic;
+  MqttTopicTemplate deviceStateTopic;
+  MqttTopicMatcher commandTopicMatcher;
+  GroupAliasIndex aliases;
+  // Commands are only accepted for these
+  DeviceIdSet gatewayDeviceIds;
+  HubSync hubSync;
+
   char* domain;
   unsigned long lastConnectAttempt;
   OnConnectFn onConnectFn;
@@ -65,12 +108,19 @@ private:
   bool connect();
   void subscribe();
   void publishCallback(char* topic, byte* payload, int length);
+  void handleCommand(const BulbId& bulbId, const uint8_t* payload, size_t length);
+  bool isSyncTopic(const char* topic) const;
+  void handleSyncMessage(const uint8_t* payload, size_t length);
+  void repeatCommand(const BulbId& bulbId, const CommandDelta& delta);
+  bool publishNow(const char* topic, const uint8_t* payload, size_t length, const bool retain);
+  void flushOutbox();
   void publish(
-    const String& topic,
+    const MqttTopicTemplate& topic,
     const MiLightRemoteConfig& remoteConfig,
     uint16_t deviceId,
     uint16_t groupId,
-    const char* update,
+    const uint8_t* payload,
+    size_t length,
     const bool retain = false
   );
 
@@ -0,0 +1,76 @@
+#include <MqttOutbox.h>
+
+MqttOutbox::MqttOutbox()
+  : totalBytes(0),
+    dropped(0),
+    coalesced(0)
+{ }
+
+void MqttOutbox::push(const char* topic, const uint8_t* payload, size_t length, bool retain) {
+  const size_t size = strlen(topic) + length;
+
+  if (size > MILIGHT_MQTT_OUTBOX_BYTES) {
+    ++dropped;
+    return;
+  }
+
+  if (retain) {
+    for (size_t i = 0; i < messages.size(); i++) {
+      if (messages[i].retain && messages[i].topic == topic) {
+        // Re-queued at the back, so messages still go out in the order they
+        // were last sent
+        removeAt(i);
+        ++coalesced;
+        break;
+      }
+    }
+  }
+
+  while (messages.size() > 0
+    && (messages.size() >= MILIGHT_MQTT_OUTBOX_SIZE || totalBytes + size > MILIGHT_MQTT_OUTBOX_BYTES)) {
+    removeAt(0);
+    ++dropped;
+  }
+
+  messages.push_back({ topic, std::vector<uint8_t>(payload, payload + length), retain });
+  totalBytes += size;
+}
+
+const MqttOutbox::Message& MqttOutbox::front() const {
+  return messages.front();
+}
+
+void MqttOutbox::pop() {
+  if (! messages.empty()) {
+    removeAt(0);
+  }
+}
+
+bool MqttOutbox::isEmpty() const {
+  return messages.empty();
+}
+
+size_t MqttOutbox::size() const {
+  return messages.size();
+}
+
+size_t MqttOutbox::bytes() const {
+  return totalBytes;
+}
+
+size_t MqttOutbox::droppedMessages() const {
+  return dropped;
+}
+
+size_t MqttOutbox::coalescedMessages() const {
+  return coalesced;
+}
+
+void MqttOutbox::removeAt(size_t index) {
+  totalBytes -= sizeOf(messages[index]);
+  messages.erase(messages.begin() + index);
+}
+
+size_t MqttOutbox::sizeOf(const Message& message) {
+  return message.topic.length() + message.payload.size();
+}
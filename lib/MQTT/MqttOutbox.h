@@ -0,0 +1,54 @@
+#include <Arduino.h>
+#include <vector>
+
+#ifndef _MQTT_OUTBOX_H
+#define _MQTT_OUTBOX_H
+
+#ifndef MILIGHT_MQTT_OUTBOX_SIZE
+#define MILIGHT_MQTT_OUTBOX_SIZE 16
+#endif
+
+// Limit on the total size of the topics and payloads held, in bytes
+#ifndef MILIGHT_MQTT_OUTBOX_BYTES
+#define MILIGHT_MQTT_OUTBOX_BYTES 4096
+#endif
+
+/**
+ * Messages waiting for the broker to be reachable, oldest first.
+ *
+ * A retained message replaces any queued one for the same topic, since the
+ * broker would only keep the newest anyway.  When the outbox is full, the
+ * oldest messages are dropped to make room.
+ */
+class MqttOutbox {
+public:
+  struct Message {
+    String topic;
+    // Not null terminated, since MessagePack payloads can contain zeros
+    std::vector<uint8_t> payload;
+    bool retain;
+  };
+
+  MqttOutbox();
+
+  void push(const char* topic, const uint8_t* payload, size_t length, bool retain);
+  const Message& front() const;
+  void pop();
+
+  bool isEmpty() const;
+  size_t size() const;
+  size_t bytes() const;
+  size_t droppedMessages() const;
+  size_t coalescedMessages() const;
+
+private:
+  std::vector<Message> messages;
+  size_t totalBytes;
+  size_t dropped;
+  size_t coalesced;
+
+  void removeAt(size_t index);
+  static size_t sizeOf(const Message& message);
+};
+
+#endif
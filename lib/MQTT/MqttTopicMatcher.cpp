@@ -0,0 +1,74 @@
+#include <MqttTopicMatcher.h>
+#include <Size.h>
+
+static const char* BINDING_NAMES[] = {
+  "device_id",
+  "hex_device_id",
+  "dec_device_id",
+  "group_id",
+  "device_type",
+  "device_alias"
+};
+
+const char* MqttTopicMatcher::Bindings::get(Binding binding) const {
+  return values[binding];
+}
+
+MqttTopicMatcher::MqttTopicMatcher(const String& pattern)
+  : bound(0)
+{
+  const char* level = pattern.c_str();
+
+  while (true) {
+    const char* end = strchr(level, '/');
+    const size_t length = end != NULL ? end - level : strlen(level);
+    uint8_t binding = NO_BINDING;
+
+    if (length > 0 && level[0] == ':') {
+      for (size_t i = 0; i < size(BINDING_NAMES); i++) {
+        if (strlen(BINDING_NAMES[i]) == length - 1 && 0 == strncmp(level + 1, BINDING_NAMES[i], length - 1)) {
+          // Only the first of repeated placeholders is used
+          if (! (bound & (1 << i))) {
+            binding = i;
+            bound |= 1 << i;
+          }
+          break;
+        }
+      }
+    }
+
+    levels.push_back(binding);
+
+    if (end == NULL) {
+      break;
+    }
+    level = end + 1;
+  }
+}
+
+bool MqttTopicMatcher::hasBinding(Binding binding) const {
+  return bound & (1 << binding);
+}
+
+void MqttTopicMatcher::match(char* topic, Bindings& bindings) const {
+  for (size_t i = 0; i < NUM_BINDINGS; i++) {
+    bindings.values[i] = NULL;
+  }
+
+  char* level = topic[0] != 0 ? topic : NULL;
+
+  for (size_t i = 0; i < levels.size() && level != NULL; i++) {
+    char* end = strchr(level, '/');
+
+    if (end != NULL) {
+      *end = 0;
+    }
+
+    if (levels[i] != NO_BINDING) {
+      bindings.values[levels[i]] = level;
+    }
+
+    // Like TokenIterator, a trailing / doesn't start another level
+    level = end != NULL && end[1] != 0 ? end + 1 : NULL;
+  }
+}
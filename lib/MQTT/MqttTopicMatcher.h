@@ -0,0 +1,49 @@
+#include <Arduino.h>
+#include <vector>
+
+#ifndef _MQTT_TOPIC_MATCHER_H
+#define _MQTT_TOPIC_MATCHER_H
+
+/**
+ * Pulls the values of placeholders out of topics received on a subscription
+ * like "milight/:device_id/:device_type/:group_id".
+ *
+ * As with UrlTokenBindings, placeholders bind whole topic levels by position,
+ * literal levels aren't checked, and the first of repeated placeholders wins.
+ * The pattern is parsed once, so matching a topic is a single pass over it.
+ */
+class MqttTopicMatcher {
+public:
+  enum Binding {
+    DEVICE_ID,
+    HEX_DEVICE_ID,
+    DEC_DEVICE_ID,
+    GROUP_ID,
+    DEVICE_TYPE,
+    DEVICE_ALIAS,
+    NUM_BINDINGS
+  };
+
+  struct Bindings {
+    // NULL for placeholders that aren't in the pattern or topic
+    const char* values[NUM_BINDINGS];
+
+    const char* get(Binding binding) const;
+  };
+
+  MqttTopicMatcher(const String& pattern);
+
+  bool hasBinding(Binding binding) const;
+
+  // Splits topic into levels in place, so the bound values point into it
+  void match(char* topic, Bindings& bindings) const;
+
+private:
+  static const uint8_t NO_BINDING = 0xFF;
+
+  // Binding for each level of the pattern, or NO_BINDING
+  std::vector<uint8_t> levels;
+  uint8_t bound;
+};
+
+#endif
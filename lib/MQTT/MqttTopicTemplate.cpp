@@ -0,0 +1,157 @@
+#include <MqttTopicTemplate.h>
+#include <MiLightRemoteType.h>
+#include <Size.h>
+
+struct Placeholder {
+  const char* name;
+  uint8_t length;
+  uint8_t token;
+};
+
+#define PLACEHOLDER(name, token) { name, sizeof(name) - 1, static_cast<uint8_t>(token) }
+
+// Writes value to the end of buffer in the given base, and returns where it starts
+static char* formatNumber(char* end, uint16_t value, uint8_t base) {
+  static const char DIGITS[] = "0123456789ABCDEF";
+
+  do {
+    *--end = DIGITS[value % base];
+    value /= base;
+  } while (value > 0);
+
+  return end;
+}
+
+MqttTopicTemplate::MqttTopicTemplate()
+  : hasAlias(false)
+{ }
+
+MqttTopicTemplate::MqttTopicTemplate(const String& pattern)
+  : pattern(pattern),
+    hasAlias(false)
+{
+  static const Placeholder PLACEHOLDERS[] = {
+    PLACEHOLDER(":device_id", Token::HEX_DEVICE_ID),
+    PLACEHOLDER(":hex_device_id", Token::HEX_DEVICE_ID),
+    PLACEHOLDER(":dec_device_id", Token::DEC_DEVICE_ID),
+    PLACEHOLDER(":group_id", Token::GROUP_ID),
+    PLACEHOLDER(":device_type", Token::DEVICE_TYPE),
+    PLACEHOLDER(":device_alias", Token::DEVICE_ALIAS)
+  };
+
+  const char* str = pattern.c_str();
+  const size_t length = pattern.length();
+  size_t literalStart = 0;
+
+  for (size_t i = 0; i < length; i++) {
+    if (str[i] != ':') {
+      continue;
+    }
+
+    for (size_t j = 0; j < size(PLACEHOLDERS); j++) {
+      const Placeholder& placeholder = PLACEHOLDERS[j];
+
+      if (0 == strncmp(str + i, placeholder.name, placeholder.length)) {
+        addLiteral(literalStart, i - literalStart);
+        ops.push_back({ static_cast<Token>(placeholder.token), 0, 0 });
+        hasAlias |= ops.back().token == Token::DEVICE_ALIAS;
+
+        i += placeholder.length - 1;
+        literalStart = i + 1;
+        break;
+      }
+    }
+  }
+
+  addLiteral(literalStart, length - literalStart);
+}
+
+void MqttTopicTemplate::addLiteral(size_t offset, size_t length) {
+  // Split up anything too long for one op
+  while (length > 0) {
+    const uint8_t opLength = std::min<size_t>(length, UINT8_MAX);
+
+    ops.push_back({ Token::LITERAL, opLength, static_cast<uint16_t>(offset) });
+    offset += opLength;
+    length -= opLength;
+  }
+}
+
+bool MqttTopicTemplate::isEmpty() const {
+  return pattern.length() == 0;
+}
+
+bool MqttTopicTemplate::usesAlias() const {
+  return hasAlias;
+}
+
+size_t MqttTopicTemplate::render(char* buffer, size_t size, const BulbId& bulbId, const char* alias) const {
+  const char* str = pattern.c_str();
+  size_t length = 0;
+
+  for (std::vector<Op>::const_iterator itr = ops.begin(); itr != ops.end(); ++itr) {
+    // Room for the longest number we write
+    char number[6];
+    char* const numberEnd = number + sizeof(number);
+    const char* text = numberEnd;
+    size_t textLength;
+
+    switch (itr->token) {
+      case Token::LITERAL:
+        text = str + itr->offset;
+        textLength = itr->length;
+        break;
+      case Token::HEX_DEVICE_ID:
+        {
+          char* digits = formatNumber(numberEnd, bulbId.deviceId, 16);
+          *--digits = 'x';
+          *--digits = '0';
+          text = digits;
+          textLength = numberEnd - text;
+        }
+        break;
+      case Token::DEC_DEVICE_ID:
+        text = formatNumber(numberEnd, bulbId.deviceId, 10);
+        textLength = numberEnd - text;
+        break;
+      case Token::GROUP_ID:
+        text = formatNumber(numberEnd, bulbId.groupId, 10);
+        textLength = numberEnd - text;
+        break;
+      case Token::DEVICE_TYPE:
+        text = MiLightRemoteTypeHelpers::remoteTypeName(bulbId.deviceType);
+        textLength = strlen(text);
+        break;
+      case Token::DEVICE_ALIAS:
+        text = alias != NULL ? alias : "__unnamed_group";
+        textLength = strlen(text);
+        break;
+      default:
+        textLength = 0;
+        break;
+    }
+
+    if (length + textLength >= size) {
+      if (size > 0) {
+        buffer[0] = 0;
+      }
+      return 0;
+    }
+
+    memcpy(buffer + length, text, textLength);
+    length += textLength;
+  }
+
+  buffer[length] = 0;
+  return length;
+}
+
+String MqttTopicTemplate::render(const BulbId& bulbId, const char* alias) const {
+  char buffer[MQTT_MAX_TOPIC_LENGTH];
+
+  if (render(buffer, sizeof(buffer), bulbId, alias) == 0) {
+    return String();
+  }
+
+  return buffer;
+}
@@ -0,0 +1,58 @@
+#include <Arduino.h>
+#include <BulbId.h>
+#include <vector>
+
+#ifndef _MQTT_TOPIC_TEMPLATE_H
+#define _MQTT_TOPIC_TEMPLATE_H
+
+#ifndef MQTT_MAX_TOPIC_LENGTH
+#define MQTT_MAX_TOPIC_LENGTH 128
+#endif
+
+/**
+ * A topic pattern like "milight/:device_id/:device_type/:group_id", parsed
+ * once into literal segments and placeholders so that binding it to a group
+ * is a single pass into a caller's buffer.
+ *
+ * Supports the same placeholders as MqttClient always has: :device_id,
+ * :hex_device_id, :dec_device_id, :group_id, :device_type and :device_alias.
+ */
+class MqttTopicTemplate {
+public:
+  MqttTopicTemplate();
+  MqttTopicTemplate(const String& pattern);
+
+  bool isEmpty() const;
+  bool usesAlias() const;
+
+  // Writes the topic for bulbId into buffer, with alias in place of
+  // :device_alias (or "__unnamed_group" if it's NULL).  Returns the length, or
+  // 0 if it didn't fit.
+  size_t render(char* buffer, size_t size, const BulbId& bulbId, const char* alias) const;
+  String render(const BulbId& bulbId, const char* alias) const;
+
+private:
+  enum class Token : uint8_t {
+    LITERAL,
+    HEX_DEVICE_ID,
+    DEC_DEVICE_ID,
+    GROUP_ID,
+    DEVICE_TYPE,
+    DEVICE_ALIAS
+  };
+
+  struct Op {
+    Token token;
+    // Where the text is in pattern, for LITERAL
+    uint8_t length;
+    uint16_t offset;
+  };
+
+  String pattern;
+  std::vector<Op> ops;
+  bool hasAlias;
+
+  void addLiteral(size_t offset, size_t length);
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include <StaleGroupSet.h>
+
+StaleGroupSet::StaleGroupSet() {
+  entries.reserve(MILIGHT_MAX_STALE_MQTT_GROUPS);
+}
+
+bool StaleGroupSet::add(const BulbId& bulbId, unsigned long now) {
+  const uint32_t id = bulbId.getCompactId();
+
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (entries[i].bulbId.getCompactId() == id) {
+      entries[i].lastChanged = now;
+      return true;
+    }
+  }
+
+  if (isFull()) {
+    return false;
+  }
+
+  entries.push_back({ bulbId, now, now });
+
+  return true;
+}
+
+void StaleGroupSet::addOverflow(const BulbId& bulbId, unsigned long now) {
+  if (! add(bulbId, now)) {
+    entries.push_back({ bulbId, now, now });
+  }
+}
+
+bool StaleGroupSet::popReady(unsigned long now, unsigned long debounce, unsigned long maxStaleness, BulbId& bulbId) {
+  // Entries are in the order they were added, so the first ready one has
+  // waited the longest
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (isReady(entries[i], now, debounce, maxStaleness)) {
+      bulbId = entries[i].bulbId;
+      remove(i);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool StaleGroupSet::popReadySibling(const BulbId& sibling, unsigned long now, unsigned long debounce, unsigned long maxStaleness, BulbId& bulbId) {
+  for (size_t i = 0; i < entries.size(); i++) {
+    const BulbId& candidate = entries[i].bulbId;
+
+    if (candidate.deviceId == sibling.deviceId
+      && candidate.deviceType == sibling.deviceType
+      && isReady(entries[i], now, debounce, maxStaleness)) {
+      bulbId = candidate;
+      remove(i);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool StaleGroupSet::popOldest(BulbId& bulbId) {
+  if (entries.empty()) {
+    return false;
+  }
+
+  bulbId = entries[0].bulbId;
+  remove(0);
+
+  return true;
+}
+
+size_t StaleGroupSet::size() const {
+  return entries.size();
+}
+
+bool StaleGroupSet::isFull() const {
+  return entries.size() >= MILIGHT_MAX_STALE_MQTT_GROUPS;
+}
+
+void StaleGroupSet::remove(size_t index) {
+  entries.erase(entries.begin() + index);
+}
+
+bool StaleGroupSet::isReady(const Entry& entry, unsigned long now, unsigned long debounce, unsigned long maxStaleness) {
+  return now - entry.lastChanged >= debounce || (maxStaleness > 0 && now - entry.firstChanged >= maxStaleness);
+}
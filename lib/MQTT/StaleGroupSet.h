@@ -0,0 +1,59 @@
+#include <stddef.h>
+#include <BulbId.h>
+#include <vector>
+
+#ifndef _STALE_GROUP_SET_H
+#define _STALE_GROUP_SET_H
+
+#ifndef MILIGHT_MAX_STALE_MQTT_GROUPS
+#define MILIGHT_MAX_STALE_MQTT_GROUPS 10
+#endif
+
+/**
+ * Groups whose state changed since it was last published, each listed once,
+ * in the order they first changed.
+ *
+ * A group is ready to publish once it hasn't changed for the debounce delay,
+ * or once it's been waiting for the maximum staleness, whichever comes first.
+ * Groups are debounced separately, so a stream of changes to one group doesn't
+ * hold back any of the others.
+ */
+class StaleGroupSet {
+public:
+  StaleGroupSet();
+
+  // Returns false if the group isn't already in the set and the set is full
+  bool add(const BulbId& bulbId, unsigned long now);
+
+  // Like add, but grows the set past MILIGHT_MAX_STALE_MQTT_GROUPS if it's
+  // full.  For groups that can't be published yet and mustn't be dropped.
+  void addOverflow(const BulbId& bulbId, unsigned long now);
+
+  // Removes the group that first changed the longest ago, out of the ones
+  // that are ready.  A maxStaleness of 0 means there's no maximum.
+  bool popReady(unsigned long now, unsigned long debounce, unsigned long maxStaleness, BulbId& bulbId);
+
+  // Like popReady, but only considers other groups of the same device as sibling
+  bool popReadySibling(const BulbId& sibling, unsigned long now, unsigned long debounce, unsigned long maxStaleness, BulbId& bulbId);
+
+  // Removes the group that first changed the longest ago, ready or not
+  bool popOldest(BulbId& bulbId);
+
+  size_t size() const;
+  bool isFull() const;
+
+private:
+  struct Entry {
+    BulbId bulbId;
+    unsigned long firstChanged;
+    unsigned long lastChanged;
+  };
+
+  // Reserved up front, so it's only reallocated on overflow
+  std::vector<Entry> entries;
+
+  void remove(size_t index);
+  static bool isReady(const Entry& entry, unsigned long now, unsigned long debounce, unsigned long maxStaleness);
+};
+
+#endif
@@ -1,11 +1,7 @@
 #include <CctPacketFormatter.h>
 #include <MiLightCommands.h>
 
-static const uint8_t CCT_PROTOCOL_ID = 0x5A;
-
-bool CctPacketFormatter::canHandle(const uint8_t *packet, const size_t len) {
-  return len == packetLength && packet[0] == CCT_PROTOCOL_ID;
-}
+static const uint8_t CCT_PROTOCOL_ID = CctPacketFormatter::Traits::HEADER;
 
 void CctPacketFormatter::initializePacket(uint8_t* packet) {
   size_t packetPtr = 0;
@@ -26,7 +22,7 @@ void CctPacketFormatter::initializePacket(uint8_t* packet) {
   packet[packetPtr++] = 0;
 
   // Byte 6: Packet sequence number 0..255
-  packet[packetPtr++] = sequenceNum++;
+  packet[packetPtr++] = sequenceNum;
 
   // Byte 7: Checksum over previous bytes, including packet length = 7
   // The checksum will be calculated when setting the command field
@@ -23,14 +23,14 @@ enum MiLightCctButton {
   CCT_TEMPERATURE_DOWN  = 0x0F
 };
 
-class CctPacketFormatter : public PacketFormatter {
+class CctPacketFormatter final : public PacketFormatterBase<CctPacketFormatter> {
 public:
+  typedef PacketFormatterTraits<REMOTE_TYPE_CCT> Traits;
+
   CctPacketFormatter()
-    : PacketFormatter(REMOTE_TYPE_CCT, 7, 20)
+    : PacketFormatterBase(REMOTE_TYPE_CCT, Traits::PACKET_LENGTH, Traits::MAX_PACKETS)
   { }
 
-  virtual bool canHandle(const uint8_t* packet, const size_t len);
-
   virtual void updateStatus(MiLightStatus status, uint8_t groupId);
   virtual void command(uint8_t command, uint8_t arg);
 
@@ -44,13 +44,17 @@ public:
   virtual void enableNightMode();
 
   virtual void format(uint8_t const* packet, char* buffer);
-  virtual void initializePacket(uint8_t* packet);
-  virtual void finalizePacket(uint8_t* packet);
   virtual BulbId parsePacket(const uint8_t* packet, JsonObject result);
 
   static uint8_t getCctStatusButton(uint8_t groupId, MiLightStatus status);
   static uint8_t cctCommandIdToGroup(uint8_t command);
   static MiLightStatus cctCommandToStatus(uint8_t command);
+
+protected:
+  friend class PacketFormatterBase<CctPacketFormatter>;
+
+  void initializePacket(uint8_t* packet);
+  void finalizePacket(uint8_t* packet);
 };
 
 #endif
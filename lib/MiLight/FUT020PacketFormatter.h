@@ -11,7 +11,7 @@ enum class FUT020Command {
   COLOR              = 0x00
 };
 
-class FUT020PacketFormatter : public FUT02xPacketFormatter {
+class FUT020PacketFormatter final : public FUT02xPacketFormatter {
 public:
   FUT020PacketFormatter()
     : FUT02xPacketFormatter(REMOTE_TYPE_FUT020)
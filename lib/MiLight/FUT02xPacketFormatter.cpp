@@ -1,6 +1,6 @@
 #include <FUT02xPacketFormatter.h>
 
-static const uint8_t FUT02X_PACKET_HEADER = 0xA5;
+static const uint8_t FUT02X_PACKET_HEADER = PacketFormatterTraits<REMOTE_TYPE_FUT020>::HEADER;
 
 static const uint8_t FUT02X_PAIR_COMMAND = 0x03;
 static const uint8_t FUT02X_UNPAIR_COMMAND = 0x03;
@@ -8,16 +8,12 @@ static const uint8_t FUT02X_UNPAIR_COMMAND = 0x03;
 void FUT02xPacketFormatter::initializePacket(uint8_t *packet) {
   size_t packetPtr = 0;
 
-  packet[packetPtr++] = 0xA5;
+  packet[packetPtr++] = FUT02X_PACKET_HEADER;
   packet[packetPtr++] = deviceId >> 8;
   packet[packetPtr++] = deviceId & 0xFF;
   packet[packetPtr++] = 0; // arg
   packet[packetPtr++] = 0; // command
-  packet[packetPtr++] = sequenceNum++;
-}
-
-bool FUT02xPacketFormatter::canHandle(const uint8_t* packet, const size_t len) {
-  return len == packetLength && packet[0] == FUT02X_PACKET_HEADER;
+  packet[packetPtr++] = sequenceNum;
 }
 
 void FUT02xPacketFormatter::command(uint8_t command, uint8_t arg) {
@@ -21,10 +21,12 @@ enum MiLightFUT089Arguments {
   FUT089_WHITE_MODE = 0x14
 };
 
-class FUT089PacketFormatter : public V2PacketFormatter {
+class FUT089PacketFormatter final : public V2PacketFormatter {
 public:
+  typedef PacketFormatterTraits<REMOTE_TYPE_FUT089> Traits;
+
   FUT089PacketFormatter()
-    : V2PacketFormatter(REMOTE_TYPE_FUT089, 0x25, 8)    // protocol is 0x25, and there are 8 groups
+    : V2PacketFormatter(REMOTE_TYPE_FUT089, Traits::PROTOCOL_ID, Traits::NUM_GROUPS)
   { }
 
   virtual void updateBrightness(uint8_t value);
@@ -9,10 +9,12 @@ enum class FUT091Command {
   KELVIN = 0x03
 };
 
-class FUT091PacketFormatter : public V2PacketFormatter {
+class FUT091PacketFormatter final : public V2PacketFormatter {
 public:
+  typedef PacketFormatterTraits<REMOTE_TYPE_FUT091> Traits;
+
   FUT091PacketFormatter()
-    : V2PacketFormatter(REMOTE_TYPE_FUT091, 0x21, 4)    // protocol is 0x21, and there are 4 groups
+    : V2PacketFormatter(REMOTE_TYPE_FUT091, Traits::PROTOCOL_ID, Traits::NUM_GROUPS)
   { }
 
   virtual void updateBrightness(uint8_t value);
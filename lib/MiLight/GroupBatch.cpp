@@ -0,0 +1,188 @@
+#include <GroupBatch.h>
+#include <GroupStateField.h>
+#include <MiLightStatus.h>
+#include <algorithm>
+#include <string.h>
+
+// Longest serialized value that is compared when looking for common fields.
+// Longer values are never treated as common, so they're sent to each group.
+#define GROUP_BATCH_MAX_VALUE_LENGTH 50
+
+// Fields that set the level of the bulb's current mode
+static const char* const LEVEL_FIELDS[] = {
+  GroupStateFieldNames::BRIGHTNESS,
+  GroupStateFieldNames::LEVEL
+};
+
+// Fields that can switch a bulb to another mode, which has its own level
+static const char* const MODE_FIELDS[] = {
+  GroupStateFieldNames::HUE,
+  GroupStateFieldNames::SATURATION,
+  GroupStateFieldNames::COLOR,
+  GroupStateFieldNames::COLOR_TEMP,
+  GroupStateFieldNames::KELVIN,
+  GroupStateFieldNames::TEMPERATURE,
+  GroupStateFieldNames::MODE,
+  GroupStateFieldNames::EFFECT,
+  GroupStateFieldNames::COMMAND,
+  GroupStateFieldNames::COMMANDS
+};
+
+void GroupBatch::split(const uint8_t numGroups, const std::vector<GroupTarget>& targets, UpdateFn update) {
+  if (targets.empty()) {
+    return;
+  }
+
+  // Group 0 can only be used when every group paired with this device ID is part of the
+  // batch.  Otherwise groups outside of the batch would be affected as well.
+  bool coversAllGroups = numGroups > 0;
+  for (size_t groupId = 1; coversAllGroups && groupId <= numGroups; ++groupId) {
+    coversAllGroups = std::any_of(
+      targets.begin(),
+      targets.end(),
+      [groupId](const GroupTarget& target) { return target.groupId == groupId; }
+    );
+  }
+
+  StaticJsonDocument<400> commonDoc;
+  JsonObject common = commonDoc.to<JsonObject>();
+  size_t numCommonFields = 0;
+
+  if (coversAllGroups) {
+    for (JsonPair kv : targets[0].state) {
+      const char* key = kv.key().c_str();
+
+      if (isCommonField(key, kv.value(), targets)) {
+        common[key] = kv.value();
+
+        // Transition is a parameter for the other fields rather than a field itself
+        if (strcmp(key, RequestKeys::TRANSITION) != 0) {
+          numCommonFields++;
+        }
+      }
+    }
+  }
+
+  // Turning off always happens last, so individual group changes need to be sent before a
+  // group 0 "off" command.
+  const bool commonTurnsOff = numCommonFields > 0 && turnsOff(common);
+
+  // A level applies to whichever mode the bulb is in, so it's set after any mode change.
+  // If a group changes mode on its own, a common level goes to group 0 after the
+  // per-group updates rather than before them.
+  StaticJsonDocument<100> levelDoc;
+  JsonObject commonLevel = levelDoc.to<JsonObject>();
+  size_t numLevelFields = 0;
+
+  if (numCommonFields > 0 && !commonTurnsOff && changesModePerGroup(common, targets)) {
+    for (const char* key : LEVEL_FIELDS) {
+      if (common.containsKey(key)) {
+        commonLevel[key] = common[key];
+        common.remove(key);
+        numCommonFields--;
+        numLevelFields++;
+      }
+    }
+
+    if (numLevelFields > 0 && common.containsKey(RequestKeys::TRANSITION)) {
+      commonLevel[RequestKeys::TRANSITION] = common[RequestKeys::TRANSITION];
+    }
+  }
+
+  if (numCommonFields > 0 && !commonTurnsOff) {
+    update(0, common);
+  }
+
+  for (const GroupTarget& target : targets) {
+    StaticJsonDocument<400> groupDoc;
+    JsonObject groupState = groupDoc.to<JsonObject>();
+    size_t numGroupFields = 0;
+
+    for (JsonPair kv : target.state) {
+      const char* key = kv.key().c_str();
+      const bool isTransition = strcmp(key, RequestKeys::TRANSITION) == 0;
+
+      const bool isCommon = common.containsKey(key) || commonLevel.containsKey(key);
+
+      if (isTransition || !isCommon) {
+        groupState[key] = kv.value();
+
+        if (!isTransition) {
+          numGroupFields++;
+        }
+      }
+    }
+
+    if (numGroupFields > 0) {
+      update(target.groupId, groupState);
+    }
+  }
+
+  if (numLevelFields > 0) {
+    update(0, commonLevel);
+  }
+
+  if (commonTurnsOff) {
+    update(0, common);
+  }
+}
+
+bool GroupBatch::isCommonField(const char* key, JsonVariant value, const std::vector<GroupTarget>& targets) {
+  char expected[GROUP_BATCH_MAX_VALUE_LENGTH + 1];
+  char actual[GROUP_BATCH_MAX_VALUE_LENGTH + 1];
+
+  // Values are compared in their serialized form.  Check the length first so that
+  // nothing is compared after being truncated.
+  const size_t length = measureJson(value);
+  if (length > GROUP_BATCH_MAX_VALUE_LENGTH) {
+    return false;
+  }
+
+  serializeJson(value, expected, sizeof(expected));
+
+  for (const GroupTarget& target : targets) {
+    JsonObject state = target.state;
+
+    if (! state.containsKey(key)) {
+      return false;
+    }
+
+    JsonVariant other = state[key];
+
+    if (measureJson(other) != length) {
+      return false;
+    }
+
+    serializeJson(other, actual, sizeof(actual));
+
+    if (strcmp(expected, actual) != 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool GroupBatch::changesModePerGroup(JsonObject common, const std::vector<GroupTarget>& targets) {
+  for (const GroupTarget& target : targets) {
+    JsonObject state = target.state;
+
+    for (const char* key : MODE_FIELDS) {
+      if (state.containsKey(key) && !common.containsKey(key)) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+bool GroupBatch::turnsOff(JsonObject state) {
+  if (state.containsKey(GroupStateFieldNames::STATUS)) {
+    return parseMilightStatus(state[GroupStateFieldNames::STATUS]) == OFF;
+  } else if (state.containsKey(GroupStateFieldNames::STATE)) {
+    return parseMilightStatus(state[GroupStateFieldNames::STATE]) == OFF;
+  }
+
+  return false;
+}
@@ -0,0 +1,46 @@
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include <ArduinoJson.h>
+
+#ifndef _GROUP_BATCH_H
+#define _GROUP_BATCH_H
+
+namespace RequestKeys {
+  static const char TRANSITION[] = "transition";
+};
+
+// Target state for a single group, used for batched multi-group updates
+struct GroupTarget {
+  uint8_t groupId;
+  JsonObject state;
+};
+
+/**
+ * Splits the target states of several groups of one device ID into the
+ * updates that are sent for them.  Fields with the same target value in every
+ * group of the device are sent once to group 0, and everything else goes to
+ * the individual groups.  A group 0 "off" comes after the per-group updates so
+ * that turning off still happens last.  So does a group 0 brightness when any
+ * group changes mode on its own, since the level applies to the new mode.
+ *
+ * Kept apart from MiLightClient so that the split can be checked without a
+ * radio.
+ */
+class GroupBatch {
+public:
+  typedef std::function<void(uint8_t groupId, JsonObject state)> UpdateFn;
+
+  static void split(const uint8_t numGroups, const std::vector<GroupTarget>& targets, UpdateFn update);
+
+  // True if the same value is assigned to `key` in every target
+  static bool isCommonField(const char* key, JsonVariant value, const std::vector<GroupTarget>& targets);
+
+private:
+  static bool turnsOff(JsonObject state);
+
+  // True if some target has a mode-changing field that isn't sent to group 0
+  static bool changesModePerGroup(JsonObject common, const std::vector<GroupTarget>& targets);
+};
+
+#endif
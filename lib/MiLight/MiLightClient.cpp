@@ -1,7 +1,6 @@
 #include <MiLightClient.h>
 #include <MiLightRadioConfig.h>
 #include <Arduino.h>
-#include <RGBConverter.h>
 #include <Units.h>
 #include <TokenIterator.h>
 #include <ParsedColor.h>
@@ -437,6 +436,37 @@ void MiLightClient::update(JsonObject request) {
   }
 }
 
+void MiLightClient::updateGroups(
+  const MiLightRemoteConfig* remoteConfig,
+  const uint16_t deviceId,
+  const std::vector<GroupTarget>& targets
+) {
+  GroupBatch::split(
+    remoteConfig->numGroups,
+    targets,
+    [this, remoteConfig, deviceId](uint8_t groupId, JsonObject state) {
+      prepare(remoteConfig, deviceId, groupId);
+      update(state);
+    }
+  );
+}
+
+void MiLightClient::updateGroups(
+  const MiLightRemoteConfig* remoteConfig,
+  const uint16_t deviceId,
+  const std::vector<uint8_t>& groupIds,
+  JsonObject state
+) {
+  std::vector<GroupTarget> targets;
+  targets.reserve(groupIds.size());
+
+  for (uint8_t groupId : groupIds) {
+    targets.push_back({ groupId, state });
+  }
+
+  updateGroups(remoteConfig, deviceId, targets);
+}
+
 void MiLightClient::handleCommands(JsonArray commands) {
   if (! commands.isNull()) {
     for (size_t i = 0; i < commands.size(); i++) {
@@ -694,7 +724,7 @@ void MiLightClient::flushPacket() {
   PacketStream& stream = currentRemote->packetFormatter->buildPackets();
 
   while (stream.hasNext()) {
-    packetSender.enqueue(stream.next(), currentRemote, repeatsOverride);
+    packetSender.enqueue(stream.next(), currentRemote, repeatsOverride, stream.freshSequence);
   }
 
   currentRemote->packetFormatter->reset();
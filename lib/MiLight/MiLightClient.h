@@ -7,6 +7,7 @@
 #include <GroupStateStore.h>
 #include <PacketSender.h>
 #include <TransitionController.h>
+#include <GroupBatch.h>
 #include <cstring>
 #include <map>
 #include <set>
@@ -19,10 +20,6 @@
 
 #define FSH(str) (reinterpret_cast<const __FlashStringHelper*>(str))
 
-namespace RequestKeys {
-  static const char TRANSITION[] = "transition";
-};
-
 namespace TransitionParams {
   static const char FIELD[] PROGMEM = "field";
   static const char START_VALUE[] PROGMEM = "start_value";
@@ -92,6 +89,13 @@ public:
   void updateSaturation(const uint8_t saturation);
 
   void update(JsonObject object);
+
+  // Apply target states to several groups of the same device ID.  Fields which
+  // have the same target value in every group of the device are sent once to
+  // group 0.  Everything else is sent to the individual groups.  State is kept
+  // consistent by the packet sent handler, which fans group 0 out to each group.
+  void updateGroups(const MiLightRemoteConfig* remoteConfig, const uint16_t deviceId, const std::vector<GroupTarget>& targets);
+  void updateGroups(const MiLightRemoteConfig* remoteConfig, const uint16_t deviceId, const std::vector<uint8_t>& groupIds, JsonObject state);
   void handleCommand(JsonVariant command);
   void handleCommands(JsonArray commands);
   bool handleTransition(JsonObject args, JsonDocument& responseObj);
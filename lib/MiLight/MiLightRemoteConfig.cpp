@@ -1,5 +1,15 @@
 #include <MiLightRemoteConfig.h>
 #include <MiLightRemoteType.h>
+#include <V2RFEncoding.h>
+
+// Formatters are statically allocated alongside the configs that own them.
+static RgbwPacketFormatter rgbwFormatter;
+static CctPacketFormatter cctFormatter;
+static RgbCctPacketFormatter rgbCctFormatter;
+static FUT089PacketFormatter fut089Formatter;
+static RgbPacketFormatter rgbFormatter;
+static FUT091PacketFormatter fut091Formatter;
+static FUT020PacketFormatter fut020Formatter;
 
 /**
  * IMPORTANT NOTE: These should be in the same order as MiLightRemoteType.
@@ -35,74 +45,106 @@ const MiLightRemoteConfig* MiLightRemoteConfig::fromReceivedPacket(
   const uint8_t* packet,
   const size_t len
 ) {
-  for (size_t i = 0; i < MiLightRemoteConfig::NUM_REMOTES; i++) {
-    const MiLightRemoteConfig* config = MiLightRemoteConfig::ALL_REMOTES[i];
-    if (&config->radioConfig == &radioConfig
-      && config->packetFormatter->canHandle(packet, len)) {
-      return config;
-    }
-  }
+  MiLightRemoteType type = remoteTypeForPacket(radioConfig, packet, len);
 
-  // This can happen under normal circumstances, so not an error condition
+  if (type == REMOTE_TYPE_UNKNOWN) {
+    // This can happen under normal circumstances, so not an error condition
 #ifdef DEBUG_PRINTF
-  Serial.println(F("MiLightRemoteConfig::fromReceivedPacket: ERROR - tried to fetch remote config for unknown packet"));
+    Serial.println(F("MiLightRemoteConfig::fromReceivedPacket: ERROR - tried to fetch remote config for unknown packet"));
 #endif
+    return NULL;
+  }
 
-  return NULL;
+  return ALL_REMOTES[type];
+}
+
+MiLightRemoteType MiLightRemoteConfig::remoteTypeForPacket(
+  const MiLightRadioConfig& radioConfig,
+  const uint8_t* packet,
+  const size_t len
+) {
+  // Each V1 protocol has its own radio config, so at most one header check is needed.
+  if (&radioConfig == &FUT096Config.radioConfig) {
+    return matchesV1Packet<REMOTE_TYPE_RGBW>(packet, len) ? REMOTE_TYPE_RGBW : REMOTE_TYPE_UNKNOWN;
+  } else if (&radioConfig == &FUT007Config.radioConfig) {
+    return matchesV1Packet<REMOTE_TYPE_CCT>(packet, len) ? REMOTE_TYPE_CCT : REMOTE_TYPE_UNKNOWN;
+  } else if (&radioConfig == &FUT098Config.radioConfig) {
+    return matchesV1Packet<REMOTE_TYPE_RGB>(packet, len) ? REMOTE_TYPE_RGB : REMOTE_TYPE_UNKNOWN;
+  } else if (&radioConfig == &FUT020Config.radioConfig) {
+    return matchesV1Packet<REMOTE_TYPE_FUT020>(packet, len) ? REMOTE_TYPE_FUT020 : REMOTE_TYPE_UNKNOWN;
+  } else if (&radioConfig != &FUT092Config.radioConfig || len != V2_PACKET_LEN) {
+    return REMOTE_TYPE_UNKNOWN;
+  }
+
+  // The V2 remotes share a radio config.  Decode once and dispatch on the protocol ID.
+  uint8_t packetCopy[V2_PACKET_LEN];
+  memcpy(packetCopy, packet, V2_PACKET_LEN);
+  V2RFEncoding::decodeV2Packet(packetCopy);
+
+  switch (packetCopy[V2_PROTOCOL_ID_INDEX]) {
+    case PacketFormatterTraits<REMOTE_TYPE_RGB_CCT>::PROTOCOL_ID:
+      return REMOTE_TYPE_RGB_CCT;
+    case PacketFormatterTraits<REMOTE_TYPE_FUT089>::PROTOCOL_ID:
+      return REMOTE_TYPE_FUT089;
+    case PacketFormatterTraits<REMOTE_TYPE_FUT091>::PROTOCOL_ID:
+      return REMOTE_TYPE_FUT091;
+    default:
+      return REMOTE_TYPE_UNKNOWN;
+  }
 }
 
 const MiLightRemoteConfig FUT096Config( //rgbw
-  new RgbwPacketFormatter(),
+  &rgbwFormatter,
   MiLightRadioConfig::ALL_CONFIGS[0],
   REMOTE_TYPE_RGBW,
   "rgbw",
-  4
+  PacketFormatterTraits<REMOTE_TYPE_RGBW>::NUM_GROUPS
 );
 
 const MiLightRemoteConfig FUT007Config( //cct
-  new CctPacketFormatter(),
+  &cctFormatter,
   MiLightRadioConfig::ALL_CONFIGS[1],
   REMOTE_TYPE_CCT,
   "cct",
-  4
+  PacketFormatterTraits<REMOTE_TYPE_CCT>::NUM_GROUPS
 );
 
 const MiLightRemoteConfig FUT091Config( //v2 cct
-  new FUT091PacketFormatter(),
+  &fut091Formatter,
   MiLightRadioConfig::ALL_CONFIGS[2],
   REMOTE_TYPE_FUT091,
   "fut091",
-  4
+  PacketFormatterTraits<REMOTE_TYPE_FUT091>::NUM_GROUPS
 );
 
 const MiLightRemoteConfig FUT092Config( //rgb+cct
-  new RgbCctPacketFormatter(),
+  &rgbCctFormatter,
   MiLightRadioConfig::ALL_CONFIGS[2],
   REMOTE_TYPE_RGB_CCT,
   "rgb_cct",
-  4
+  PacketFormatterTraits<REMOTE_TYPE_RGB_CCT>::NUM_GROUPS
 );
 
 const MiLightRemoteConfig FUT089Config( //rgb+cct B8 / FUT089
-  new FUT089PacketFormatter(),
+  &fut089Formatter,
   MiLightRadioConfig::ALL_CONFIGS[2],
   REMOTE_TYPE_FUT089,
   "fut089",
-  8
+  PacketFormatterTraits<REMOTE_TYPE_FUT089>::NUM_GROUPS
 );
 
 const MiLightRemoteConfig FUT098Config( //rgb
-  new RgbPacketFormatter(),
+  &rgbFormatter,
   MiLightRadioConfig::ALL_CONFIGS[3],
   REMOTE_TYPE_RGB,
   "rgb",
-  0
+  PacketFormatterTraits<REMOTE_TYPE_RGB>::NUM_GROUPS
 );
 
 const MiLightRemoteConfig FUT020Config(
-  new FUT020PacketFormatter(),
+  &fut020Formatter,
   MiLightRadioConfig::ALL_CONFIGS[4],
   REMOTE_TYPE_FUT020,
   "fut020",
-  0
+  PacketFormatterTraits<REMOTE_TYPE_FUT020>::NUM_GROUPS
 );
\ No newline at end of file
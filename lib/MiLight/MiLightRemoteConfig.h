@@ -19,7 +19,7 @@ public:
     PacketFormatter* packetFormatter,
     MiLightRadioConfig& radioConfig,
     const MiLightRemoteType type,
-    const String name,
+    const char* name,
     const size_t numGroups
   ) : packetFormatter(packetFormatter),
       radioConfig(radioConfig),
@@ -31,13 +31,17 @@ public:
   PacketFormatter* const packetFormatter;
   const MiLightRadioConfig& radioConfig;
   const MiLightRemoteType type;
-  const String name;
+  const char* const name;
   const size_t numGroups;
 
   static const MiLightRemoteConfig* fromType(MiLightRemoteType type);
   static const MiLightRemoteConfig* fromType(const String& type);
   static const MiLightRemoteConfig* fromReceivedPacket(const MiLightRadioConfig& radioConfig, const uint8_t* packet, const size_t len);
 
+  // Identifies the remote that sent a packet without going through the formatters.
+  // Returns REMOTE_TYPE_UNKNOWN if no remote on this radio config recognizes it.
+  static MiLightRemoteType remoteTypeForPacket(const MiLightRadioConfig& radioConfig, const uint8_t* packet, const size_t len);
+
   static const size_t NUM_REMOTES;
   static const MiLightRemoteConfig* ALL_REMOTES[];
 };
@@ -1,12 +1,16 @@
 #include <PacketFormatter.h>
 
-static uint8_t* PACKET_BUFFER = new uint8_t[PACKET_FORMATTER_BUFFER_SIZE];
+// Statically allocated so that it is valid before any formatter is constructed
+static uint8_t PACKET_BUFFER[PACKET_FORMATTER_BUFFER_SIZE];
+
+SequenceNumberTable PacketFormatter::sequenceNumbers;
 
 PacketStream::PacketStream()
     : packetStream(PACKET_BUFFER),
       numPackets(0),
       packetLength(0),
-      currentPacket(0)
+      currentPacket(0),
+      freshSequence(false)
 { }
 
 bool PacketStream::hasNext() {
@@ -34,12 +38,6 @@ void PacketFormatter::initialize(GroupStateStore* stateStore, const Settings* se
   this->settings = settings;
 }
 
-bool PacketFormatter::canHandle(const uint8_t *packet, const size_t len) {
-  return len == packetLength;
-}
-
-void PacketFormatter::finalizePacket(uint8_t* packet) { }
-
 void PacketFormatter::updateStatus(MiLightStatus status) {
   updateStatus(status, groupId);
 }
@@ -94,11 +92,7 @@ void PacketFormatter::unpair() {
   pair();
 }
 
-PacketStream& PacketFormatter::buildPackets() {
-  if (numPackets > 0) {
-    finalizePacket(currentPacket);
-  }
-
+PacketStream& PacketFormatter::finishPackets() {
   packetStream.numPackets = numPackets;
   packetStream.currentPacket = 0;
 
@@ -144,22 +138,29 @@ void PacketFormatter::reset() {
   this->numPackets = 0;
   this->currentPacket = PACKET_BUFFER;
   this->held = false;
+  this->packetStream.freshSequence = false;
 }
 
-void PacketFormatter::pushPacket() {
-  if (numPackets > 0) {
-    finalizePacket(currentPacket);
-  }
-
+bool PacketFormatter::beginPacket() {
   // Make sure there's enough buffer to add another packet.
   if ((currentPacket + packetLength) >= PACKET_BUFFER + PACKET_FORMATTER_BUFFER_SIZE) {
     Serial.println(F("ERROR: packet buffer full!  Cannot buffer a new packet.  THIS IS A BUG!"));
-    return;
+    return false;
   }
 
   currentPacket = PACKET_BUFFER + (numPackets * packetLength);
   numPackets++;
-  initializePacket(currentPacket);
+
+  bool fresh;
+  sequenceNum = sequenceNumbers.next(deviceId, deviceType, fresh);
+
+  // Every packet after the first follows a number assigned just now, so the
+  // first one decides for the stream
+  if (numPackets == 1) {
+    packetStream.freshSequence = fresh;
+  }
+
+  return true;
 }
 
 void PacketFormatter::format(uint8_t const* packet, char* buffer) {
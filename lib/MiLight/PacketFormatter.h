@@ -6,6 +6,8 @@
 #include <GroupState.h>
 #include <GroupStateStore.h>
 #include <Settings.h>
+#include <PacketFormatterTraits.h>
+#include <SequenceNumberTable.h>
 
 #ifndef _PACKET_FORMATTER_H
 #define _PACKET_FORMATTER_H
@@ -25,6 +27,10 @@ struct PacketStream {
   size_t numPackets;
   size_t packetLength;
   size_t currentPacket;
+
+  // True if every packet in the stream has a sequence number its device is known
+  // not to have seen yet.  See SequenceNumberTable.
+  bool freshSequence;
 };
 
 class PacketFormatter {
@@ -40,8 +46,6 @@ public:
 
   typedef void (PacketFormatter::*StepFunction)();
 
-  virtual bool canHandle(const uint8_t* packet, const size_t len);
-
   void updateStatus(MiLightStatus status);
   void toggleStatus();
   virtual void updateStatus(MiLightStatus status, uint8_t groupId);
@@ -79,7 +83,7 @@ public:
 
   virtual void reset();
 
-  virtual PacketStream& buildPackets();
+  virtual PacketStream& buildPackets() = 0;
   virtual void prepare(uint16_t deviceId, uint8_t groupId);
   virtual void format(uint8_t const* packet, char* buffer);
 
@@ -90,6 +94,10 @@ public:
 
   size_t getPacketLength() const;
 
+  // Sequence numbers are tracked per device rather than per formatter, so that
+  // interleaved commands to different devices don't share a sequence.
+  static SequenceNumberTable sequenceNumbers;
+
 protected:
   const MiLightRemoteType deviceType;
   size_t packetLength;
@@ -98,12 +106,16 @@ protected:
   bool held;
   uint16_t deviceId;
   uint8_t groupId;
+  // Sequence number for the packet being initialized.  Assigned by pushPacket.
   uint8_t sequenceNum;
   PacketStream packetStream;
   GroupStateStore* stateStore = NULL;
   const Settings* settings = NULL;
 
-  void pushPacket();
+  // Shared halves of pushPacket and buildPackets.  The per-format hooks are
+  // called around these by PacketFormatterBase.
+  bool beginPacket();
+  PacketStream& finishPackets();
 
   // Get field into a desired state using only increment/decrement commands.  Do this by:
   //   1. Driving it down to its minimum value
@@ -112,9 +124,44 @@ protected:
   // If the current state is already known, take that into account and apply the exact
   // number of rpeeats for the appropriate command.
   void valueByStepFunction(StepFunction increase, StepFunction decrease, uint8_t numSteps, uint8_t targetValue, int8_t knownValue = -1);
+};
 
-  virtual void initializePacket(uint8_t* packetStart) = 0;
-  virtual void finalizePacket(uint8_t* packet);
+// Formatters derive from this rather than PacketFormatter directly.  Derived
+// must provide initializePacket(uint8_t*), and may hide finalizePacket(uint8_t*)
+// if its packets need a checksum or encoding pass.  Both are resolved at compile
+// time, so building a packet costs no virtual calls.
+template <typename Derived>
+class PacketFormatterBase : public PacketFormatter {
+public:
+  PacketFormatterBase(const MiLightRemoteType deviceType, const size_t packetLength, const size_t maxPackets = 1)
+    : PacketFormatter(deviceType, packetLength, maxPackets)
+  { }
+
+  virtual PacketStream& buildPackets() override {
+    if (numPackets > 0) {
+      derived().finalizePacket(currentPacket);
+    }
+
+    return finishPackets();
+  }
+
+protected:
+  void pushPacket() {
+    if (numPackets > 0) {
+      derived().finalizePacket(currentPacket);
+    }
+
+    if (beginPacket()) {
+      derived().initializePacket(currentPacket);
+    }
+  }
+
+  void finalizePacket(uint8_t* packet) { }
+
+private:
+  Derived& derived() {
+    return *static_cast<Derived*>(this);
+  }
 };
 
 #endif
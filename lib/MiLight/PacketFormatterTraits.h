@@ -0,0 +1,90 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <MiLightRemoteType.h>
+
+#ifndef _PACKET_FORMATTER_TRAITS_H
+#define _PACKET_FORMATTER_TRAITS_H
+
+/**
+ * Compile-time description of each remote's wire format.  Formatters and remote
+ * configs are built from these, and MiLightRemoteConfig::fromReceivedPacket uses
+ * them to identify a received packet with a single switch instead of asking every
+ * formatter in turn.
+ *
+ * V1 protocols are identified by their first byte (after applying HEADER_MASK).
+ * V2 protocols are identified by the protocol ID in the decoded packet.
+ */
+template <MiLightRemoteType Type>
+struct PacketFormatterTraits;
+
+template <>
+struct PacketFormatterTraits<REMOTE_TYPE_RGBW> {
+  static constexpr size_t PACKET_LENGTH = 7;
+  static constexpr size_t MAX_PACKETS = 1;
+  static constexpr uint8_t HEADER = 0xB0;
+  // Low nibble of the header carries the disco mode
+  static constexpr uint8_t HEADER_MASK = 0xF0;
+  static constexpr uint8_t NUM_GROUPS = 4;
+};
+
+template <>
+struct PacketFormatterTraits<REMOTE_TYPE_CCT> {
+  static constexpr size_t PACKET_LENGTH = 7;
+  static constexpr size_t MAX_PACKETS = 20;
+  static constexpr uint8_t HEADER = 0x5A;
+  static constexpr uint8_t HEADER_MASK = 0xFF;
+  static constexpr uint8_t NUM_GROUPS = 4;
+};
+
+template <>
+struct PacketFormatterTraits<REMOTE_TYPE_RGB> {
+  static constexpr size_t PACKET_LENGTH = 6;
+  static constexpr size_t MAX_PACKETS = 20;
+  static constexpr uint8_t HEADER = 0xA4;
+  // RGB remotes have always been matched on length alone
+  static constexpr uint8_t HEADER_MASK = 0x00;
+  static constexpr uint8_t NUM_GROUPS = 0;
+};
+
+template <>
+struct PacketFormatterTraits<REMOTE_TYPE_FUT020> {
+  static constexpr size_t PACKET_LENGTH = 6;
+  static constexpr size_t MAX_PACKETS = 10;
+  static constexpr uint8_t HEADER = 0xA5;
+  static constexpr uint8_t HEADER_MASK = 0xFF;
+  static constexpr uint8_t NUM_GROUPS = 0;
+};
+
+template <>
+struct PacketFormatterTraits<REMOTE_TYPE_RGB_CCT> {
+  static constexpr size_t PACKET_LENGTH = 9;
+  static constexpr size_t MAX_PACKETS = 1;
+  static constexpr uint8_t PROTOCOL_ID = 0x20;
+  static constexpr uint8_t NUM_GROUPS = 4;
+};
+
+template <>
+struct PacketFormatterTraits<REMOTE_TYPE_FUT089> {
+  static constexpr size_t PACKET_LENGTH = 9;
+  static constexpr size_t MAX_PACKETS = 1;
+  static constexpr uint8_t PROTOCOL_ID = 0x25;
+  static constexpr uint8_t NUM_GROUPS = 8;
+};
+
+template <>
+struct PacketFormatterTraits<REMOTE_TYPE_FUT091> {
+  static constexpr size_t PACKET_LENGTH = 9;
+  static constexpr size_t MAX_PACKETS = 1;
+  static constexpr uint8_t PROTOCOL_ID = 0x21;
+  static constexpr uint8_t NUM_GROUPS = 4;
+};
+
+// Header check for the V1 protocols.  Inlined into the type switch in
+// MiLightRemoteConfig.
+template <MiLightRemoteType Type>
+inline bool matchesV1Packet(const uint8_t* packet, const size_t len) {
+  typedef PacketFormatterTraits<Type> Traits;
+  return len == Traits::PACKET_LENGTH && (packet[0] & Traits::HEADER_MASK) == (Traits::HEADER & Traits::HEADER_MASK);
+}
+
+#endif
@@ -19,7 +19,7 @@ PacketSender::PacketSender(
     )
 { }
 
-void PacketSender::enqueue(uint8_t* packet, const MiLightRemoteConfig* remoteConfig, const size_t repeatsOverride) {
+void PacketSender::enqueue(uint8_t* packet, const MiLightRemoteConfig* remoteConfig, const size_t repeatsOverride, const bool freshSequence) {
 #ifdef DEBUG_PRINTF
   Serial.println("Enqueuing packet");
 #endif
@@ -27,6 +27,12 @@ void PacketSender::enqueue(uint8_t* packet, const MiLightRemoteConfig* remoteCon
     ? this->currentResendCount
     : repeatsOverride;
 
+  // Bulbs drop repeats of a sequence number they've already seen, so repeats of a
+  // new one are only there to get a single copy through.
+  if (freshSequence && repeatsOverride == DEFAULT_PACKET_SENDS_VALUE && settings.freshSequencePacketRepeats > 0) {
+    repeats = std::min(repeats, settings.freshSequencePacketRepeats);
+  }
+
   queue.push(packet, remoteConfig, repeats);
 }
 
@@ -16,7 +16,10 @@ public:
     PacketSentHandler packetSentHandler
   );
 
-  void enqueue(uint8_t* packet, const MiLightRemoteConfig* remoteConfig, const size_t repeatsOverride = 0);
+  // freshSequence should be set if the packet's sequence number is known to be new
+  // to its device (see PacketStream).  Such packets are sent with the
+  // fresh_sequence_packet_repeats setting, if enabled.
+  void enqueue(uint8_t* packet, const MiLightRemoteConfig* remoteConfig, const size_t repeatsOverride = 0, const bool freshSequence = false);
   void loop();
 
   // Return true if there are queued packets
@@ -29,10 +29,12 @@ enum MiLightRgbCctArguments {
   RGB_CCT_MODE_SPEED_DOWN = 0x0B
 };
 
-class RgbCctPacketFormatter : public V2PacketFormatter {
+class RgbCctPacketFormatter final : public V2PacketFormatter {
 public:
+  typedef PacketFormatterTraits<REMOTE_TYPE_RGB_CCT> Traits;
+
   RgbCctPacketFormatter()
-    : V2PacketFormatter(REMOTE_TYPE_RGB_CCT, 0x20, 4),
+    : V2PacketFormatter(REMOTE_TYPE_RGB_CCT, Traits::PROTOCOL_ID, Traits::NUM_GROUPS),
       lastMode(0)
   { }
 
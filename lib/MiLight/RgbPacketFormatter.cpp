@@ -5,12 +5,12 @@
 void RgbPacketFormatter::initializePacket(uint8_t *packet) {
   size_t packetPtr = 0;
 
-  packet[packetPtr++] = 0xA4;
+  packet[packetPtr++] = Traits::HEADER;
   packet[packetPtr++] = deviceId >> 8;
   packet[packetPtr++] = deviceId & 0xFF;
   packet[packetPtr++] = 0;
   packet[packetPtr++] = 0;
-  packet[packetPtr++] = sequenceNum++;
+  packet[packetPtr++] = sequenceNum;
 }
 
 void RgbPacketFormatter::pair() {
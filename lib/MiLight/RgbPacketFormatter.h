@@ -19,10 +19,12 @@ enum MiLightRgbButton {
   RGB_PAIR            = RGB_SPEED_UP
 };
 
-class RgbPacketFormatter : public PacketFormatter {
+class RgbPacketFormatter final : public PacketFormatterBase<RgbPacketFormatter> {
 public:
+  typedef PacketFormatterTraits<REMOTE_TYPE_RGB> Traits;
+
   RgbPacketFormatter()
-    : PacketFormatter(REMOTE_TYPE_RGB, 6, 20)
+    : PacketFormatterBase(REMOTE_TYPE_RGB, Traits::PACKET_LENGTH, Traits::MAX_PACKETS)
   { }
 
   virtual void updateStatus(MiLightStatus status, uint8_t groupId);
@@ -41,7 +43,10 @@ public:
   virtual void previousMode();
   virtual BulbId parsePacket(const uint8_t* packet, JsonObject result);
 
-  virtual void initializePacket(uint8_t* packet);
+protected:
+  friend class PacketFormatterBase<RgbPacketFormatter>;
+
+  void initializePacket(uint8_t* packet);
 };
 
 #endif
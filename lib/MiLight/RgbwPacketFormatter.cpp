@@ -6,10 +6,6 @@
 #define GROUP_FOR_STATUS_COMMAND(buttonId) ( ((buttonId) - 1) / 2 )
 #define STATUS_FOR_COMMAND(buttonId) ( ((buttonId) % 2) == 0 ? OFF : ON )
 
-bool RgbwPacketFormatter::canHandle(const uint8_t *packet, const size_t len) {
-  return len == packetLength && (packet[0] & 0xF0) == RGBW_PROTOCOL_ID_BYTE;
-}
-
 void RgbwPacketFormatter::initializePacket(uint8_t* packet) {
   size_t packetPtr = 0;
 
@@ -19,7 +15,7 @@ void RgbwPacketFormatter::initializePacket(uint8_t* packet) {
   packet[packetPtr++] = 0;
   packet[packetPtr++] = (groupId & 0x07);
   packet[packetPtr++] = 0;
-  packet[packetPtr++] = sequenceNum++;
+  packet[packetPtr++] = sequenceNum;
 }
 
 void RgbwPacketFormatter::unpair() {
@@ -3,7 +3,7 @@
 #ifndef _RGBW_PACKET_FORMATTER_H
 #define _RGBW_PACKET_FORMATTER_H
 
-#define RGBW_PROTOCOL_ID_BYTE 0xB0
+#define RGBW_PROTOCOL_ID_BYTE (PacketFormatterTraits<REMOTE_TYPE_RGBW>::HEADER)
 
 enum MiLightRgbwButton {
   RGBW_ALL_ON            = 0x01,
@@ -49,13 +49,14 @@ enum MiLightRgbwButton {
 #define RGBW_COLOR_INDEX 3
 #define RGBW_NUM_MODES 9
 
-class RgbwPacketFormatter : public PacketFormatter {
+class RgbwPacketFormatter final : public PacketFormatterBase<RgbwPacketFormatter> {
 public:
+  typedef PacketFormatterTraits<REMOTE_TYPE_RGBW> Traits;
+
   RgbwPacketFormatter()
-    : PacketFormatter(REMOTE_TYPE_RGBW, 7)
+    : PacketFormatterBase(REMOTE_TYPE_RGBW, Traits::PACKET_LENGTH, Traits::MAX_PACKETS)
   { }
 
-  virtual bool canHandle(const uint8_t* packet, const size_t len);
   virtual void updateStatus(MiLightStatus status, uint8_t groupId);
   virtual void updateBrightness(uint8_t value);
   virtual void command(uint8_t command, uint8_t arg);
@@ -72,9 +73,10 @@ public:
   virtual void enableNightMode();
   virtual BulbId parsePacket(const uint8_t* packet, JsonObject result);
 
-  virtual void initializePacket(uint8_t* packet);
-
 protected:
+  friend class PacketFormatterBase<RgbwPacketFormatter>;
+
+  void initializePacket(uint8_t* packet);
   static bool isStatusCommand(const uint8_t command);
   uint8_t currentMode();
 };
@@ -0,0 +1,61 @@
+#include <SequenceNumberTable.h>
+#include <string.h>
+
+SequenceNumberTable::SequenceNumberTable()
+  : count(0),
+    untrackedSequenceNum(0)
+{ }
+
+uint8_t SequenceNumberTable::next(uint16_t deviceId, MiLightRemoteType type, bool& fresh) {
+  const int index = find(deviceId, type);
+  Entry entry;
+
+  if (index >= 0) {
+    entry = entries[index];
+    entry.sequenceNum++;
+    shiftDown(index);
+    fresh = true;
+  } else {
+    entry.deviceId = deviceId;
+    entry.type = type;
+    entry.sequenceNum = untrackedSequenceNum++;
+
+    // Drops the least recently used entry if the table is full
+    shiftDown(count < MILIGHT_SEQUENCE_TABLE_SIZE ? count++ : MILIGHT_SEQUENCE_TABLE_SIZE - 1);
+    fresh = false;
+  }
+
+  entries[0] = entry;
+  return entry.sequenceNum;
+}
+
+void SequenceNumberTable::forget(uint16_t deviceId, MiLightRemoteType type) {
+  const int index = find(deviceId, type);
+
+  if (index >= 0) {
+    memmove(&entries[index], &entries[index + 1], (count - index - 1) * sizeof(Entry));
+    count--;
+  }
+}
+
+void SequenceNumberTable::clear() {
+  count = 0;
+}
+
+size_t SequenceNumberTable::size() const {
+  return count;
+}
+
+int SequenceNumberTable::find(uint16_t deviceId, MiLightRemoteType type) const {
+  for (size_t i = 0; i < count; i++) {
+    if (entries[i].deviceId == deviceId && entries[i].type == type) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+void SequenceNumberTable::shiftDown(size_t index) {
+  memmove(&entries[1], &entries[0], index * sizeof(Entry));
+}
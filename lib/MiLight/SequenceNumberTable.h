@@ -0,0 +1,57 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <MiLightRemoteType.h>
+
+#ifndef _SEQUENCE_NUMBER_TABLE_H
+#define _SEQUENCE_NUMBER_TABLE_H
+
+// Each entry is 4 bytes
+#ifndef MILIGHT_SEQUENCE_TABLE_SIZE
+#define MILIGHT_SEQUENCE_TABLE_SIZE 32
+#endif
+
+/**
+ * Tracks the last sequence number sent to each (device ID, remote type), so that
+ * commands to one device don't advance another's sequence.  Bulbs ignore repeats
+ * of the sequence number they last saw, so as long as we know what that was, each
+ * new packet is guaranteed to be seen as new.
+ *
+ * Entries are kept in most-recently-used order.  When the table is full, the least
+ * recently used device is dropped, and its next packet is no longer fresh.
+ */
+class SequenceNumberTable {
+public:
+  SequenceNumberTable();
+
+  // Returns the sequence number for the next packet to this device.  fresh is set
+  // if the last number sent to the device is known, so this one is guaranteed to
+  // differ from it.
+  uint8_t next(uint16_t deviceId, MiLightRemoteType type, bool& fresh);
+
+  // Call when something else (e.g., a physical remote) may have sent packets to
+  // this device.  Its next packet will not be fresh.
+  void forget(uint16_t deviceId, MiLightRemoteType type);
+
+  void clear();
+  size_t size() const;
+
+private:
+  struct Entry {
+    uint16_t deviceId;
+    uint8_t type;
+    uint8_t sequenceNum;
+  };
+
+  Entry entries[MILIGHT_SEQUENCE_TABLE_SIZE];
+  size_t count;
+
+  // Starting point for devices that aren't in the table
+  uint8_t untrackedSequenceNum;
+
+  int find(uint16_t deviceId, MiLightRemoteType type) const;
+
+  // Move entries[0, index) down one slot, freeing entries[0]
+  void shiftDown(size_t index);
+};
+
+#endif
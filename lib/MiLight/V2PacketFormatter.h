@@ -13,20 +13,15 @@
 // Default number of values to allow before and after strictly defined range for V2 scales
 #define V2_DEFAULT_RANGE_BUFFER 0x13
 
-class V2PacketFormatter : public PacketFormatter {
+class V2PacketFormatter : public PacketFormatterBase<V2PacketFormatter> {
 public:
   V2PacketFormatter(const MiLightRemoteType deviceType, uint8_t protocolId, uint8_t numGroups);
 
-  virtual bool canHandle(const uint8_t* packet, const size_t packetLen);
-  virtual void initializePacket(uint8_t* packet);
-
   virtual void updateStatus(MiLightStatus status, uint8_t group);
   virtual void command(uint8_t command, uint8_t arg);
   virtual void format(uint8_t const* packet, char* buffer);
   virtual void unpair();
 
-  virtual void finalizePacket(uint8_t* packet);
-
   uint8_t groupCommandArg(MiLightStatus status, uint8_t groupId);
 
   /*
@@ -47,8 +42,13 @@ public:
   static uint8_t fromv2scale(uint8_t value, uint8_t endValue, uint8_t interval, bool reverse = true, uint8_t buffer = V2_DEFAULT_RANGE_BUFFER);
 
 protected:
+  friend class PacketFormatterBase<V2PacketFormatter>;
+
   const uint8_t protocolId;
   const uint8_t numGroups;
+
+  void initializePacket(uint8_t* packet);
+  void finalizePacket(uint8_t* packet);
   void switchMode(const GroupState& currentState, BulbMode desiredMode);
 };
 
@@ -0,0 +1,87 @@
+#include <GroupBroadcastLog.h>
+#include <string.h>
+
+size_t GroupBroadcastLog::Device::pending(uint8_t groupId) const {
+  if (groupId == 0 || groupId > numGroups) {
+    return 0;
+  }
+
+  return static_cast<uint8_t>(generation - groupGenerations[groupId - 1]);
+}
+
+void GroupBroadcastLog::Device::catchUp(uint8_t groupId, GroupState& state) {
+  const size_t numPending = pending(groupId);
+
+  for (size_t i = numPending; i > 0; i--) {
+    const uint8_t broadcast = generation - i + 1;
+    state.patch(broadcasts[broadcast % MILIGHT_BROADCAST_LOG_DEPTH]);
+  }
+
+  if (numPending > 0) {
+    groupGenerations[groupId - 1] = generation;
+  }
+}
+
+bool GroupBroadcastLog::Device::isFull(uint8_t groupId) const {
+  return pending(groupId) >= MILIGHT_BROADCAST_LOG_DEPTH;
+}
+
+void GroupBroadcastLog::Device::record(const GroupState& state) {
+  generation++;
+  broadcasts[generation % MILIGHT_BROADCAST_LOG_DEPTH] = state;
+}
+
+GroupBroadcastLog::GroupBroadcastLog()
+  : count(0)
+{ }
+
+GroupBroadcastLog::Device* GroupBroadcastLog::find(uint16_t deviceId, MiLightRemoteType type) {
+  const int index = indexOf(deviceId, type);
+  return index >= 0 ? &devices[index] : NULL;
+}
+
+GroupBroadcastLog::Device* GroupBroadcastLog::promote(uint16_t deviceId, MiLightRemoteType type, uint8_t numGroups) {
+  int index = indexOf(deviceId, type);
+  Device device;
+
+  if (index >= 0) {
+    device = devices[index];
+  } else {
+    index = count < MILIGHT_BROADCAST_LOG_DEVICES ? count++ : MILIGHT_BROADCAST_LOG_DEVICES - 1;
+
+    device.deviceId = deviceId;
+    device.type = type;
+    device.numGroups = numGroups < MILIGHT_MAX_GROUPS_PER_DEVICE ? numGroups : MILIGHT_MAX_GROUPS_PER_DEVICE;
+    device.generation = 0;
+    memset(device.groupGenerations, 0, sizeof(device.groupGenerations));
+  }
+
+  for (size_t i = index; i > 0; i--) {
+    devices[i] = devices[i - 1];
+  }
+  devices[0] = device;
+
+  return &devices[0];
+}
+
+bool GroupBroadcastLog::isFull() const {
+  return count >= MILIGHT_BROADCAST_LOG_DEVICES;
+}
+
+size_t GroupBroadcastLog::size() const {
+  return count;
+}
+
+GroupBroadcastLog::Device& GroupBroadcastLog::operator[](size_t index) {
+  return devices[index];
+}
+
+int GroupBroadcastLog::indexOf(uint16_t deviceId, MiLightRemoteType type) const {
+  for (size_t i = 0; i < count; i++) {
+    if (devices[i].deviceId == deviceId && devices[i].type == type) {
+      return i;
+    }
+  }
+
+  return -1;
+}
@@ -0,0 +1,82 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <GroupState.h>
+
+#ifndef _GROUP_BROADCAST_LOG_H
+#define _GROUP_BROADCAST_LOG_H
+
+// Most groups any remote has (FUT089)
+#ifndef MILIGHT_MAX_GROUPS_PER_DEVICE
+#define MILIGHT_MAX_GROUPS_PER_DEVICE 8
+#endif
+
+// Number of devices with group 0 commands tracked at once
+#ifndef MILIGHT_BROADCAST_LOG_DEVICES
+#define MILIGHT_BROADCAST_LOG_DEVICES 8
+#endif
+
+// Group 0 commands kept per device.  Must be a power of two.
+#ifndef MILIGHT_BROADCAST_LOG_DEPTH
+#define MILIGHT_BROADCAST_LOG_DEPTH 4
+#endif
+
+/**
+ * Recent group 0 ("broadcast") commands for each device, and how many of them
+ * each individual group has seen.  Rather than patching every group when a group
+ * 0 command arrives, GroupStateStore records it here and applies it to a group
+ * the next time that group's state is read.
+ *
+ * Entries are kept in most-recently-used order.  Before an entry or a logged
+ * command is dropped, the groups that haven't seen it have to catch up.
+ */
+class GroupBroadcastLog {
+public:
+  class Device {
+  public:
+    uint16_t deviceId;
+    uint8_t type;
+    uint8_t numGroups;
+
+    // Number of group 0 commands not yet applied to groupId
+    size_t pending(uint8_t groupId) const;
+
+    // Applies pending commands to groupId's state, oldest first
+    void catchUp(uint8_t groupId, GroupState& state);
+
+    // A group with this many pending commands has to catch up before another
+    // command can be recorded
+    bool isFull(uint8_t groupId) const;
+    void record(const GroupState& state);
+
+  private:
+    friend class GroupBroadcastLog;
+
+    // Counts commands, wrapping.  Command n is in broadcasts[n % DEPTH].
+    uint8_t generation;
+    uint8_t groupGenerations[MILIGHT_MAX_GROUPS_PER_DEVICE];
+    GroupState broadcasts[MILIGHT_BROADCAST_LOG_DEPTH];
+  };
+
+  GroupBroadcastLog();
+
+  // Doesn't change the order of entries, so pointers stay valid
+  Device* find(uint16_t deviceId, MiLightRemoteType type);
+
+  // Finds or adds an entry for the device and moves it to the front.  If the log
+  // is full, the last entry is reused.  Invalidates other Device pointers.
+  Device* promote(uint16_t deviceId, MiLightRemoteType type, uint8_t numGroups);
+
+  bool isFull() const;
+  size_t size() const;
+
+  // Entries in most-recently-used order
+  Device& operator[](size_t index);
+
+private:
+  Device devices[MILIGHT_BROADCAST_LOG_DEVICES];
+  size_t count;
+
+  int indexOf(uint16_t deviceId, MiLightRemoteType type) const;
+};
+
+#endif
@@ -1,7 +1,7 @@
 #include <GroupState.h>
 #include <Units.h>
 #include <MiLightRemoteConfig.h>
-#include <RGBConverter.h>
+#include <ColorConversion.h>
 #include <BulbId.h>
 #include <MiLightCommands.h>
 
@@ -729,6 +729,21 @@ void GroupState::patch(const GroupState& other) {
   }
 }
 
+uint32_t GroupState::getChangedFields(const GroupState& other) const {
+  uint32_t changed = 0;
+
+  for (size_t i = 0; i < size(ALL_PHYSICAL_FIELDS); ++i) {
+    GroupStateField field = ALL_PHYSICAL_FIELDS[i];
+    const bool isSet = isSetField(field);
+
+    if (isSet != other.isSetField(field) || (isSet && getFieldValue(field) != other.getFieldValue(field))) {
+      changed |= 1UL << static_cast<unsigned>(field);
+    }
+  }
+
+  return changed;
+}
+
 /*
   Update group state to reflect a packet state
 
@@ -984,17 +999,11 @@ bool GroupState::isSetColor() const {
 
 ParsedColor GroupState::getColor() const {
   uint8_t rgb[3];
-  RGBConverter converter;
   uint16_t hue = getHue();
+  // Default to fully saturated
   uint8_t sat = isSetSaturation() ? getSaturation() : 100;
 
-  converter.hsvToRgb(
-    hue / 360.0,
-    // Default to fully saturated
-    sat / 100.0,
-    1,
-    rgb
-  );
+  ColorConversion::hsvToRgb(hue, sat, 255, rgb);
 
   return {
     .success = true,
@@ -1014,6 +1023,181 @@ void GroupState::applyState(JsonObject partialState, const BulbId& bulbId, std::
   }
 }
 
+// Writes the same members applyState would set.  Several fields share the
+// "color" key, and a JsonObject keeps a key where it was first set with the
+// value it was last set to, so only that value is written, at that position.
+void GroupState::writeState(GroupStateWriter& writer, const BulbId& bulbId, const std::vector<GroupStateField>& fields) const {
+  const BulbMode bulbMode = getBulbMode();
+  const bool hasBulbMode = isSetBulbMode();
+  GroupStateField colorField = GroupStateField::UNKNOWN;
+  uint32_t written = 0;
+
+  for (std::vector<GroupStateField>::const_iterator itr = fields.begin(); itr != fields.end(); ++itr) {
+    if (*itr == GroupStateField::COMPUTED_COLOR || (isColorField(*itr) && isSetHue() && bulbMode == BULB_MODE_COLOR)) {
+      colorField = *itr;
+    }
+  }
+
+  for (std::vector<GroupStateField>::const_iterator itr = fields.begin(); itr != fields.end(); ++itr) {
+    const GroupStateField field = *itr;
+    const uint32_t key = 1UL << static_cast<unsigned>(isColorField(field) ? GroupStateField::COLOR : field);
+
+    if ((written & key) || !isSetField(field)) {
+      continue;
+    }
+
+    if (isColorField(field)) {
+      if (field == GroupStateField::COMPUTED_COLOR || bulbMode == BULB_MODE_COLOR) {
+        writeColor(writer, colorField);
+        written |= key;
+      }
+      continue;
+    }
+
+    // Writing any other field again would repeat the same value
+    written |= key;
+
+    switch (field) {
+      case GroupStateField::STATE:
+      case GroupStateField::STATUS:
+        writer.writeKey(field);
+        writer.writeValue(getState() == ON ? "ON" : "OFF");
+        break;
+
+      case GroupStateField::BRIGHTNESS:
+        writer.writeKey(field);
+        writer.writeValue(Units::rescale(getBrightness(), 255, 100));
+        break;
+
+      case GroupStateField::LEVEL:
+        writer.writeKey(field);
+        writer.writeValue(getBrightness());
+        break;
+
+      case GroupStateField::BULB_MODE:
+        writer.writeKey(field);
+        writer.writeValue(BULB_MODE_NAMES[bulbMode]);
+        break;
+
+      case GroupStateField::HUE:
+        if (bulbMode == BULB_MODE_COLOR) {
+          writer.writeKey(field);
+          writer.writeValue(getHue());
+        }
+        break;
+
+      case GroupStateField::SATURATION:
+        if (bulbMode == BULB_MODE_COLOR) {
+          writer.writeKey(field);
+          writer.writeValue(getSaturation());
+        }
+        break;
+
+      case GroupStateField::MODE:
+        if (bulbMode == BULB_MODE_SCENE) {
+          writer.writeKey(field);
+          writer.writeValue(getMode());
+        }
+        break;
+
+      case GroupStateField::EFFECT:
+        if (bulbMode == BULB_MODE_SCENE) {
+          char mode[4];
+          sprintf(mode, "%u", getMode());
+          writer.writeKey(field);
+          writer.writeValue(mode);
+        } else if (hasBulbMode && bulbMode == BULB_MODE_WHITE) {
+          writer.writeKey(field);
+          writer.writeValue("white_mode");
+        } else if (bulbMode == BULB_MODE_NIGHT) {
+          writer.writeKey(field);
+          writer.writeValue(MiLightCommandNames::NIGHT_MODE);
+        }
+        break;
+
+      case GroupStateField::COLOR_TEMP:
+        if (hasBulbMode && bulbMode == BULB_MODE_WHITE) {
+          writer.writeKey(field);
+          writer.writeValue(getMireds());
+        }
+        break;
+
+      case GroupStateField::KELVIN:
+        if (hasBulbMode && bulbMode == BULB_MODE_WHITE) {
+          writer.writeKey(field);
+          writer.writeValue(getKelvin());
+        }
+        break;
+
+      case GroupStateField::DEVICE_ID:
+        writer.writeKey(field);
+        writer.writeValue(bulbId.deviceId);
+        break;
+
+      case GroupStateField::GROUP_ID:
+        writer.writeKey(field);
+        writer.writeValue(bulbId.groupId);
+        break;
+
+      case GroupStateField::DEVICE_TYPE:
+        {
+          const MiLightRemoteConfig* remoteConfig = MiLightRemoteConfig::fromType(bulbId.deviceType);
+          if (remoteConfig) {
+            writer.writeKey(field);
+            writer.writeValue(remoteConfig->name);
+          }
+        }
+        break;
+
+      default:
+        Serial.printf_P(PSTR("Tried to write unknown field: %d\n"), static_cast<uint8_t>(field));
+        break;
+    }
+  }
+}
+
+// Writes the "color" member in the format field calls for
+void GroupState::writeColor(GroupStateWriter& writer, GroupStateField field) const {
+  ParsedColor color = getColor();
+
+  writer.writeKey(GroupStateField::COLOR);
+
+  if (field == GroupStateField::OH_COLOR) {
+    char ohColorStr[13];
+    sprintf(ohColorStr, "%d,%d,%d", color.r, color.g, color.b);
+    writer.writeValue(ohColorStr);
+  } else if (field == GroupStateField::HEX_COLOR) {
+    char hexColor[8];
+    sprintf(hexColor, "#%02X%02X%02X", color.r, color.g, color.b);
+    writer.writeValue(hexColor);
+  } else {
+    if (getBulbMode() != BULB_MODE_COLOR) {
+      color.r = color.g = color.b = 255;
+    }
+
+    writer.beginObject();
+    writer.writeKey("r");
+    writer.writeValue(color.r);
+    writer.writeKey("g");
+    writer.writeValue(color.g);
+    writer.writeKey("b");
+    writer.writeValue(color.b);
+    writer.endObject();
+  }
+}
+
+bool GroupState::isColorField(GroupStateField field) {
+  switch (field) {
+    case GroupStateField::COLOR:
+    case GroupStateField::OH_COLOR:
+    case GroupStateField::HEX_COLOR:
+    case GroupStateField::COMPUTED_COLOR:
+      return true;
+    default:
+      return false;
+  }
+}
+
 bool GroupState::isPhysicalField(GroupStateField field) {
   for (size_t i = 0; i < size(ALL_PHYSICAL_FIELDS); ++i) {
     if (field == ALL_PHYSICAL_FIELDS[i]) {
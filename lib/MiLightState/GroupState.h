@@ -7,6 +7,7 @@
 #include <ArduinoJson.h>
 #include <BulbId.h>
 #include <ParsedColor.h>
+#include <GroupStateWriter.h>
 
 #ifndef _GROUP_STATE_H
 #define _GROUP_STATE_H
@@ -115,6 +116,10 @@ public:
   // Patches this state with ONLY the set fields in the other.
   void patch(const GroupState& other);
 
+  // Physical fields that are set in only one of the states, or have different
+  // values.  Bit n is for the GroupStateField with value n.
+  uint32_t getChangedFields(const GroupState& other) const;
+
   // Patches this state with the fields defined in the JSON state.  Returns
   // true if there were any changes.
   bool patch(JsonObject state);
@@ -126,6 +131,10 @@ public:
   void applyField(JsonObject state, const BulbId& bulbId, GroupStateField field) const;
   void applyState(JsonObject state, const BulbId& bulbId, std::vector<GroupStateField>& fields) const;
 
+  // Same as applyState, but writes the fields as members of writer's current
+  // object without building a JsonDocument
+  void writeState(GroupStateWriter& writer, const BulbId& bulbId, const std::vector<GroupStateField>& fields) const;
+
   // Attempt to keep track of increment commands in such a way that we can
   // know what state it's in.  When we get an increment command (like "increase
   // brightness"):
@@ -148,6 +157,9 @@ public:
   bool isSetColor() const;
   ParsedColor getColor() const;
 
+  // Number of 32-bit words read and written by load() and dump()
+  static const size_t DATA_LONGS = 2;
+
   void load(Stream& stream);
   void dump(Stream& stream) const;
 
@@ -159,7 +171,6 @@ public:
   static bool isPhysicalField(GroupStateField field);
 
 private:
-  static const size_t DATA_LONGS = 2;
   union StateData {
     uint32_t rawData[DATA_LONGS];
     struct Fields {
@@ -218,6 +229,9 @@ private:
   void applyOhColor(JsonObject state) const;
   // Apply hex color, e.g., {"color":"#FF0000"}
   void applyHexColor(JsonObject state) const;
+
+  void writeColor(GroupStateWriter& writer, GroupStateField field) const;
+  static bool isColorField(GroupStateField field);
 };
 
 extern const BulbId DEFAULT_BULB_ID;
@@ -1,72 +1,366 @@
 #include <GroupStateCache.h>
+#include <algorithm>
+#include <stdint.h>
+
+// 2^32 / golden ratio, for Fibonacci hashing
+#define GROUP_STATE_CACHE_HASH_MULTIPLIER 2654435769u
 
 GroupStateCache::GroupStateCache(const size_t maxSize)
-  : maxSize(maxSize)
-{ }
+  : maxSize(maxSize),
+    maxProbationSize(std::max<size_t>(1, maxSize * MILIGHT_STATE_CACHE_PROBATION_PERCENT / 100)),
+    // Ghost slots hold 16-bit ring positions
+    maxGhostSize(std::min<size_t>(
+      UINT16_MAX - 1,
+      std::max<size_t>(1, maxSize * MILIGHT_STATE_CACHE_GHOST_PERCENT / 100)
+    )),
+    count(0),
+    mainCount(0),
+    mainHead(NULL),
+    mainTail(NULL),
+    probationHead(NULL),
+    probationTail(NULL),
+    ghostNext(0),
+    ghostCount(0),
+    dirtyHead(NULL),
+    dirtyTail(NULL),
+    dirtyCount(0)
+{
+  // Keep the table at most 2/3 full so probe sequences stay short
+  size_t numSlots = 1;
+  while (numSlots < maxSize + maxSize / 2 + 1) {
+    numSlots <<= 1;
+  }
+
+  slots = new GroupCacheNode*[numSlots]();
+  slotMask = numSlots - 1;
+
+  size_t numGhostSlots = 1;
+  while (numGhostSlots < maxGhostSize + maxGhostSize / 2 + 1) {
+    numGhostSlots <<= 1;
+  }
+
+  ghostRing = new uint32_t[maxGhostSize];
+  ghostSlots = new uint16_t[numGhostSlots]();
+  ghostSlotMask = numGhostSlots - 1;
+}
 
 GroupStateCache::~GroupStateCache() {
-  ListNode<GroupCacheNode*>* cur = cache.getHead();
+  GroupCacheNode* lists[] = { mainHead, probationHead };
 
-  while (cur != NULL) {
-    delete cur->data;
-    cur = cur->next;
+  for (GroupCacheNode* cur : lists) {
+    while (cur != NULL) {
+      GroupCacheNode* next = cur->next;
+      delete cur;
+      cur = next;
+    }
   }
+
+  delete[] slots;
+  delete[] ghostRing;
+  delete[] ghostSlots;
 }
 
 GroupState* GroupStateCache::get(const BulbId& id) {
-  return getInternal(id);
+  GroupCacheNode* node = slots[findSlot(id)];
+
+  if (node == NULL) {
+    return NULL;
+  }
+
+  // Probation is FIFO, so only nodes in the main queue move
+  if (node->inMain && node != mainHead) {
+    unlink(node);
+    pushFront(node);
+  }
+
+  return &node->state;
 }
 
 GroupState* GroupStateCache::set(const BulbId& id, const GroupState& state) {
-  GroupCacheNode* pushedNode = NULL;
-  if (cache.size() >= maxSize) {
-    pushedNode = cache.pop();
-  }
-
-  GroupState* cachedState = getInternal(id);
-
-  if (cachedState == NULL) {
-    if (pushedNode == NULL) {
-      GroupCacheNode* newNode = new GroupCacheNode(id, state);
-      cachedState = &newNode->state;
-      cache.unshift(newNode);
-    } else {
-      pushedNode->id = id;
-      pushedNode->state = state;
-      cachedState = &pushedNode->state;
-      cache.unshift(pushedNode);
+  size_t slot = findSlot(id);
+  GroupCacheNode* node = slots[slot];
+
+  if (node != NULL) {
+    node->state = state;
+
+    if (node->inMain && node != mainHead) {
+      unlink(node);
+      pushFront(node);
     }
+
+    return &node->state;
+  }
+
+  const bool seenRecently = removeGhost(id.getCompactId());
+
+  if (count >= maxSize) {
+    node = selectVictim();
+    unlink(node);
+    removeSlot(findSlot(node->id));
+    clearDirty(node);
+
+    if (! node->inMain) {
+      addGhost(node->id.getCompactId());
+    }
+
+    // Removing a slot can shift the probe sequence for id
+    slot = findSlot(id);
+
+    node->id = id;
+    node->state = state;
   } else {
-    *cachedState = state;
+    node = new GroupCacheNode(id, state);
+    count++;
   }
 
-  return cachedState;
+  node->inMain = seenRecently;
+  slots[slot] = node;
+  pushFront(node);
+
+  return &node->state;
+}
+
+GroupCacheNode* GroupStateCache::getVictim() {
+  return count >= maxSize ? selectVictim() : NULL;
 }
 
-BulbId GroupStateCache::getLru() {
-  GroupCacheNode* node = cache.getLast();
-  return node->id;
+size_t GroupStateCache::mainSize() const {
+  return mainCount;
 }
 
 bool GroupStateCache::isFull() const {
-  return cache.size() >= maxSize;
+  return count >= maxSize;
+}
+
+size_t GroupStateCache::size() const {
+  return count;
+}
+
+size_t GroupStateCache::capacity() const {
+  return maxSize;
+}
+
+void GroupStateCache::markDirty(const BulbId& id, unsigned long now) {
+  GroupCacheNode* node = slots[findSlot(id)];
+
+  if (node != NULL) {
+    markDirty(node, now);
+  }
+}
+
+void GroupStateCache::markDirty(GroupStateNode* node, unsigned long now) {
+  if (isDirtyListed(node)) {
+    return;
+  }
+
+  node->dirtySince = now;
+  node->prevDirty = dirtyTail;
+  node->nextDirty = NULL;
+
+  if (dirtyTail != NULL) {
+    dirtyTail->nextDirty = node;
+  } else {
+    dirtyHead = node;
+  }
+
+  dirtyTail = node;
+  dirtyCount++;
+}
+
+void GroupStateCache::clearDirty(GroupStateNode* node) {
+  if (! isDirtyListed(node)) {
+    return;
+  }
+
+  if (node->prevDirty != NULL) {
+    node->prevDirty->nextDirty = node->nextDirty;
+  } else {
+    dirtyHead = node->nextDirty;
+  }
+
+  if (node->nextDirty != NULL) {
+    node->nextDirty->prevDirty = node->prevDirty;
+  } else {
+    dirtyTail = node->prevDirty;
+  }
+
+  node->prevDirty = NULL;
+  node->nextDirty = NULL;
+  dirtyCount--;
+}
+
+GroupStateNode* GroupStateCache::getOldestDirty() {
+  return dirtyHead;
+}
+
+size_t GroupStateCache::getDirtyCount() const {
+  return dirtyCount;
+}
+
+bool GroupStateCache::isDirtyListed(const GroupStateNode* node) const {
+  return node->prevDirty != NULL || dirtyHead == node;
+}
+
+size_t GroupStateCache::findSlot(const BulbId& id) const {
+  size_t slot = homeSlot(id);
+
+  while (slots[slot] != NULL && !(slots[slot]->id == id)) {
+    slot = (slot + 1) & slotMask;
+  }
+
+  return slot;
+}
+
+// Backward shift deletion: pull later entries of the probe sequence into the gap
+// so that lookups never need tombstones.
+void GroupStateCache::removeSlot(size_t slot) {
+  size_t next = slot;
+
+  while (true) {
+    next = (next + 1) & slotMask;
+
+    if (slots[next] == NULL) {
+      break;
+    }
+
+    const size_t home = homeSlot(slots[next]->id);
+
+    // Entries whose home is cyclically in (slot, next] are still reachable
+    const bool reachable = slot <= next
+      ? (slot < home && home <= next)
+      : (slot < home || home <= next);
+
+    if (!reachable) {
+      slots[slot] = slots[next];
+      slot = next;
+    }
+  }
+
+  slots[slot] = NULL;
+}
+
+void GroupStateCache::unlink(GroupCacheNode* node) {
+  GroupCacheNode*& head = node->inMain ? mainHead : probationHead;
+  GroupCacheNode*& tail = node->inMain ? mainTail : probationTail;
+
+  if (node->prev != NULL) {
+    node->prev->next = node->next;
+  } else {
+    head = node->next;
+  }
+
+  if (node->next != NULL) {
+    node->next->prev = node->prev;
+  } else {
+    tail = node->prev;
+  }
+
+  if (node->inMain) {
+    mainCount--;
+  }
+}
+
+void GroupStateCache::pushFront(GroupCacheNode* node) {
+  GroupCacheNode*& head = node->inMain ? mainHead : probationHead;
+  GroupCacheNode*& tail = node->inMain ? mainTail : probationTail;
+
+  node->prev = NULL;
+  node->next = head;
+
+  if (head != NULL) {
+    head->prev = node;
+  } else {
+    tail = node;
+  }
+
+  head = node;
+
+  if (node->inMain) {
+    mainCount++;
+  }
+}
+
+GroupCacheNode* GroupStateCache::selectVictim() const {
+  if (mainTail == NULL || (probationTail != NULL && count - mainCount > maxProbationSize)) {
+    return probationTail;
+  }
+
+  return mainTail;
 }
 
-ListNode<GroupCacheNode*>* GroupStateCache::getHead() {
-  return cache.getHead();
+bool GroupStateCache::removeGhost(uint32_t id) {
+  const size_t slot = findGhostSlot(id);
+
+  if (ghostSlots[slot] == 0) {
+    return false;
+  }
+
+  removeGhostSlot(slot);
+  return true;
 }
 
-GroupState* GroupStateCache::getInternal(const BulbId& id) {
-  ListNode<GroupCacheNode*>* cur = cache.getHead();
+void GroupStateCache::addGhost(uint32_t id) {
+  // Forget the oldest, unless it was already removed or has been added again since
+  if (ghostCount == maxGhostSize) {
+    const size_t oldest = findGhostSlot(ghostRing[ghostNext]);
 
-  while (cur != NULL) {
-    if (cur->data->id == id) {
-      GroupState* result = &cur->data->state;
-      cache.spliceToFront(cur);
-      return result;
+    if (ghostSlots[oldest] == ghostNext + 1) {
+      removeGhostSlot(oldest);
     }
-    cur = cur->next;
+  } else {
+    ghostCount++;
+  }
+
+  ghostRing[ghostNext] = id;
+
+  const size_t slot = findGhostSlot(id);
+  if (ghostSlots[slot] != 0) {
+    removeGhostSlot(slot);
   }
+  ghostSlots[findGhostSlot(id)] = ghostNext + 1;
+
+  ghostNext = (ghostNext + 1) % maxGhostSize;
+}
+
+size_t GroupStateCache::findGhostSlot(uint32_t id) const {
+  size_t slot = ghostHomeSlot(id);
+
+  while (ghostSlots[slot] != 0 && ghostRing[ghostSlots[slot] - 1] != id) {
+    slot = (slot + 1) & ghostSlotMask;
+  }
+
+  return slot;
+}
+
+// Backward shift deletion, as in removeSlot
+void GroupStateCache::removeGhostSlot(size_t slot) {
+  size_t next = slot;
+
+  while (true) {
+    next = (next + 1) & ghostSlotMask;
+
+    if (ghostSlots[next] == 0) {
+      break;
+    }
+
+    const size_t home = ghostHomeSlot(ghostRing[ghostSlots[next] - 1]);
+    const bool reachable = slot <= next
+      ? (slot < home && home <= next)
+      : (slot < home || home <= next);
+
+    if (!reachable) {
+      ghostSlots[slot] = ghostSlots[next];
+      slot = next;
+    }
+  }
+
+  ghostSlots[slot] = 0;
+}
+
+size_t GroupStateCache::ghostHomeSlot(uint32_t id) const {
+  return ((id * GROUP_STATE_CACHE_HASH_MULTIPLIER) >> 16) & ghostSlotMask;
+}
 
-  return NULL;
+size_t GroupStateCache::homeSlot(const BulbId& id) const {
+  return ((id.getCompactId() * GROUP_STATE_CACHE_HASH_MULTIPLIER) >> 16) & slotMask;
 }
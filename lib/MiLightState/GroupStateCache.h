@@ -1,34 +1,151 @@
 #include <GroupState.h>
-#include <LinkedList.h>
 
 #ifndef _GROUP_STATE_CACHE_H
 #define _GROUP_STATE_CACHE_H
 
-struct GroupCacheNode {
-  GroupCacheNode() {}
-  GroupCacheNode(const BulbId& id, const GroupState& state)
-    : id(id), state(state) { }
+// Share of the cache for states seen once since they were last evicted
+#ifndef MILIGHT_STATE_CACHE_PROBATION_PERCENT
+#define MILIGHT_STATE_CACHE_PROBATION_PERCENT 25
+#endif
+
+// Number of evicted IDs remembered, as a share of the cache size
+#ifndef MILIGHT_STATE_CACHE_GHOST_PERCENT
+#define MILIGHT_STATE_CACHE_GHOST_PERCENT 50
+#endif
+
+// A state that can wait on the dirty list.  Resident states are just this.
+struct GroupStateNode {
+  GroupStateNode()
+    : prevDirty(NULL), nextDirty(NULL), dirtySince(0) { }
+  GroupStateNode(const BulbId& id, const GroupState& state)
+    : id(id), state(state), prevDirty(NULL), nextDirty(NULL), dirtySince(0) { }
 
   BulbId id;
   GroupState state;
+
+  // Intrusive list of states waiting to be persisted, oldest first
+  GroupStateNode* prevDirty;
+  GroupStateNode* nextDirty;
+  unsigned long dirtySince;
 };
 
+struct GroupCacheNode : public GroupStateNode {
+  GroupCacheNode()
+    : prev(NULL), next(NULL), inMain(false) { }
+  GroupCacheNode(const BulbId& id, const GroupState& state)
+    : GroupStateNode(id, state), prev(NULL), next(NULL), inMain(false) { }
+
+  // Intrusive list for the queue this node is in, most recently added first
+  GroupCacheNode* prev;
+  GroupCacheNode* next;
+  bool inMain;
+};
+
+/**
+ * Cache of group states with 2Q replacement, so that a burst of one-off IDs (e.g.,
+ * from sniffing other remotes) can't push out bulbs that are controlled often.
+ *
+ *   * New states enter a FIFO probation queue, and hits there don't move them.
+ *   * When a state leaves probation, its ID is remembered in a ghost queue.
+ *   * A state whose ID is in the ghost queue has been wanted twice recently, so it
+ *     enters the main queue, which is LRU.
+ *
+ * Probation is evicted from while it holds more than its share of the cache, the
+ * main queue otherwise.
+ *
+ * Nodes are indexed by an open-addressing hash table (linear probing, at most 2/3
+ * full) and threaded on intrusive lists.  Ghost IDs are kept in a ring with a
+ * table of the same kind, so lookup, promotion and eviction are all constant time.  Nodes are allocated as the cache fills.  Once full, the victim
+ * node is reused for each new entry.
+ */
 class GroupStateCache {
 public:
   GroupStateCache(const size_t maxSize);
   ~GroupStateCache();
 
+  // Owns its nodes and hash table
+  GroupStateCache(const GroupStateCache&) = delete;
+  GroupStateCache& operator=(const GroupStateCache&) = delete;
+
   GroupState* get(const BulbId& id);
   GroupState* set(const BulbId& id, const GroupState& state);
-  BulbId getLru();
   bool isFull() const;
-  ListNode<GroupCacheNode*>* getHead();
+  size_t size() const;
+  size_t capacity() const;
+
+  // Node that will be reused by the next set() of an uncached ID, or NULL if the
+  // cache isn't full
+  GroupCacheNode* getVictim();
+
+  // Number of states in the main queue
+  size_t mainSize() const;
+
+  // Adds id's node to the dirty list, unless it's already there or id isn't cached.
+  // now is recorded as the time it became dirty.
+  void markDirty(const BulbId& id, unsigned long now);
+
+  // Same, for a node that may not belong to this cache.  It must outlive the
+  // dirty list entry.
+  void markDirty(GroupStateNode* node, unsigned long now);
+
+  // Removes node from the dirty list.  Also done when a node is evicted.
+  void clearDirty(GroupStateNode* node);
+
+  // Node that has been dirty longest.  Follow GroupStateNode::nextDirty to walk
+  // the dirty list.
+  GroupStateNode* getOldestDirty();
+  size_t getDirtyCount() const;
 
 private:
-  LinkedList<GroupCacheNode*> cache;
   const size_t maxSize;
+  const size_t maxProbationSize;
+  const size_t maxGhostSize;
+  size_t count;
+  size_t mainCount;
+
+  GroupCacheNode* mainHead;
+  GroupCacheNode* mainTail;
+  GroupCacheNode* probationHead;
+  GroupCacheNode* probationTail;
+
+  // Compact IDs recently evicted from probation, in a ring so the oldest is
+  // overwritten.  Entries removed from the ghost queue stay in the ring, but are
+  // no longer indexed.
+  uint32_t* ghostRing;
+  size_t ghostNext;
+  size_t ghostCount;
+
+  // Open-addressing index into ghostRing, holding ring position + 1 (0 is empty)
+  uint16_t* ghostSlots;
+  size_t ghostSlotMask;
+
+  GroupCacheNode** slots;
+  size_t slotMask;
+
+  GroupStateNode* dirtyHead;
+  GroupStateNode* dirtyTail;
+  size_t dirtyCount;
+
+  // Returns the slot holding id, or the empty slot where it would be inserted
+  size_t findSlot(const BulbId& id) const;
+  void removeSlot(size_t slot);
+
+  void unlink(GroupCacheNode* node);
+  void pushFront(GroupCacheNode* node);
+  GroupCacheNode* selectVictim() const;
+
+  // Removes id from the ghost queue.  Returns true if it was there.
+  bool removeGhost(uint32_t id);
+  void addGhost(uint32_t id);
+
+  // Returns the ghost slot indexing id, or the empty slot where it would go
+  size_t findGhostSlot(uint32_t id) const;
+  void removeGhostSlot(size_t slot);
+  size_t ghostHomeSlot(uint32_t id) const;
+  bool isDirtyListed(const GroupStateNode* node) const;
 
-  GroupState* getInternal(const BulbId& id);
+  // Slot that id's compact ID hashes to
+  size_t homeSlot(const BulbId& id) const;
 };
 
 #endif
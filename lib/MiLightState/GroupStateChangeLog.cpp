@@ -0,0 +1,39 @@
+#include <GroupStateChangeLog.h>
+
+BulbId GroupStateChangeLog::Change::getBulbId() const {
+  return BulbId(deviceId, groupId, static_cast<MiLightRemoteType>(deviceType));
+}
+
+GroupStateChangeLog::GroupStateChangeLog()
+  : sequence(0)
+{ }
+
+uint32_t GroupStateChangeLog::record(const BulbId& id, uint32_t fields) {
+  Change& change = changes[++sequence % MILIGHT_STATE_CHANGE_LOG_SIZE];
+
+  change.sequence = sequence;
+  change.deviceId = id.deviceId;
+  change.groupId = id.groupId;
+  change.deviceType = id.deviceType;
+  change.fields = fields;
+
+  return sequence;
+}
+
+uint32_t GroupStateChangeLog::getSequence() const {
+  return sequence;
+}
+
+bool GroupStateChangeLog::since(uint32_t after, ChangeHandler handler) const {
+  const uint32_t oldest = sequence > MILIGHT_STATE_CHANGE_LOG_SIZE ? sequence - MILIGHT_STATE_CHANGE_LOG_SIZE + 1 : 1;
+
+  if (after > sequence || after + 1 < oldest) {
+    return false;
+  }
+
+  for (uint32_t i = after + 1; i <= sequence; i++) {
+    handler(changes[i % MILIGHT_STATE_CHANGE_LOG_SIZE]);
+  }
+
+  return true;
+}
@@ -0,0 +1,54 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <functional>
+#include <BulbId.h>
+
+#ifndef _GROUP_STATE_CHANGE_LOG_H
+#define _GROUP_STATE_CHANGE_LOG_H
+
+// Each entry is 12 bytes
+#ifndef MILIGHT_STATE_CHANGE_LOG_SIZE
+#define MILIGHT_STATE_CHANGE_LOG_SIZE 64
+#endif
+
+/**
+ * Ring of the most recent group state changes, so that clients can ask what
+ * changed since they last looked rather than polling every group.
+ *
+ * Every change gets the next sequence number, starting from 1 at boot.  A change
+ * to group 0 applies to every group of the device.
+ */
+class GroupStateChangeLog {
+public:
+  struct Change {
+    uint32_t sequence;
+    uint16_t deviceId;
+    uint8_t groupId;
+    uint8_t deviceType;
+    // Indexed by GroupStateField, as returned by GroupState::getChangedFields
+    uint32_t fields;
+
+    BulbId getBulbId() const;
+  };
+
+  typedef std::function<void(const Change& change)> ChangeHandler;
+
+  GroupStateChangeLog();
+
+  // Returns the change's sequence number
+  uint32_t record(const BulbId& id, uint32_t fields);
+
+  // Sequence number of the latest change, or 0 if there hasn't been one
+  uint32_t getSequence() const;
+
+  // Passes every change after sequence to handler, oldest first.  Returns false
+  // without calling handler if some of those changes have been dropped, or if
+  // sequence is from the future (e.g., from before a restart).
+  bool since(uint32_t sequence, ChangeHandler handler) const;
+
+private:
+  Change changes[MILIGHT_STATE_CHANGE_LOG_SIZE];
+  uint32_t sequence;
+};
+
+#endif
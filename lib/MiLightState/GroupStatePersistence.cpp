@@ -1,40 +1,403 @@
 #include <GroupStatePersistence.h>
-#include <FS.h>
+#include <algorithm>
 
-static const char FILE_PREFIX[] = "group_states/";
+static const char JOURNAL_FILE[] = "group_states.log";
+static const char COMPACTION_FILE[] = "group_states.tmp";
+
+// Where a journal with an unrecognized header is moved, so it isn't lost
+static const char UNRECOGNIZED_JOURNAL_FILE[] = "group_states.bad";
+
+// States used to be stored in one file per bulb, named with this prefix followed
+// by the bulb's compact ID in hex.  The contents are the same as a record's state.
+static const char LEGACY_FILE_PREFIX[] = "group_states/";
+
+// Identifies the journal format.  Last byte is the version.
+static const uint8_t JOURNAL_HEADER[] = { 'G', 'S', 'J', 1 };
+static const size_t JOURNAL_HEADER_SIZE = sizeof(JOURNAL_HEADER);
+
+static const uint8_t DELETED_RECORD_FLAG = 0x80;
+
+// Records copied per read/write during compaction
+#define COMPACTION_BATCH_SIZE 16
+
+GroupStatePersistence::GroupStatePersistence()
+  : loaded(false),
+    numRecords(0),
+    journalSize(0)
+{ }
+
+GroupStatePersistence::~GroupStatePersistence() {
+  if (appendFile) {
+    appendFile.close();
+  }
+}
 
 void GroupStatePersistence::get(const BulbId &id, GroupState& state) {
-  char path[30];
-  memset(path, 0, 30);
-  buildFilename(id, path);
+  load();
+
+  auto entry = find(id.getCompactId());
+  if (entry == index.end()) {
+    return;
+  }
+
+  // Reads from a separate handle may not see buffered appends
+  commit();
 
-  if (SPIFFS.exists(path)) {
-    File f = SPIFFS.open(path, "r");
+  File f = SPIFFS.open(JOURNAL_FILE, "r");
+  if (f && f.seek(entry->offset + 4, SeekSet)) {
     state.load(f);
-    f.close();
   }
+  f.close();
 }
 
 void GroupStatePersistence::set(const BulbId &id, const GroupState& state) {
-  char path[30];
-  memset(path, 0, 30);
-  buildFilename(id, path);
+  appendRecord(id, &state);
+}
+
+void GroupStatePersistence::clear(const BulbId &id) {
+  load();
+
+  // Nothing to delete, and no point in recording that
+  if (find(id.getCompactId()) != index.end()) {
+    appendRecord(id, NULL);
+  }
+}
+
+void GroupStatePersistence::commit() {
+  if (appendFile) {
+    appendFile.close();
+  }
+
+  if (numRecords > index.size() + MILIGHT_STATE_JOURNAL_SLACK) {
+    compact();
+  }
+}
+
+size_t GroupStatePersistence::size() {
+  load();
+  return index.size();
+}
+
+size_t GroupStatePersistence::journalRecords() {
+  load();
+  return numRecords;
+}
+
+size_t GroupStatePersistence::loadRecent(size_t maxStates, StateHandler handler) {
+  load();
+  commit();
+
+  std::vector<uint32_t> offsets;
+  offsets.reserve(index.size());
+
+  for (const IndexEntry& entry : index) {
+    offsets.push_back(entry.offset);
+  }
+
+  // Records are appended as states change, so the latest ones are at the end
+  std::sort(offsets.begin(), offsets.end());
+  if (offsets.size() > maxStates) {
+    offsets.erase(offsets.begin(), offsets.end() - maxStates);
+  }
+
+  File f = SPIFFS.open(JOURNAL_FILE, "r");
+  if (! f) {
+    return 0;
+  }
+
+  uint8_t header[4];
+  size_t position = JOURNAL_HEADER_SIZE;
+  size_t numLoaded = 0;
+  f.seek(position, SeekSet);
+
+  for (uint32_t offset : offsets) {
+    // After a compaction the live records are contiguous, so this rarely seeks
+    if (offset != position && ! f.seek(offset, SeekSet)) {
+      break;
+    }
+
+    if (f.readBytes(header, sizeof(header)) != sizeof(header)) {
+      break;
+    }
+
+    BulbId id(header[0] | (header[1] << 8), header[2], static_cast<MiLightRemoteType>(header[3]));
+    GroupState state;
+    state.load(f);
+
+    handler(id, state);
+    numLoaded++;
+    position = offset + RECORD_SIZE;
+  }
 
-  File f = SPIFFS.open(path, "w");
-  state.dump(f);
   f.close();
+  return numLoaded;
 }
 
-void GroupStatePersistence::clear(const BulbId &id) {
-  char path[30];
-  buildFilename(id, path);
+void GroupStatePersistence::appendRecord(const BulbId& id, const GroupState* state) {
+  load();
+
+  if (! appendFile) {
+    appendFile = SPIFFS.open(JOURNAL_FILE, "a");
+
+    if (! appendFile) {
+      Serial.println(F("ERROR: could not open state journal for writing"));
+      return;
+    }
+  }
+
+  const uint8_t header[] = {
+    static_cast<uint8_t>(id.deviceId & 0xFF),
+    static_cast<uint8_t>(id.deviceId >> 8),
+    id.groupId,
+    static_cast<uint8_t>(id.deviceType | (state == NULL ? DELETED_RECORD_FLAG : 0))
+  };
+  appendFile.write(header, sizeof(header));
+
+  if (state != NULL) {
+    state->dump(appendFile);
+  } else {
+    const uint8_t empty[RECORD_SIZE - sizeof(header)] = { 0 };
+    appendFile.write(empty, sizeof(empty));
+  }
+
+  const IndexEntry entry = { id.getCompactId(), static_cast<uint32_t>(journalSize) };
+  auto it = find(entry.id);
+
+  if (state == NULL) {
+    if (it != index.end()) {
+      index.erase(it);
+    }
+  } else if (it != index.end()) {
+    it->offset = entry.offset;
+  } else {
+    index.insert(std::upper_bound(index.begin(), index.end(), entry), entry);
+  }
+
+  journalSize += RECORD_SIZE;
+  numRecords++;
+}
+
+std::vector<GroupStatePersistence::IndexEntry>::iterator GroupStatePersistence::find(uint32_t id) {
+  const IndexEntry key = { id, 0 };
+  auto it = std::lower_bound(index.begin(), index.end(), key);
+
+  if (it != index.end() && it->id == id) {
+    return it;
+  }
+
+  return index.end();
+}
+
+// Builds the index by replaying the journal.  Creates the journal if it doesn't exist.
+void GroupStatePersistence::load() {
+  if (loaded) {
+    return;
+  }
+  loaded = true;
 
-  if (SPIFFS.exists(path)) {
-    SPIFFS.remove(path);
+  // A compaction was interrupted after the old journal was removed.  The new one
+  // is complete.
+  if (! SPIFFS.exists(JOURNAL_FILE) && SPIFFS.exists(COMPACTION_FILE)) {
+    SPIFFS.rename(COMPACTION_FILE, JOURNAL_FILE);
+  }
+  // ...or before, in which case the new one may be incomplete.
+  if (SPIFFS.exists(COMPACTION_FILE)) {
+    SPIFFS.remove(COMPACTION_FILE);
+  }
+
+  File f = SPIFFS.open(JOURNAL_FILE, "r");
+  uint8_t header[JOURNAL_HEADER_SIZE];
+
+  if (! f || f.readBytes(header, JOURNAL_HEADER_SIZE) != JOURNAL_HEADER_SIZE || memcmp(header, JOURNAL_HEADER, JOURNAL_HEADER_SIZE) != 0) {
+    const bool exists = f;
+
+    if (exists) {
+      Serial.println(F("WARNING: unrecognized state journal, moving it aside and starting a new one"));
+      f.close();
+
+      SPIFFS.remove(UNRECOGNIZED_JOURNAL_FILE);
+      SPIFFS.rename(JOURNAL_FILE, UNRECOGNIZED_JOURNAL_FILE);
+    }
+
+    f = SPIFFS.open(JOURNAL_FILE, "w");
+    f.write(JOURNAL_HEADER, JOURNAL_HEADER_SIZE);
+    f.close();
+
+    journalSize = JOURNAL_HEADER_SIZE;
+
+    if (! exists) {
+      importLegacyFiles();
+    }
+    return;
+  }
+
+  uint8_t record[RECORD_SIZE];
+  journalSize = JOURNAL_HEADER_SIZE;
+
+  while (f.readBytes(record, RECORD_SIZE) == RECORD_SIZE) {
+    const IndexEntry entry = {
+      BulbId(record[0] | (record[1] << 8), record[2], static_cast<MiLightRemoteType>(record[3] & ~DELETED_RECORD_FLAG)).getCompactId(),
+      static_cast<uint32_t>(journalSize)
+    };
+    auto it = std::lower_bound(index.begin(), index.end(), entry);
+    const bool exists = it != index.end() && it->id == entry.id;
+
+    if (record[3] & DELETED_RECORD_FLAG) {
+      if (exists) {
+        index.erase(it);
+      }
+    } else if (exists) {
+      it->offset = entry.offset;
+    } else {
+      index.insert(it, entry);
+    }
+
+    journalSize += RECORD_SIZE;
+    numRecords++;
+  }
+
+  const bool truncated = f.size() != journalSize;
+  f.close();
+
+  // A partially written record was left at the end.  Appending after it would
+  // misalign everything that follows, so rewrite the journal without it.
+  if (truncated) {
+    Serial.println(F("WARNING: state journal has a partial record, compacting"));
+
+    if (! compact()) {
+      Serial.println(F("ERROR: could not remove partial record from state journal"));
+    }
   }
 }
 
-char* GroupStatePersistence::buildFilename(const BulbId &id, char *buffer) {
-  uint32_t compactId = id.getCompactId();
-  return buffer + sprintf(buffer, "%s%x", FILE_PREFIX, compactId);
+bool GroupStatePersistence::compact() {
+  if (appendFile) {
+    appendFile.close();
+  }
+
+  File source = SPIFFS.open(JOURNAL_FILE, "r");
+  File dest = SPIFFS.open(COMPACTION_FILE, "w");
+
+  if (! source || ! dest) {
+    Serial.println(F("ERROR: could not open files to compact state journal"));
+    return false;
+  }
+
+  bool ok = dest.write(JOURNAL_HEADER, JOURNAL_HEADER_SIZE) == JOURNAL_HEADER_SIZE;
+
+  uint8_t buffer[COMPACTION_BATCH_SIZE * RECORD_SIZE];
+  size_t buffered = 0;
+  uint32_t offset = JOURNAL_HEADER_SIZE;
+
+  // Copied in journal order rather than index order, so that loadRecent still
+  // finds the most recently written states at the end
+  std::vector<IndexEntry*> byOffset;
+  byOffset.reserve(index.size());
+
+  for (IndexEntry& entry : index) {
+    byOffset.push_back(&entry);
+  }
+
+  std::sort(byOffset.begin(), byOffset.end(), [](const IndexEntry* a, const IndexEntry* b) {
+    return a->offset < b->offset;
+  });
+
+  for (size_t i = 0; ok && i < byOffset.size(); i++) {
+    ok = source.seek(byOffset[i]->offset, SeekSet)
+      && source.readBytes(buffer + buffered * RECORD_SIZE, RECORD_SIZE) == RECORD_SIZE;
+    offset += RECORD_SIZE;
+
+    if (ok && ++buffered == COMPACTION_BATCH_SIZE) {
+      ok = dest.write(buffer, sizeof(buffer)) == sizeof(buffer);
+      buffered = 0;
+    }
+  }
+
+  if (ok) {
+    ok = dest.write(buffer, buffered * RECORD_SIZE) == buffered * RECORD_SIZE
+      && dest.size() == offset;
+  }
+
+  source.close();
+  dest.close();
+
+  // The old journal and index are still good, so keep using them
+  if (! ok) {
+    Serial.println(F("ERROR: could not write compacted state journal"));
+    SPIFFS.remove(COMPACTION_FILE);
+    return false;
+  }
+
+  SPIFFS.remove(JOURNAL_FILE);
+  SPIFFS.rename(COMPACTION_FILE, JOURNAL_FILE);
+
+  offset = JOURNAL_HEADER_SIZE;
+  for (IndexEntry* entry : byOffset) {
+    entry->offset = offset;
+    offset += RECORD_SIZE;
+  }
+
+  numRecords = index.size();
+  journalSize = offset;
+  return true;
+}
+
+// Copies states from the old one-file-per-bulb layout into the journal, then
+// removes the old files
+void GroupStatePersistence::importLegacyFiles() {
+  std::vector<String> legacyFiles;
+  Dir dir = SPIFFS.openDir(LEGACY_FILE_PREFIX);
+
+  while (dir.next()) {
+    legacyFiles.push_back(dir.fileName());
+  }
+
+  if (legacyFiles.empty()) {
+    return;
+  }
+
+  const size_t prefixLength = strlen(LEGACY_FILE_PREFIX);
+  size_t numImported = 0;
+
+  for (const String& file : legacyFiles) {
+    const char* name = file.c_str();
+    // Paths may or may not be listed with a leading slash
+    const char* prefix = strstr(name, LEGACY_FILE_PREFIX);
+    char* end;
+    const uint32_t compactId = prefix != NULL ? strtoul(prefix + prefixLength, &end, 16) : 0;
+
+    if (prefix == NULL || end == prefix + prefixLength || *end != 0) {
+      continue;
+    }
+
+    File f = SPIFFS.open(file, "r");
+
+    if (f && f.size() == GroupState::DATA_LONGS * sizeof(uint32_t)) {
+      const BulbId id(
+        compactId >> 16,
+        compactId & 0xFF,
+        static_cast<MiLightRemoteType>((compactId >> 8) & 0xFF)
+      );
+      GroupState state;
+
+      state.load(f);
+      appendRecord(id, &state);
+      numImported++;
+    }
+
+    f.close();
+  }
+
+  // Make the imported states durable before their files go away
+  if (appendFile) {
+    appendFile.close();
+  }
+
+  if (numImported != 0) {
+    Serial.printf_P(PSTR("Imported %u group states from per-bulb files\n"), numImported);
+  }
+
+  for (const String& file : legacyFiles) {
+    SPIFFS.remove(file);
+  }
 }
@@ -1,18 +1,81 @@
 #include <GroupState.h>
+#include <FS.h>
+#include <vector>
+#include <functional>
 
 #ifndef _GROUP_STATE_PERSISTENCE_H
 #define _GROUP_STATE_PERSISTENCE_H
 
+// Compact once the journal holds this many more records than there are live states
+#ifndef MILIGHT_STATE_JOURNAL_SLACK
+#define MILIGHT_STATE_JOURNAL_SLACK 64
+#endif
+
+/**
+ * Persists group states in a single append-only journal rather than one SPIFFS
+ * file per bulb.  Each record is a fixed 12 bytes:
+ *
+ *   device ID (2) | group ID (1) | device type (1) | raw StateData (8)
+ *
+ * The high bit of the device type marks a deletion.  The latest record for a bulb
+ * wins.  An in-RAM index maps each bulb to the offset of its latest record, built
+ * by scanning the journal on first use.
+ *
+ * Writes between calls to commit() go to a single open file handle, so flushing
+ * many states is one sequential append.  When superseded records outnumber live
+ * ones by MILIGHT_STATE_JOURNAL_SLACK, commit() compacts the journal by rewriting
+ * the live records to a new file.
+ */
 class GroupStatePersistence {
 public:
+  typedef std::function<void(const BulbId& id, const GroupState& state)> StateHandler;
+
+  static const size_t RECORD_SIZE = 4 + GroupState::DATA_LONGS * sizeof(uint32_t);
+
+  GroupStatePersistence();
+  ~GroupStatePersistence();
+
   void get(const BulbId& id, GroupState& state);
-  void set(const BulbId& id, const GroupState& state);
 
+  // Appends to the journal.  Changes are durable after commit().
+  void set(const BulbId& id, const GroupState& state);
   void clear(const BulbId& id);
 
+  // Close the pending append and compact if needed
+  void commit();
+
+  // Number of bulbs with persisted state
+  size_t size();
+
+  // Number of records in the journal, including superseded ones
+  size_t journalRecords();
+
+  // Reads the maxStates most recently written states in one pass over the journal,
+  // least recent first.  Returns the number of states passed to handler.
+  size_t loadRecent(size_t maxStates, StateHandler handler);
+
 private:
+  struct IndexEntry {
+    uint32_t id;
+    uint32_t offset;
+
+    bool operator<(const IndexEntry& other) const { return id < other.id; }
+  };
+
+  // Sorted by id
+  std::vector<IndexEntry> index;
+  bool loaded;
+  size_t numRecords;
+  size_t journalSize;
+  File appendFile;
 
-  static char* buildFilename(const BulbId& id, char* buffer);
+  void load();
+  // Returns false, leaving the journal as it was, if the compacted copy couldn't
+  // be written
+  bool compact();
+  void appendRecord(const BulbId& id, const GroupState* state);
+  std::vector<IndexEntry>::iterator find(uint32_t id);
+  void importLegacyFiles();
 };
 
 #endif
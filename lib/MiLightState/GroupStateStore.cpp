@@ -1,13 +1,38 @@
 #include <GroupStateStore.h>
 #include <MiLightRemoteConfig.h>
 
-GroupStateStore::GroupStateStore(const size_t maxSize, const size_t flushRate)
-  : cache(GroupStateCache(maxSize)),
+GroupStateStore::GroupStateStore(const size_t maxSize, const size_t flushRate, const std::vector<uint16_t>& residentDeviceIds)
+  : cache(maxSize),
+    resident(residentDeviceIds),
     flushRate(flushRate),
-    lastFlush(0)
+    lastFlush(0),
+    uncommittedWrites(false),
+    preloadedCount(0),
+    preloadMicros(0)
 { }
 
 GroupState* GroupStateStore::get(const BulbId& id) {
+  GroupState* state = getStored(id);
+
+  if (state != NULL && id.groupId != 0) {
+    applyBroadcasts(id, state);
+  }
+
+  return state;
+}
+
+GroupState* GroupStateStore::getStored(const BulbId& id) {
+  GroupStateNode* residentNode = resident.find(id);
+
+  if (residentNode != NULL) {
+    if (! resident.isLoaded(residentNode)) {
+      persistence.get(id, residentNode->state);
+      resident.setLoaded(residentNode);
+    }
+
+    return &residentNode->state;
+  }
+
   GroupState* state = cache.get(id);
 
   if (state == NULL) {
@@ -16,10 +41,10 @@ GroupState* GroupStateStore::get(const BulbId& id) {
       "Couldn't fetch state for 0x%04X / %d / %s in the cache, getting it from persistence\n",
       id.deviceId,
       id.groupId,
-      MiLightRemoteConfig::fromType(id.deviceType)->name.c_str()
+      MiLightRemoteConfig::fromType(id.deviceType)->name
     );
 #endif
-    trackEviction();
+    writeBackVictim();
     GroupState loadedState = GroupState::defaultState(id.deviceType);
 
     const MiLightRemoteConfig* remoteConfig = MiLightRemoteConfig::fromType(id.deviceType);
@@ -29,6 +54,8 @@ GroupState* GroupStateStore::get(const BulbId& id) {
     }
 
     persistence.get(id, loadedState);
+    // Nothing to write back if it's evicted unchanged
+    loadedState.clearDirty();
     state = cache.set(id, loadedState);
   }
 
@@ -48,32 +75,42 @@ GroupState* GroupStateStore::get(const uint16_t deviceId, const uint8_t groupId,
 //   respond to group 0.  When state for an individual (i.e., != 0) group is changed, the state for
 //   group 0 becomes out of sync and should be cleared.
 //
-// * If id.groupId == 0, will iterate across all groups and individually save each group (recursively)
+// * If id.groupId == 0, the change is recorded in the broadcast log rather than saved to each group.
+//   Groups pick it up when they're next read (see get()), so this doesn't touch any other states.
 //
 GroupState* GroupStateStore::set(const BulbId &id, const GroupState& state) {
   BulbId otherId(id);
   GroupState* storedState = get(id);
+  const GroupState previousState(*storedState);
+
   storedState->patch(state);
+  trackDirty(id, storedState);
+  recordChange(id, previousState, *storedState);
 
   if (id.groupId == 0) {
     const MiLightRemoteConfig* remote = MiLightRemoteConfig::fromType(id.deviceType);
 
 #ifdef STATE_DEBUG
-    Serial.printf_P(PSTR("Fanning out group 0 state for device ID 0x%04X (%d groups in total)\n"), id.deviceId, remote->numGroups);
+    Serial.printf_P(PSTR("Recording group 0 state for device ID 0x%04X (%d groups in total)\n"), id.deviceId, remote->numGroups);
     state.debugState("group 0 state = ");
 #endif
 
-    for (size_t i = 1; i <= remote->numGroups; i++) {
-      otherId.groupId = i;
-
-      GroupState* individualState = get(otherId);
-      individualState->patch(state);
+    if (remote->numGroups > 0) {
+      recordBroadcast(id, state, remote->numGroups);
     }
   } else {
     otherId.groupId = 0;
     GroupState* group0State = get(otherId);
+    const GroupState previousGroup0State(*group0State);
+
+    if (group0State->clearNonMatchingFields(state)) {
+      recordChange(otherId, previousGroup0State, *group0State);
+    }
+    trackDirty(otherId, group0State);
 
-    group0State->clearNonMatchingFields(state);
+    // Fetching group 0 can evict id's node (probation hits don't move it), in
+    // which case it was written back and storedState now belongs to group 0
+    storedState = getStored(id);
   }
 
   return storedState;
@@ -88,51 +125,156 @@ void GroupStateStore::clear(const BulbId& bulbId) {
   GroupState* state = get(bulbId);
 
   if (state != NULL) {
+    const GroupState previousState(*state);
+
     state->initFields();
     state->patch(GroupState::defaultState(bulbId.deviceType));
+    trackDirty(bulbId, state);
+    recordChange(bulbId, previousState, *state);
   }
 }
 
-void GroupStateStore::trackEviction() {
-  if (cache.isFull()) {
-    evictedIds.add(cache.getLru());
+size_t GroupStateStore::preload() {
+  const unsigned long start = micros();
+
+  // Reads every state so that all resident ones are loaded.  The cache ends up
+  // with the most recent of the rest.
+  size_t residentCount = 0;
+
+  persistence.loadRecent(
+    SIZE_MAX,
+    [this, &residentCount](const BulbId& id, const GroupState& state) {
+      GroupStateNode* residentNode = resident.find(id);
+
+      if (residentNode != NULL) {
+        residentNode->state = state;
+        residentCount++;
+      // Same as get(): states for unknown remote types aren't cached
+      } else if (MiLightRemoteConfig::fromType(id.deviceType) != NULL) {
+        cache.set(id, state);
+      }
+    }
+  );
+
+  // Resident states without a record keep their defaults
+  resident.setAllLoaded();
+  preloadedCount = residentCount + cache.size();
+
+  preloadMicros = micros() - start;
+  return preloadedCount;
+}
+
+void GroupStateStore::writeBackVictim() {
+  GroupCacheNode* victim = cache.getVictim();
+
+  if (victim == NULL) {
+    return;
+  }
 
 #ifdef STATE_DEBUG
-    BulbId bulbId = evictedIds.getLast();
-    printf(
-      "Evicting from cache: 0x%04X / %d / %s\n",
-      bulbId.deviceId,
-      bulbId.groupId,
-      MiLightRemoteConfig::fromType(bulbId.deviceType)->name.c_str()
-    );
+  BulbId bulbId = victim->id;
+  printf(
+    "Evicting from cache: 0x%04X / %d / %s\n",
+    bulbId.deviceId,
+    bulbId.groupId,
+    MiLightRemoteConfig::fromType(bulbId.deviceType)->name
+  );
 #endif
+
+  // Clean states match what's persisted, so can just be dropped
+  if (victim->state.isDirty()) {
+    persistence.set(victim->id, victim->state);
+    victim->state.clearDirty();
+    uncommittedWrites = true;
+  }
+}
+
+void GroupStateStore::recordBroadcast(const BulbId& id, const GroupState& state, size_t numGroups) {
+  GroupBroadcastLog::Device* device = broadcasts.find(id.deviceId, id.deviceType);
+
+  // The least recently used device is about to be dropped from the log
+  if (device == NULL && broadcasts.isFull()) {
+    GroupBroadcastLog::Device& lru = broadcasts[broadcasts.size() - 1];
+    BulbId lruId(lru.deviceId, 0, static_cast<MiLightRemoteType>(lru.type));
+
+    for (size_t i = 1; i <= lru.numGroups; i++) {
+      lruId.groupId = i;
+      get(lruId);
+    }
+  }
+
+  // Only reorders the log after the lookups above are done with it
+  device = broadcasts.promote(id.deviceId, id.deviceType, numGroups);
+
+  // Groups that haven't seen the oldest logged change have to before it's overwritten
+  BulbId groupId(id);
+  for (size_t i = 1; i <= device->numGroups; i++) {
+    if (device->isFull(i)) {
+      groupId.groupId = i;
+      get(groupId);
+    }
+  }
+
+  device->record(state);
+}
+
+void GroupStateStore::applyBroadcasts(const BulbId& id, GroupState* state) {
+  GroupBroadcastLog::Device* device = broadcasts.find(id.deviceId, id.deviceType);
+
+  if (device != NULL && device->pending(id.groupId) > 0) {
+    device->catchUp(id.groupId, *state);
+    trackDirty(id, state);
+  }
+}
+
+void GroupStateStore::applyAllBroadcasts() {
+  for (size_t i = 0; i < broadcasts.size(); i++) {
+    GroupBroadcastLog::Device& device = broadcasts[i];
+    BulbId id(device.deviceId, 0, static_cast<MiLightRemoteType>(device.type));
+
+    for (size_t j = 1; j <= device.numGroups; j++) {
+      if (device.pending(j) > 0) {
+        id.groupId = j;
+        get(id);
+      }
+    }
   }
 }
 
 bool GroupStateStore::flush() {
-  ListNode<GroupCacheNode*>* curr = cache.getHead();
+  applyAllBroadcasts();
+
+  GroupStateNode* curr = cache.getOldestDirty();
   bool anythingFlushed = false;
 
-  while (curr != NULL && curr->data->state.isDirty() && !anythingFlushed) {
-    persistence.set(curr->data->id, curr->data->state);
-    curr->data->state.clearDirty();
+  while (curr != NULL) {
+    GroupStateNode* next = curr->nextDirty;
+
+    if (curr->state.isDirty()) {
+      persistence.set(curr->id, curr->state);
+      curr->state.clearDirty();
+      anythingFlushed = true;
 
 #ifdef STATE_DEBUG
-    BulbId bulbId = curr->data->id;
-    printf(
-      "Flushing dirty state for 0x%04X / %d / %s\n",
-      bulbId.deviceId,
-      bulbId.groupId,
-      MiLightRemoteConfig::fromType(bulbId.deviceType)->name.c_str()
-    );
+      BulbId bulbId = curr->id;
+      printf(
+        "Flushing dirty state for 0x%04X / %d / %s\n",
+        bulbId.deviceId,
+        bulbId.groupId,
+        MiLightRemoteConfig::fromType(bulbId.deviceType)->name
+      );
 #endif
+    }
 
-    curr = curr->next;
-    anythingFlushed = true;
+    cache.clearDirty(curr);
+    curr = next;
   }
 
-  while (evictedIds.size() > 0 && !anythingFlushed) {
-    persistence.clear(evictedIds.shift());
+  // Everything above, and any states written back on eviction, go out as one append
+  if (anythingFlushed || uncommittedWrites) {
+    persistence.commit();
+    lastFlush = millis();
+    uncommittedWrites = false;
     anythingFlushed = true;
   }
 
@@ -140,11 +282,59 @@ bool GroupStateStore::flush() {
 }
 
 void GroupStateStore::limitedFlush() {
-  unsigned long now = millis();
+  const unsigned long now = millis();
+
+  if (cache.getDirtyCount() > 0) {
+    if (getOldestDirtyAge() >= flushRate) {
+      flush();
+    }
+  } else if (uncommittedWrites && (now - lastFlush) >= flushRate) {
+    flush();
+  }
+}
+
+size_t GroupStateStore::getDirtyCount() const {
+  return cache.getDirtyCount();
+}
+
+unsigned long GroupStateStore::getOldestDirtyAge() {
+  GroupStateNode* oldest = cache.getOldestDirty();
+  return oldest == NULL ? 0 : millis() - oldest->dirtySince;
+}
+
+size_t GroupStateStore::getPreloadedCount() const {
+  return preloadedCount;
+}
+
+unsigned long GroupStateStore::getPreloadMicros() const {
+  return preloadMicros;
+}
+
+void GroupStateStore::forEachState(GroupStatePersistence::StateHandler handler) {
+  flush();
+  persistence.loadRecent(SIZE_MAX, handler);
+}
+
+const GroupStateChangeLog& GroupStateStore::getChanges() const {
+  return changes;
+}
+
+void GroupStateStore::recordChange(const BulbId& id, const GroupState& previous, const GroupState& current) {
+  const uint32_t fields = current.getChangedFields(previous);
+
+  if (fields != 0) {
+    changes.record(id, fields);
+  }
+}
+
+void GroupStateStore::trackDirty(const BulbId& id, const GroupState* state) {
+  if (state->isDirty()) {
+    GroupStateNode* residentNode = resident.find(id);
 
-  if ((lastFlush + flushRate) < now) {
-    if (flush()) {
-      lastFlush = now;
+    if (residentNode != NULL) {
+      cache.markDirty(residentNode, millis());
+    } else {
+      cache.markDirty(id, millis());
     }
   }
 }
@@ -1,13 +1,20 @@
 #include <GroupState.h>
 #include <GroupStateCache.h>
 #include <GroupStatePersistence.h>
+#include <GroupBroadcastLog.h>
+#include <ResidentGroupStates.h>
+#include <GroupStateChangeLog.h>
 
 #ifndef _GROUP_STATE_STORE_H
 #define _GROUP_STATE_STORE_H
 
 class GroupStateStore {
 public:
-  GroupStateStore(const size_t maxSize, const size_t flushRate);
+  /*
+   * States for residentDeviceIds (the gateway device IDs) are kept outside of the
+   * cache and never evicted.  maxSize only bounds the cache for other IDs.
+   */
+  GroupStateStore(const size_t maxSize, const size_t flushRate, const std::vector<uint16_t>& residentDeviceIds = {});
 
   /*
    * Returns the state for the given BulbId.  If accessing state for a valid device
@@ -22,6 +29,9 @@ public:
   /*
    * Sets the state for the given BulbId.  State will be marked as dirty and
    * flushed to persistent storage.
+   *
+   * Group 0 changes are applied to the individual groups lazily: each group picks
+   * them up the next time it's read, or at the next flush.
    */
   GroupState* set(const BulbId& id, const GroupState& state);
   GroupState* set(const uint16_t deviceId, const uint8_t groupId, const MiLightRemoteType deviceType, const GroupState& state);
@@ -29,25 +39,74 @@ public:
   void clear(const BulbId& id);
 
   /*
-   * Flushes all states to persistent storage.  Returns true iff anything was
-   * flushed.
+   * Loads all resident states, and fills the cache with the most recently
+   * persisted others, so that the first command to each bulb after boot doesn't
+   * have to wait on flash.  Returns the number of states loaded.
+   */
+  size_t preload();
+
+  /*
+   * Applies pending group 0 changes, then flushes all dirty states to persistent
+   * storage in one batch.  Returns true
+   * iff anything was flushed.
    */
   bool flush();
 
   /*
-   * Flushes at most one dirty state to persistent storage.  Rate limit
-   * specified by Settings.
+   * Flushes once the oldest dirty state has waited flushRate milliseconds (the
+   * state_flush_interval setting), so that bursts of changes share one write.
    */
   void limitedFlush();
 
+  // Number of states changed since they were last flushed
+  size_t getDirtyCount() const;
+
+  // Milliseconds since the oldest unflushed change, or 0 if nothing is dirty
+  unsigned long getOldestDirtyAge();
+
+  /*
+   * Passes every persisted state to handler, one at a time.  Flushes first, so
+   * that this includes all changes.
+   */
+  void forEachState(GroupStatePersistence::StateHandler handler);
+
+  // Recent changes made through set() and clear()
+  const GroupStateChangeLog& getChanges() const;
+
+  // Results of the last preload()
+  size_t getPreloadedCount() const;
+  unsigned long getPreloadMicros() const;
+
 private:
   GroupStateCache cache;
+  ResidentGroupStates resident;
   GroupStatePersistence persistence;
-  LinkedList<BulbId> evictedIds;
+  GroupBroadcastLog broadcasts;
+  GroupStateChangeLog changes;
   const size_t flushRate;
   unsigned long lastFlush;
 
-  void trackEviction();
+  // States written back on eviction since the last commit
+  bool uncommittedWrites;
+  size_t preloadedCount;
+  unsigned long preloadMicros;
+
+  // Persists the state the cache is about to evict, if it has unflushed changes
+  void writeBackVictim();
+
+  // Cache lookup, falling back to persistence.  Doesn't apply group 0 changes.
+  GroupState* getStored(const BulbId& id);
+
+  void recordBroadcast(const BulbId& id, const GroupState& state, size_t numGroups);
+  void applyBroadcasts(const BulbId& id, GroupState* state);
+
+  // Brings every group of every device in the broadcast log up to date
+  void applyAllBroadcasts();
+
+  void recordChange(const BulbId& id, const GroupState& previous, const GroupState& current);
+
+  // Adds id to the dirty set if the change made to state needs to be persisted
+  void trackDirty(const BulbId& id, const GroupState* state);
 };
 
 #endif
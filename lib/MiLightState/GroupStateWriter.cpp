@@ -0,0 +1,319 @@
+#include <GroupStateWriter.h>
+#include <Size.h>
+
+#define KEY_FRAGMENT(name) { "\"" name "\":", sizeof(name) + 2 }
+
+struct KeyFragment {
+  const char* str;
+  uint8_t length;
+};
+
+// "name": for each GroupStateField, indexed by its value
+static const KeyFragment KEY_FRAGMENTS[] = {
+  KEY_FRAGMENT("unknown"),
+  KEY_FRAGMENT("state"),
+  KEY_FRAGMENT("status"),
+  KEY_FRAGMENT("brightness"),
+  KEY_FRAGMENT("level"),
+  KEY_FRAGMENT("hue"),
+  KEY_FRAGMENT("saturation"),
+  KEY_FRAGMENT("color"),
+  KEY_FRAGMENT("mode"),
+  KEY_FRAGMENT("kelvin"),
+  KEY_FRAGMENT("color_temp"),
+  KEY_FRAGMENT("bulb_mode"),
+  KEY_FRAGMENT("computed_color"),
+  KEY_FRAGMENT("effect"),
+  KEY_FRAGMENT("device_id"),
+  KEY_FRAGMENT("group_id"),
+  KEY_FRAGMENT("device_type"),
+  KEY_FRAGMENT("oh_color"),
+  KEY_FRAGMENT("hex_color")
+};
+
+GroupStateWriter::GroupStateWriter(char* buffer, size_t size, Format format)
+  : format(format),
+    out(NULL),
+    buffer(buffer),
+    // Leave room for the null terminator
+    capacity(size > 0 ? size - 1 : 0),
+    length(0),
+    flushed(0),
+    overflow(size == 0),
+    needsComma(false),
+    depth(0)
+{ }
+
+GroupStateWriter::GroupStateWriter(Print& out)
+  : format(JSON),
+    out(&out),
+    buffer(chunk),
+    capacity(sizeof(chunk)),
+    length(0),
+    flushed(0),
+    overflow(false),
+    needsComma(false),
+    depth(0)
+{ }
+
+void GroupStateWriter::beginObject() {
+  if (format == MSGPACK) {
+    beginContainer(false);
+    return;
+  }
+
+  if (needsComma) {
+    write(',');
+  }
+  write('{');
+  needsComma = false;
+}
+
+void GroupStateWriter::endObject() {
+  if (format == MSGPACK) {
+    endContainer();
+    return;
+  }
+
+  write('}');
+  needsComma = true;
+}
+
+void GroupStateWriter::beginArray() {
+  if (format == MSGPACK) {
+    beginContainer(true);
+    return;
+  }
+
+  if (needsComma) {
+    write(',');
+  }
+  write('[');
+  needsComma = false;
+}
+
+void GroupStateWriter::endArray() {
+  if (format == MSGPACK) {
+    endContainer();
+    return;
+  }
+
+  write(']');
+  needsComma = true;
+}
+
+void GroupStateWriter::writeKey(GroupStateField field) {
+  const size_t index = static_cast<size_t>(field);
+
+  if (index >= size(KEY_FRAGMENTS)) {
+    writeKey(GroupStateFieldHelpers::getFieldName(field));
+    return;
+  }
+
+  if (format == MSGPACK) {
+    // The name is what's between the quotes, and is always short enough for a fixstr
+    const uint8_t nameLength = KEY_FRAGMENTS[index].length - 3;
+
+    countMapMember();
+    write(static_cast<char>(0xA0 | nameLength));
+    write(KEY_FRAGMENTS[index].str + 1, nameLength);
+    return;
+  }
+
+  if (needsComma) {
+    write(',');
+  }
+  write(KEY_FRAGMENTS[index].str, KEY_FRAGMENTS[index].length);
+  needsComma = false;
+}
+
+void GroupStateWriter::writeKey(const char* key) {
+  if (format == MSGPACK) {
+    countMapMember();
+    writeMsgPackString(key);
+    return;
+  }
+
+  if (needsComma) {
+    write(',');
+  }
+  write('"');
+  write(key, strlen(key));
+  write("\":", 2);
+  needsComma = false;
+}
+
+void GroupStateWriter::writeValue(uint32_t value) {
+  if (format == MSGPACK) {
+    countArrayElement();
+
+    if (value < 0x80) {
+      write(static_cast<char>(value));
+    } else if (value <= 0xFF) {
+      const char encoded[] = { '\xCC', static_cast<char>(value) };
+      write(encoded, sizeof(encoded));
+    } else if (value <= 0xFFFF) {
+      const char encoded[] = { '\xCD', static_cast<char>(value >> 8), static_cast<char>(value & 0xFF) };
+      write(encoded, sizeof(encoded));
+    } else {
+      const char encoded[] = {
+        '\xCE',
+        static_cast<char>(value >> 24),
+        static_cast<char>((value >> 16) & 0xFF),
+        static_cast<char>((value >> 8) & 0xFF),
+        static_cast<char>(value & 0xFF)
+      };
+      write(encoded, sizeof(encoded));
+    }
+    return;
+  }
+
+  // Only array elements need it.  In objects, the key has already reset it.
+  if (needsComma) {
+    write(',');
+  }
+
+  char digits[10];
+  size_t i = sizeof(digits);
+
+  do {
+    digits[--i] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+
+  write(digits + i, sizeof(digits) - i);
+  needsComma = true;
+}
+
+void GroupStateWriter::writeValue(const char* value) {
+  if (format == MSGPACK) {
+    countArrayElement();
+    writeMsgPackString(value);
+    return;
+  }
+
+  if (needsComma) {
+    write(',');
+  }
+  write('"');
+  write(value, strlen(value));
+  write('"');
+  needsComma = true;
+}
+
+size_t GroupStateWriter::finish() {
+  if (out != NULL) {
+    flush();
+    return flushed;
+  }
+
+  if (overflow) {
+    if (capacity > 0) {
+      buffer[0] = 0;
+    }
+    return 0;
+  }
+
+  buffer[length] = 0;
+  return length;
+}
+
+void GroupStateWriter::write(char c) {
+  write(&c, 1);
+}
+
+void GroupStateWriter::write(const char* str, size_t size) {
+  if (length + size > capacity) {
+    if (out == NULL) {
+      overflow = true;
+      return;
+    }
+
+    flush();
+
+    if (size > capacity) {
+      flushed += out->write(reinterpret_cast<const uint8_t*>(str), size);
+      return;
+    }
+  }
+
+  memcpy(buffer + length, str, size);
+  length += size;
+}
+
+void GroupStateWriter::flush() {
+  if (length > 0) {
+    flushed += out->write(reinterpret_cast<const uint8_t*>(buffer), length);
+    length = 0;
+  }
+}
+
+void GroupStateWriter::writeMsgPackString(const char* str) {
+  const size_t size = strlen(str);
+
+  if (size < 32) {
+    write(static_cast<char>(0xA0 | size));
+  } else if (size <= 0xFF) {
+    const char header[] = { '\xD9', static_cast<char>(size) };
+    write(header, sizeof(header));
+  } else {
+    const char header[] = { '\xDA', static_cast<char>(size >> 8), static_cast<char>(size & 0xFF) };
+    write(header, sizeof(header));
+  }
+
+  write(str, size);
+}
+
+void GroupStateWriter::beginContainer(bool isArray) {
+  countArrayElement();
+
+  if (depth == MILIGHT_STATE_WRITER_MAX_DEPTH) {
+    overflow = true;
+    return;
+  }
+
+  containerStarts[depth] = length;
+  containerSizes[depth] = 0;
+  containerIsArray[depth] = isArray;
+  ++depth;
+
+  // Room for a map16 or array16 header
+  write(isArray ? "\xDC\x00\x00" : "\xDE\x00\x00", 3);
+}
+
+void GroupStateWriter::endContainer() {
+  if (depth == 0) {
+    return;
+  }
+
+  --depth;
+
+  if (overflow) {
+    return;
+  }
+
+  const size_t start = containerStarts[depth];
+  const uint16_t size = containerSizes[depth];
+
+  if (size < 16) {
+    // Use a fixmap or fixarray header instead, like serializeMsgPack does
+    buffer[start] = (containerIsArray[depth] ? 0x90 : 0x80) | size;
+    memmove(buffer + start + 1, buffer + start + 3, length - start - 3);
+    length -= 2;
+  } else {
+    buffer[start + 1] = size >> 8;
+    buffer[start + 2] = size & 0xFF;
+  }
+}
+
+void GroupStateWriter::countArrayElement() {
+  if (depth > 0 && containerIsArray[depth - 1]) {
+    ++containerSizes[depth - 1];
+  }
+}
+
+void GroupStateWriter::countMapMember() {
+  if (depth > 0 && ! containerIsArray[depth - 1]) {
+    ++containerSizes[depth - 1];
+  }
+}
@@ -0,0 +1,88 @@
+#include <Arduino.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <GroupStateField.h>
+
+#ifndef _GROUP_STATE_WRITER_H
+#define _GROUP_STATE_WRITER_H
+
+// Enough for every field, with room to spare
+#ifndef MILIGHT_STATE_JSON_SIZE
+#define MILIGHT_STATE_JSON_SIZE 320
+#endif
+
+// Bytes collected before each write to a Print
+#ifndef MILIGHT_STATE_WRITER_CHUNK_SIZE
+#define MILIGHT_STATE_WRITER_CHUNK_SIZE 64
+#endif
+
+// Deepest nesting of objects supported when writing MessagePack
+#ifndef MILIGHT_STATE_WRITER_MAX_DEPTH
+#define MILIGHT_STATE_WRITER_MAX_DEPTH 4
+#endif
+
+/**
+ * Writes compact JSON directly to a buffer or Print without building a
+ * JsonDocument first.  Used to serialize group states (see
+ * GroupState::writeState), which only need unsigned numbers and strings that
+ * never need escaping.
+ *
+ * Output matches what serializeJson produces for the same members.  When
+ * writing into a buffer, MessagePack can be written instead, matching what
+ * serializeMsgPack produces.
+ */
+class GroupStateWriter {
+public:
+  enum Format {
+    JSON,
+    MSGPACK
+  };
+
+  // Writes into buffer, which is null terminated by finish()
+  GroupStateWriter(char* buffer, size_t size, Format format = JSON);
+  // Writes to out a chunk at a time
+  GroupStateWriter(Print& out);
+
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+
+  void writeKey(GroupStateField field);
+  void writeKey(const char* key);
+
+  void writeValue(uint32_t value);
+  void writeValue(const char* value);
+
+  // Returns the number of bytes written, or 0 if they didn't fit in the buffer
+  size_t finish();
+
+private:
+  Format format;
+  Print* out;
+  char chunk[MILIGHT_STATE_WRITER_CHUNK_SIZE];
+  char* buffer;
+  size_t capacity;
+  size_t length;
+  size_t flushed;
+  bool overflow;
+  bool needsComma;
+
+  // MessagePack maps and arrays start with their size, which isn't known
+  // until the end, so the header is filled in then
+  size_t containerStarts[MILIGHT_STATE_WRITER_MAX_DEPTH];
+  uint16_t containerSizes[MILIGHT_STATE_WRITER_MAX_DEPTH];
+  bool containerIsArray[MILIGHT_STATE_WRITER_MAX_DEPTH];
+  uint8_t depth;
+
+  void write(char c);
+  void write(const char* str, size_t size);
+  void flush();
+  void writeMsgPackString(const char* str);
+  void beginContainer(bool isArray);
+  void endContainer();
+  void countArrayElement();
+  void countMapMember();
+};
+
+#endif
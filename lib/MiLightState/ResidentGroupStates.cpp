@@ -0,0 +1,99 @@
+#include <ResidentGroupStates.h>
+#include <MiLightRemoteConfig.h>
+#include <string.h>
+
+ResidentGroupStates::ResidentGroupStates(const std::vector<uint16_t>& ids)
+  : numDevices(0)
+{
+  for (uint16_t id : ids) {
+    if (numDevices == MILIGHT_MAX_RESIDENT_DEVICES) {
+      Serial.println(F("WARNING: too many gateway device IDs to keep all of their states resident"));
+      break;
+    }
+
+    // Ignore duplicates
+    bool seen = false;
+    for (size_t i = 0; i < numDevices; i++) {
+      seen |= deviceIds[i] == id;
+    }
+
+    if (! seen) {
+      deviceIds[numDevices++] = id;
+    }
+  }
+
+  // Remote configs are only read when there's something to store, since the
+  // store may be constructed during static initialization
+  size_t nodesPerDevice = 0;
+
+  if (numDevices > 0) {
+    typeOffsets.reserve(MiLightRemoteConfig::NUM_REMOTES + 1);
+
+    for (size_t type = 0; type < MiLightRemoteConfig::NUM_REMOTES; type++) {
+      typeOffsets.push_back(nodesPerDevice);
+      nodesPerDevice += MiLightRemoteConfig::ALL_REMOTES[type]->numGroups + 1;
+    }
+    typeOffsets.push_back(nodesPerDevice);
+  }
+
+  numNodes = numDevices * nodesPerDevice;
+  nodes = new GroupStateNode[numNodes];
+  loaded = new uint8_t[(numNodes + 7) / 8]();
+
+  GroupStateNode* node = nodes;
+
+  for (size_t i = 0; i < numDevices; i++) {
+    for (size_t type = 0; type < MiLightRemoteConfig::NUM_REMOTES; type++) {
+      const MiLightRemoteType remoteType = static_cast<MiLightRemoteType>(type);
+      const size_t numGroups = typeOffsets[type + 1] - typeOffsets[type];
+
+      for (size_t group = 0; group < numGroups; group++, node++) {
+        node->id = BulbId(deviceIds[i], group, remoteType);
+        node->state = GroupState::defaultState(remoteType);
+      }
+    }
+  }
+}
+
+ResidentGroupStates::~ResidentGroupStates() {
+  delete[] nodes;
+  delete[] loaded;
+}
+
+GroupStateNode* ResidentGroupStates::find(const BulbId& id) {
+  if (numDevices == 0 || id.deviceType >= MiLightRemoteConfig::NUM_REMOTES) {
+    return NULL;
+  }
+
+  const size_t offset = typeOffsets[id.deviceType] + id.groupId;
+
+  if (offset >= typeOffsets[id.deviceType + 1]) {
+    return NULL;
+  }
+
+  for (size_t i = 0; i < numDevices; i++) {
+    if (deviceIds[i] == id.deviceId) {
+      return &nodes[i * typeOffsets.back() + offset];
+    }
+  }
+
+  return NULL;
+}
+
+bool ResidentGroupStates::isLoaded(const GroupStateNode* node) const {
+  const size_t index = node - nodes;
+  return loaded[index / 8] & (1 << (index % 8));
+}
+
+void ResidentGroupStates::setLoaded(const GroupStateNode* node) {
+  const size_t index = node - nodes;
+  loaded[index / 8] |= 1 << (index % 8);
+}
+
+void ResidentGroupStates::setAllLoaded() {
+  memset(loaded, 0xFF, (numNodes + 7) / 8);
+}
+
+size_t ResidentGroupStates::size() const {
+  return numNodes;
+}
@@ -0,0 +1,53 @@
+#include <GroupStateCache.h>
+#include <GroupBroadcastLog.h>
+#include <vector>
+
+#ifndef _RESIDENT_GROUP_STATES_H
+#define _RESIDENT_GROUP_STATES_H
+
+// Device IDs beyond this many fall back to the LRU cache.  Each one costs a node
+// for group 0 and every numbered group of every remote type.
+#ifndef MILIGHT_MAX_RESIDENT_DEVICES
+#define MILIGHT_MAX_RESIDENT_DEVICES 4
+#endif
+
+/**
+ * States for the gateway device IDs, which are the only ones the hub sends
+ * commands for.  Every (device ID, remote type, group) gets a node up front, found
+ * by index arithmetic rather than hashing, and is never evicted.  Remote types
+ * only get nodes for the groups they have.
+ *
+ * Nodes start with the default state for their remote type.  Whether each has
+ * been loaded from persistence yet is tracked separately.
+ */
+class ResidentGroupStates {
+public:
+  ResidentGroupStates(const std::vector<uint16_t>& deviceIds);
+  ~ResidentGroupStates();
+
+  ResidentGroupStates(const ResidentGroupStates&) = delete;
+  ResidentGroupStates& operator=(const ResidentGroupStates&) = delete;
+
+  // NULL if id isn't resident
+  GroupStateNode* find(const BulbId& id);
+
+  bool isLoaded(const GroupStateNode* node) const;
+  void setLoaded(const GroupStateNode* node);
+
+  // Marks every node as loaded, for once persistence has been read in full
+  void setAllLoaded();
+
+  size_t size() const;
+
+private:
+  uint16_t deviceIds[MILIGHT_MAX_RESIDENT_DEVICES];
+  size_t numDevices;
+  // Index of each remote type's group 0 within a device's nodes, followed by
+  // the number of nodes per device
+  std::vector<uint8_t> typeOffsets;
+  size_t numNodes;
+  GroupStateNode* nodes;
+  uint8_t* loaded;
+};
+
+#endif
@@ -82,6 +82,8 @@ void Settings::patch(JsonObject parsedSettings) {
   this->setIfPresent(parsedSettings, "mqtt_topic_pattern", mqttTopicPattern);
   this->setIfPresent(parsedSettings, "mqtt_update_topic_pattern", mqttUpdateTopicPattern);
   this->setIfPresent(parsedSettings, "mqtt_state_topic_pattern", mqttStateTopicPattern);
+  this->setIfPresent(parsedSettings, "mqtt_device_state_topic_pattern", mqttDeviceStateTopicPattern);
+  this->setIfPresent(parsedSettings, "mqtt_sync_topic_prefix", mqttSyncTopicPrefix);
   this->setIfPresent(parsedSettings, "mqtt_client_status_topic", mqttClientStatusTopic);
   this->setIfPresent(parsedSettings, "simple_mqtt_client_status", simpleMqttClientStatus);
   this->setIfPresent(parsedSettings, "discovery_port", discoveryPort);
@@ -89,10 +91,12 @@ void Settings::patch(JsonObject parsedSettings) {
   this->setIfPresent(parsedSettings, "state_flush_interval", stateFlushInterval);
   this->setIfPresent(parsedSettings, "mqtt_state_rate_limit", mqttStateRateLimit);
   this->setIfPresent(parsedSettings, "mqtt_debounce_delay", mqttDebounceDelay);
+  this->setIfPresent(parsedSettings, "mqtt_state_max_staleness", mqttStateMaxStaleness);
   this->setIfPresent(parsedSettings, "mqtt_retain", mqttRetain);
   this->setIfPresent(parsedSettings, "packet_repeat_throttle_threshold", packetRepeatThrottleThreshold);
   this->setIfPresent(parsedSettings, "packet_repeat_throttle_sensitivity", packetRepeatThrottleSensitivity);
   this->setIfPresent(parsedSettings, "packet_repeat_minimum", packetRepeatMinimum);
+  this->setIfPresent(parsedSettings, "fresh_sequence_packet_repeats", freshSequencePacketRepeats);
   this->setIfPresent(parsedSettings, "enable_automatic_mode_switching", enableAutomaticModeSwitching);
   this->setIfPresent(parsedSettings, "led_mode_packet_count", ledModePacketCount);
   this->setIfPresent(parsedSettings, "hostname", hostname);
@@ -107,6 +111,10 @@ void Settings::patch(JsonObject parsedSettings) {
     this->wifiMode = wifiModeFromString(parsedSettings["wifi_mode"]);
   }
 
+  if (parsedSettings.containsKey("mqtt_payload_format")) {
+    this->mqttPayloadFormat = mqttPayloadFormatFromString(parsedSettings["mqtt_payload_format"]);
+  }
+
   if (parsedSettings.containsKey("rf24_channels")) {
     JsonArray arr = parsedSettings["rf24_channels"];
     rf24Channels = JsonHelpers::jsonArrToVector<RF24Channel, String>(arr, RF24ChannelHelpers::valueFromName);
@@ -267,6 +275,8 @@ void Settings::serialize(Print& stream, const bool prettyPrint) {
   root["mqtt_topic_pattern"] = this->mqttTopicPattern;
   root["mqtt_update_topic_pattern"] = this->mqttUpdateTopicPattern;
   root["mqtt_state_topic_pattern"] = this->mqttStateTopicPattern;
+  root["mqtt_device_state_topic_pattern"] = this->mqttDeviceStateTopicPattern;
+  root["mqtt_sync_topic_prefix"] = this->mqttSyncTopicPrefix;
   root["mqtt_client_status_topic"] = this->mqttClientStatusTopic;
   root["simple_mqtt_client_status"] = this->simpleMqttClientStatus;
   root["discovery_port"] = this->discoveryPort;
@@ -274,10 +284,13 @@ void Settings::serialize(Print& stream, const bool prettyPrint) {
   root["state_flush_interval"] = this->stateFlushInterval;
   root["mqtt_state_rate_limit"] = this->mqttStateRateLimit;
   root["mqtt_debounce_delay"] = this->mqttDebounceDelay;
+  root["mqtt_state_max_staleness"] = this->mqttStateMaxStaleness;
+  root["mqtt_payload_format"] = mqttPayloadFormatToString(this->mqttPayloadFormat);
   root["mqtt_retain"] = this->mqttRetain;
   root["packet_repeat_throttle_sensitivity"] = this->packetRepeatThrottleSensitivity;
   root["packet_repeat_throttle_threshold"] = this->packetRepeatThrottleThreshold;
   root["packet_repeat_minimum"] = this->packetRepeatMinimum;
+  root["fresh_sequence_packet_repeats"] = this->freshSequencePacketRepeats;
   root["enable_automatic_mode_switching"] = this->enableAutomaticModeSwitching;
   root["led_mode_wifi_config"] = LEDStatus::LEDModeToString(this->ledModeWifiConfig);
   root["led_mode_wifi_failed"] = LEDStatus::LEDModeToString(this->ledModeWifiFailed);
@@ -380,4 +393,22 @@ String Settings::wifiModeToString(WifiMode mode) {
     default:
       return "n";
   }
-}
\ No newline at end of file
+}
+
+MqttPayloadFormat Settings::mqttPayloadFormatFromString(const String& format) {
+  if (format.equalsIgnoreCase("msgpack")) {
+    return MqttPayloadFormat::MSGPACK;
+  } else {
+    return MqttPayloadFormat::JSON;
+  }
+}
+
+String Settings::mqttPayloadFormatToString(MqttPayloadFormat format) {
+  switch (format) {
+    case MqttPayloadFormat::MSGPACK:
+      return "msgpack";
+    case MqttPayloadFormat::JSON:
+    default:
+      return "json";
+  }
+}
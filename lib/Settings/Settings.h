@@ -41,10 +41,6 @@
 #define MILIGHT_MAX_STATE_ITEMS 100
 #endif
 
-#ifndef MILIGHT_MAX_STALE_MQTT_GROUPS
-#define MILIGHT_MAX_STALE_MQTT_GROUPS 10
-#endif
-
 #define SETTINGS_FILE  "/config.json"
 #define SETTINGS_TERMINATOR '\0'
 
@@ -67,6 +63,10 @@ enum class WifiMode {
   B, G, N
 };
 
+enum class MqttPayloadFormat {
+  JSON, MSGPACK
+};
+
 static const std::vector<GroupStateField> DEFAULT_GROUP_STATE_FIELDS({
   GroupStateField::STATE,
   GroupStateField::BRIGHTNESS,
@@ -103,10 +103,13 @@ public:
     stateFlushInterval(10000),
     mqttStateRateLimit(500),
     mqttDebounceDelay(500),
+    mqttStateMaxStaleness(10000),
+    mqttPayloadFormat(MqttPayloadFormat::JSON),
     mqttRetain(true),
     packetRepeatThrottleThreshold(200),
     packetRepeatThrottleSensitivity(0),
     packetRepeatMinimum(3),
+    freshSequencePacketRepeats(0),
     enableAutomaticModeSwitching(false),
     ledModeWifiConfig(LEDStatus::LEDMode::FastToggle),
     ledModeWifiFailed(LEDStatus::LEDMode::On),
@@ -166,15 +169,20 @@ public:
   String mqttTopicPattern;
   String mqttUpdateTopicPattern;
   String mqttStateTopicPattern;
+  String mqttDeviceStateTopicPattern;
+  String mqttSyncTopicPrefix;
   String mqttClientStatusTopic;
   bool simpleMqttClientStatus;
   size_t stateFlushInterval;
   size_t mqttStateRateLimit;
   size_t mqttDebounceDelay;
+  size_t mqttStateMaxStaleness;
+  MqttPayloadFormat mqttPayloadFormat;
   bool mqttRetain;
   size_t packetRepeatThrottleThreshold;
   size_t packetRepeatThrottleSensitivity;
   size_t packetRepeatMinimum;
+  size_t freshSequencePacketRepeats;
   bool enableAutomaticModeSwitching;
   LEDStatus::LEDMode ledModeWifiConfig;
   LEDStatus::LEDMode ledModeWifiFailed;
@@ -206,6 +214,8 @@ protected:
 
   static WifiMode wifiModeFromString(const String& mode);
   static String wifiModeToString(WifiMode mode);
+  static MqttPayloadFormat mqttPayloadFormatFromString(const String& format);
+  static String mqttPayloadFormatToString(MqttPayloadFormat format);
 
   template <typename T>
   void setIfPresent(JsonObject obj, const char* key, T& var) {
@@ -10,31 +10,35 @@ static const char* REMOTE_NAME_FUT091  = "fut091";
 static const char* REMOTE_NAME_FUT020  = "fut020";
 
 const MiLightRemoteType MiLightRemoteTypeHelpers::remoteTypeFromString(const String& type) {
-  if (type.equalsIgnoreCase(REMOTE_NAME_RGBW) || type.equalsIgnoreCase("fut096")) {
+  return remoteTypeFromString(type.c_str());
+}
+
+const MiLightRemoteType MiLightRemoteTypeHelpers::remoteTypeFromString(const char* type) {
+  if (0 == strcasecmp(type, REMOTE_NAME_RGBW) || 0 == strcasecmp(type, "fut096")) {
     return REMOTE_TYPE_RGBW;
   }
 
-  if (type.equalsIgnoreCase(REMOTE_NAME_CCT) || type.equalsIgnoreCase("fut007")) {
+  if (0 == strcasecmp(type, REMOTE_NAME_CCT) || 0 == strcasecmp(type, "fut007")) {
     return REMOTE_TYPE_CCT;
   }
 
-  if (type.equalsIgnoreCase(REMOTE_NAME_RGB_CCT) || type.equalsIgnoreCase("fut092")) {
+  if (0 == strcasecmp(type, REMOTE_NAME_RGB_CCT) || 0 == strcasecmp(type, "fut092")) {
     return REMOTE_TYPE_RGB_CCT;
   }
 
-  if (type.equalsIgnoreCase(REMOTE_NAME_FUT089)) {
+  if (0 == strcasecmp(type, REMOTE_NAME_FUT089)) {
     return REMOTE_TYPE_FUT089;
   }
 
-  if (type.equalsIgnoreCase(REMOTE_NAME_RGB) || type.equalsIgnoreCase("fut098")) {
+  if (0 == strcasecmp(type, REMOTE_NAME_RGB) || 0 == strcasecmp(type, "fut098")) {
     return REMOTE_TYPE_RGB;
   }
 
-  if (type.equalsIgnoreCase("v2_cct") || type.equalsIgnoreCase(REMOTE_NAME_FUT091)) {
+  if (0 == strcasecmp(type, "v2_cct") || 0 == strcasecmp(type, REMOTE_NAME_FUT091)) {
     return REMOTE_TYPE_FUT091;
   }
 
-  if (type.equalsIgnoreCase(REMOTE_NAME_FUT020)) {
+  if (0 == strcasecmp(type, REMOTE_NAME_FUT020)) {
     return REMOTE_TYPE_FUT020;
   }
 
@@ -45,6 +49,10 @@ const MiLightRemoteType MiLightRemoteTypeHelpers::remoteTypeFromString(const Str
 }
 
 const String MiLightRemoteTypeHelpers::remoteTypeToString(const MiLightRemoteType type) {
+  return remoteTypeName(type);
+}
+
+const char* MiLightRemoteTypeHelpers::remoteTypeName(const MiLightRemoteType type) {
   switch (type) {
     case REMOTE_TYPE_RGBW:
       return REMOTE_NAME_RGBW;
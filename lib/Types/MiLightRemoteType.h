@@ -16,5 +16,8 @@ enum MiLightRemoteType {
 class MiLightRemoteTypeHelpers {
 public:
   static const MiLightRemoteType remoteTypeFromString(const String& type);
+  static const MiLightRemoteType remoteTypeFromString(const char* type);
   static const String remoteTypeToString(const MiLightRemoteType type);
+  // Same as remoteTypeToString, without allocating a String
+  static const char* remoteTypeName(const MiLightRemoteType type);
 };
\ No newline at end of file
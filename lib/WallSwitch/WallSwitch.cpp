@@ -5,6 +5,7 @@
 #include <MiLightRadioConfig.h>
 #include <Settings.h>
 #include <Units.h>
+#include <MiLightCommands.h>
 #include <OneWire.h>
 #include <DallasTemperature.h>
 #include <ESP8266Wifi.h>
@@ -143,7 +144,9 @@ void WallSwitch::checkButton(int buttonPin, uint8_t id) {
 //handle short clicks
 void WallSwitch::doShortClicks(uint8_t id)
 {
+  BulbId bulbId(settings.gatewayConfigs[0]->deviceId, id + 1, remoteConfig->type);
   milightClient->prepare(remoteConfig, settings.gatewayConfigs[0]->deviceId, id + 1);
+  mqttClient.supersedeDeferredCommand(bulbId);
 
   if (shortClicks[id] == 1)
   {
@@ -155,6 +158,8 @@ void WallSwitch::doShortClicks(uint8_t id)
 
     //no Off command to other espMH's:
     buttonDirty[id] = false;
+    //so enable receiving here, or deferred MQTT commands wait for the next button press
+    mqttClient.enableReceive();
   }
   if (shortClicks[id] == 3)
   {
@@ -173,6 +178,7 @@ void WallSwitch::doLongClicks(uint8_t id)
   BulbId bulbId(settings.gatewayConfigs[0]->deviceId, id + 1, remoteConfig->type);
   milightClient->prepare(remoteConfig, settings.gatewayConfigs[0]->deviceId, id + 1);
   milightClient->setRepeatsOverride(10);
+  mqttClient.supersedeDeferredCommand(bulbId);
 
   //set lamps on before raising brightness and initialize raising state
   if (initLongClick[id])
@@ -231,38 +237,42 @@ void WallSwitch::doLongClicks(uint8_t id)
   milightClient->clearRepeatsOverride();
 }
 
-//Send command update to MQTT mesh_in/milight to update other devices with same bulbId
+//Send command update to MQTT mesh_in/milight to update other devices with same bulbId,
+//or to the hub sync topic when configured
 void WallSwitch::sendMQTTCommand(uint8_t id)
 {
   BulbId bulbId(settings.gatewayConfigs[0]->deviceId, id + 1, remoteConfig->type);
 
-  char buffer[200];
-  StaticJsonDocument<200> json;
-  JsonObject message = json.to<JsonObject>();
-
   GroupState* groupState = stateStore->get(bulbId);
 	if (groupState == NULL) return;
 
-  groupState->applyState(message, bulbId, settings.groupStateFields);
-  json.add("repeats");
-  json["repeats"] = "NO";
-  serializeJson(json, buffer);
+  //versioned, and only resent over RF by hubs whose state differs.  Changes made
+  //while the button was held weren't announced as their packets were sent.
+  if (mqttClient.hasSyncTopic()) {
+    mqttClient.sendSync(bulbId, *groupState);
+    return;
+  }
+
+  char buffer[MILIGHT_STATE_JSON_SIZE];
+  GroupStateWriter writer(buffer, sizeof(buffer));
 
-  String topic = settings.mqttTopicPattern;
-  String hexDeviceId = bulbId.getHexDeviceId();
+  writer.beginObject();
+  groupState->writeState(writer, bulbId, settings.groupStateFields);
+  writer.writeKey("repeats");
+  writer.writeValue("NO");
+  writer.endObject();
 
-  topic.replace(":device_id", hexDeviceId);
-  topic.replace(":hex_device_id", hexDeviceId);
-  topic.replace(":dec_device_id", String(bulbId.deviceId));
-  topic.replace(":device_type", MiLightRemoteTypeHelpers::remoteTypeToString(bulbId.deviceType));
-  topic.replace(":group_id", String(bulbId.groupId));
+  if (writer.finish() == 0) {
+    Serial.println(F("WallSwitch - ERROR: group state is too large to send"));
+    return;
+  }
 
   #ifdef MQTT_DEBUG
-    Serial.printf("WallSwitch - send message to topic: %s : %s\r\n", topic.c_str(), output);
+    Serial.printf("WallSwitch - send message: %s\r\n", buffer);
   #endif
 
   //send command to milight/xxx/xxx/x
-  mqttClient.send(topic.c_str(), buffer, false);
+  mqttClient.sendCommand(*remoteConfig, bulbId.deviceId, bulbId.groupId, buffer);
 }
 
 //handle actions based on LDR state
@@ -308,21 +318,28 @@ void WallSwitch::doDayNight()
     Serial.println(F("LDR triggered night condition, turn lamps on..."));
     nightTime = millis()/1000;
 
-    milightClient->prepare(remoteConfig, settings.gatewayConfigs[0]->deviceId, 1); //zithoek
-    milightClient->updateStatus(ON);
-    milightClient->updateTemperature(100);
-    milightClient->updateBrightness(1);
-
-    milightClient->prepare(remoteConfig, settings.gatewayConfigs[0]->deviceId, 2); //keuken
-    milightClient->enableNightMode();
-
-    milightClient->prepare(remoteConfig, settings.gatewayConfigs[0]->deviceId, 3); //kinderhoek
-    milightClient->enableNightMode();
-
-    milightClient->prepare(remoteConfig, settings.gatewayConfigs[0]->deviceId, 4); //buitenverlichting
-    milightClient->updateStatus(ON);
-    milightClient->updateTemperature(100);
-    milightClient->updateBrightness(50);
+    StaticJsonDocument<100> onDoc;
+    JsonObject on = onDoc.to<JsonObject>();
+    on[GroupStateFieldNames::STATUS] = "ON";
+    on[GroupStateFieldNames::TEMPERATURE] = 100;
+    on[GroupStateFieldNames::LEVEL] = 1;
+
+    StaticJsonDocument<100> outdoorDoc;
+    JsonObject outdoor = outdoorDoc.to<JsonObject>();
+    outdoor[GroupStateFieldNames::STATUS] = "ON";
+    outdoor[GroupStateFieldNames::TEMPERATURE] = 100;
+    outdoor[GroupStateFieldNames::LEVEL] = 50;
+
+    StaticJsonDocument<100> nightDoc;
+    JsonObject night = nightDoc.to<JsonObject>();
+    night[GroupStateFieldNames::COMMAND] = MiLightCommandNames::NIGHT_MODE;
+
+    milightClient->updateGroups(remoteConfig, settings.gatewayConfigs[0]->deviceId, {
+      { 1, on },      //zithoek
+      { 2, night },   //keuken
+      { 3, night },   //kinderhoek
+      { 4, outdoor }  //buitenverlichting
+    });
   }
 
   if (nightTimer > 10800 && isMidNight == false) { //after 3 hours turn lamps on night mode
@@ -383,10 +400,17 @@ void WallSwitch::doLightState() {
 
     isStartUp = false;
 
+    std::vector<uint8_t> groupIds;
     for (size_t i = 1; i <= remoteConfig->numGroups; i++) {
-      milightClient->prepare(remoteConfig, settings.gatewayConfigs[0]->deviceId, i);
-      milightClient->updateTemperature(100);
-      milightClient->updateStatus(OFF);
-    }  
+      groupIds.push_back(i);
+    }
+
+    StaticJsonDocument<100> offDoc;
+    JsonObject off = offDoc.to<JsonObject>();
+    off[GroupStateFieldNames::TEMPERATURE] = 100;
+    off[GroupStateFieldNames::STATUS] = "OFF";
+
+    // Same state for every group, so this ends up as group 0 packets
+    milightClient->updateGroups(remoteConfig, settings.gatewayConfigs[0]->deviceId, groupIds, off);
   }
 }
@@ -0,0 +1,95 @@
+#include <ChunkedJsonWriter.h>
+
+ChunkedJsonWriter::ChunkedJsonWriter(ESP8266WebServer& server)
+  : server(server),
+    length(0),
+    firstElement(true)
+{ }
+
+void ChunkedJsonWriter::begin(const char* contentType) {
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, contentType, "");
+}
+
+void ChunkedJsonWriter::end() {
+  flush();
+  server.sendContent("");
+}
+
+void ChunkedJsonWriter::write(const char* str) {
+  const size_t size = strlen(str);
+
+  if (size > MILIGHT_CHUNK_SIZE) {
+    flush();
+    server.sendContent(str);
+    return;
+  }
+
+  reserve(size);
+
+  memcpy(buffer + length, str, size);
+  length += size;
+}
+
+void ChunkedJsonWriter::write_P(PGM_P str) {
+  const size_t size = strlen_P(str);
+
+  if (size > MILIGHT_CHUNK_SIZE) {
+    flush();
+    server.sendContent_P(str);
+    return;
+  }
+
+  reserve(size);
+
+  memcpy_P(buffer + length, str, size);
+  length += size;
+}
+
+void ChunkedJsonWriter::startArray() {
+  firstElement = true;
+}
+
+void ChunkedJsonWriter::writeElement(const JsonDocument& json) {
+  const size_t size = measureJson(json) + 1;
+  reserve(size);
+
+  if (! firstElement) {
+    buffer[length++] = ',';
+  }
+  firstElement = false;
+
+  if (size > MILIGHT_CHUNK_SIZE) {
+    String serialized;
+    serializeJson(json, serialized);
+
+    flush();
+    server.sendContent(serialized);
+  } else {
+    length += serializeJson(json, buffer + length, MILIGHT_CHUNK_SIZE + 1 - length);
+  }
+}
+
+void ChunkedJsonWriter::writeElement(const char* json) {
+  if (! firstElement) {
+    write(",");
+  }
+  firstElement = false;
+
+  write(json);
+}
+
+// Flushes if there isn't room for size more bytes
+void ChunkedJsonWriter::reserve(size_t size) {
+  if (length + size > MILIGHT_CHUNK_SIZE) {
+    flush();
+  }
+}
+
+void ChunkedJsonWriter::flush() {
+  if (length > 0) {
+    buffer[length] = 0;
+    server.sendContent(buffer);
+    length = 0;
+  }
+}
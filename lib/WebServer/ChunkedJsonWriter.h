@@ -0,0 +1,45 @@
+#include <ESP8266WebServer.h>
+#include <ArduinoJson.h>
+
+#ifndef _CHUNKED_JSON_WRITER_H
+#define _CHUNKED_JSON_WRITER_H
+
+#ifndef MILIGHT_CHUNK_SIZE
+#define MILIGHT_CHUNK_SIZE 512
+#endif
+
+/**
+ * Writes a chunked response in pieces, so that responses can be larger than what
+ * fits in memory at once.  Small writes are collected into chunks of up to
+ * MILIGHT_CHUNK_SIZE bytes.
+ *
+ * Call begin() first and end() when done.
+ */
+class ChunkedJsonWriter {
+public:
+  ChunkedJsonWriter(ESP8266WebServer& server);
+
+  void begin(const char* contentType);
+  void end();
+
+  void write(const char* str);
+  void write_P(PGM_P str);
+
+  // Writes json as the next element of an array, with a separating comma if it
+  // isn't the first.  Call startArray() before the first element.
+  void startArray();
+  void writeElement(const JsonDocument& json);
+  // Same, for JSON that's already been serialized
+  void writeElement(const char* json);
+
+private:
+  ESP8266WebServer& server;
+  char buffer[MILIGHT_CHUNK_SIZE + 1];
+  size_t length;
+  bool firstElement;
+
+  void reserve(size_t size);
+  void flush();
+};
+
+#endif
@@ -39,6 +39,10 @@ void MiLightHttpServer::begin() {
     .buildHandler("/gateway_traffic/:type")
     .on(HTTP_GET, std::bind(&MiLightHttpServer::handleListenGateway, this, _1));
 
+  server
+    .buildHandler("/gateways")
+    .on(HTTP_GET, std::bind(&MiLightHttpServer::handleListGroups, this));
+
   server
     .buildHandler("/gateways/:device_id/:type/:group_id")
     .on(HTTP_PUT, std::bind(&MiLightHttpServer::handleUpdateGroup, this, _1))
@@ -67,6 +71,10 @@ void MiLightHttpServer::begin() {
     .buildHandler("/raw_commands/:type")
     .on(HTTP_ANY, std::bind(&MiLightHttpServer::handleSendRaw, this, _1));
 
+  server
+    .buildHandler("/state_changes")
+    .on(HTTP_GET, std::bind(&MiLightHttpServer::handleGetStateChanges, this));
+
   server
     .buildHandler("/about")
     .on(HTTP_GET, std::bind(&MiLightHttpServer::handleAbout, this, _1));
@@ -164,6 +172,117 @@ void MiLightHttpServer::handleAbout(RequestContext& request) {
   JsonObject queueStats = request.response.json.createNestedObject("queue_stats");
   queueStats[F("length")] = packetSender->queueLength();
   queueStats[F("dropped_packets")] = packetSender->droppedPackets();
+
+  JsonObject stateStats = request.response.json.createNestedObject("state_stats");
+  stateStats[F("dirty_count")] = stateStore->getDirtyCount();
+  stateStats[F("oldest_dirty_age")] = stateStore->getOldestDirtyAge();
+  stateStats[F("preloaded_count")] = stateStore->getPreloadedCount();
+  stateStats[F("preload_time_us")] = stateStore->getPreloadMicros();
+
+  if (mqttClient != NULL) {
+    const MqttOutbox& outbox = mqttClient->getOutbox();
+
+    JsonObject mqttStats = request.response.json.createNestedObject("mqtt_stats");
+    mqttStats[F("connected")] = mqttClient->isConnected();
+    mqttStats[F("queue_length")] = outbox.size();
+    mqttStats[F("queue_bytes")] = outbox.bytes();
+    mqttStats[F("dropped_messages")] = outbox.droppedMessages();
+    mqttStats[F("coalesced_messages")] = outbox.coalescedMessages();
+
+    const DeferredCommandQueue& deferredCommands = mqttClient->getDeferredCommands();
+    mqttStats[F("deferred_commands")] = deferredCommands.deferredCommands();
+    mqttStats[F("merged_deferred_commands")] = deferredCommands.mergedCommands();
+    mqttStats[F("dropped_deferred_commands")] = deferredCommands.droppedCommands();
+  }
+}
+
+// Streamed one change (or state) at a time, since there can be more than fits in
+// a response buffer
+void MiLightHttpServer::handleGetStateChanges() {
+  const GroupStateChangeLog& changes = stateStore->getChanges();
+  const uint32_t since = strtoul(server.arg("since").c_str(), NULL, 10);
+
+  ChunkedJsonWriter writer(server);
+  StaticJsonDocument<300> json;
+  char buffer[40];
+
+  writer.begin(APPLICATION_JSON);
+
+  sprintf_P(buffer, PSTR("{\"sequence\":%lu,\"changes\":["), static_cast<unsigned long>(changes.getSequence()));
+  writer.write(buffer);
+  writer.startArray();
+
+  const bool complete = changes.since(
+    since,
+    [&writer, &json](const GroupStateChangeLog::Change& change) {
+      JsonObject obj = json.to<JsonObject>();
+
+      obj[F("sequence")] = change.sequence;
+      change.getBulbId().serialize(obj);
+
+      JsonArray fields = obj.createNestedArray(F("fields"));
+      for (uint8_t i = 0; i < 32; i++) {
+        if (change.fields & (1UL << i)) {
+          fields.add(GroupStateFieldHelpers::getFieldName(static_cast<GroupStateField>(i)));
+        }
+      }
+
+      writer.writeElement(json);
+    }
+  );
+
+  writer.write("]");
+
+  // Too far behind to catch up from the change log, so send everything
+  if (! complete) {
+    writer.write_P(PSTR(",\"snapshot\":true,\"states\":"));
+    writeStates(writer);
+  }
+
+  writer.write("}");
+  writer.end();
+}
+
+void MiLightHttpServer::handleListGroups() {
+  ChunkedJsonWriter writer(server);
+
+  writer.begin(APPLICATION_JSON);
+  writeStates(writer);
+  writer.end();
+}
+
+// Writes an array of every known state, serializing one at a time into the
+// same small buffer
+void MiLightHttpServer::writeStates(ChunkedJsonWriter& writer) {
+  char buffer[MILIGHT_STATE_JSON_SIZE + 64];
+
+  writer.write("[");
+  writer.startArray();
+
+  stateStore->forEachState(
+    [this, &writer, &buffer](const BulbId& bulbId, const GroupState& state) {
+      GroupStateWriter stateWriter(buffer, sizeof(buffer));
+
+      stateWriter.beginObject();
+      stateWriter.writeKey(GroupStateField::DEVICE_ID);
+      stateWriter.writeValue(bulbId.deviceId);
+      stateWriter.writeKey(GroupStateField::GROUP_ID);
+      stateWriter.writeValue(bulbId.groupId);
+      stateWriter.writeKey(GroupStateField::DEVICE_TYPE);
+      stateWriter.writeValue(MiLightRemoteTypeHelpers::remoteTypeName(bulbId.deviceType));
+      stateWriter.writeKey(GroupStateField::STATE);
+      stateWriter.beginObject();
+      state.writeState(stateWriter, bulbId, settings.groupStateFields);
+      stateWriter.endObject();
+      stateWriter.endObject();
+
+      if (stateWriter.finish() > 0) {
+        writer.writeElement(buffer);
+      }
+    }
+  );
+
+  writer.write("]");
 }
 
 void MiLightHttpServer::handleGetRadioConfigs(RequestContext& request) {
@@ -325,7 +444,7 @@ void MiLightHttpServer::handleListenGateway(RequestContext& request) {
   responseBuffer += sprintf_P(
     responseBuffer,
     PSTR("\n%s packet received (%d bytes):\n"),
-    remoteConfig->name.c_str(),
+    remoteConfig->name,
     remoteConfig->packetFormatter->getPacketLength()
   );
   remoteConfig->packetFormatter->format(packet, responseBuffer);
@@ -496,15 +615,27 @@ void MiLightHttpServer::handleUpdateGroup(RequestContext& request) {
     while (deviceIdItr.hasNext()) {
       const uint16_t deviceId = parseInt<uint16_t>(deviceIdItr.nextToken());
 
+      std::vector<uint8_t> targetGroupIds;
+
       groupIdItr.reset();
       while (groupIdItr.hasNext()) {
         const uint8_t groupId = atoi(groupIdItr.nextToken());
 
-        milightClient->prepare(config, deviceId, groupId);
-        handleRequest(reqObj);
+        targetGroupIds.push_back(groupId);
         foundBulbId = BulbId(deviceId, groupId, config->type);
         groupCount++;
       }
+
+      if (targetGroupIds.size() == 1) {
+        milightClient->prepare(config, deviceId, targetGroupIds[0]);
+        handleRequest(reqObj);
+      } else {
+        milightClient->setRepeatsOverride(
+          settings.httpRepeatFactor * settings.packetRepeats
+        );
+        milightClient->updateGroups(config, deviceId, targetGroupIds, reqObj);
+        milightClient->clearRepeatsOverride();
+      }
     }
   }
 
@@ -585,7 +716,7 @@ void MiLightHttpServer::handlePacketSent(uint8_t *packet, const MiLightRemoteCon
     sprintf_P(
       responseBuffer,
       PSTR("\n%s packet received (%d bytes):\n%s"),
-      config.name.c_str(),
+      config.name,
       packetLen,
       formattedPacket
     );
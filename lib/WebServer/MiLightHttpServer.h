@@ -6,6 +6,8 @@
 #include <RadioSwitchboard.h>
 #include <PacketSender.h>
 #include <TransitionController.h>
+#include <MqttClient.h>
+#include <ChunkedJsonWriter.h>
 
 #ifndef _MILIGHT_HTTP_SERVER
 #define _MILIGHT_HTTP_SERVER
@@ -29,7 +31,8 @@ public:
     GroupStateStore*& stateStore,
     PacketSender*& packetSender,
     RadioSwitchboard*& radios,
-    TransitionController& transitions
+    TransitionController& transitions,
+    MqttClient*& mqttClient
   )
     : authProvider(settings)
     , server(80, authProvider)
@@ -41,6 +44,7 @@ public:
     , packetSender(packetSender)
     , radios(radios)
     , transitions(transitions)
+    , mqttClient(mqttClient)
   { }
 
   void begin();
@@ -65,6 +69,8 @@ protected:
   void handleGetRadioConfigs(RequestContext& request);
 
   void handleAbout(RequestContext& request);
+  void handleGetStateChanges();
+  void handleListGroups();
   void handleSystemPost(RequestContext& request);
   void handleFirmwareUpload();
   void handleFirmwarePost();
@@ -87,6 +93,8 @@ protected:
   void handleCreateTransition(RequestContext& request);
   void handleListTransitions(RequestContext& request);
 
+  void writeStates(ChunkedJsonWriter& writer);
+
   void handleRequest(const JsonObject& request);
   void handleWsEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t length);
 
@@ -105,6 +113,7 @@ protected:
   PacketSender*& packetSender;
   RadioSwitchboard*& radios;
   TransitionController& transitions;
+  MqttClient*& mqttClient;
 
 };
 
@@ -19,13 +19,12 @@
 #include <ESP8266mDNS.h>
 #include <ESP8266SSDP.h>
 #include <MqttClient.h>
-#include <RGBConverter.h>
 //#include <MiLightDiscoveryServer.h>
 #include <MiLightClient.h>
 #include <BulbStateUpdater.h>
 #include <RadioSwitchboard.h>
 #include <PacketSender.h>
-//#include <HomeAssistantDiscoveryClient.h>
+#include <HomeAssistantDiscoveryClient.h>
 #include <TransitionController.h>
 //<Added by HC>
 #include <WallSwitch.h>
@@ -59,6 +58,7 @@ PacketSender* packetSender = nullptr;
 std::shared_ptr<MiLightRadioFactory> radioFactory;
 MiLightHttpServer *httpServer = NULL;
 MqttClient* mqttClient = NULL;
+HomeAssistantDiscoveryClient* discoveryClient = NULL;
 //MiLightDiscoveryServer* discoveryServer = NULL;
 uint8_t currentRadioType = 0;
 
@@ -101,9 +101,9 @@ TransitionController transitions;
  * Milight RF packet handler.
  *
  * Called both when a packet is sent locally, and when an intercepted packet
- * is read.
+ * is read.  Returns the bulb the packet was for.
  */
-void onPacketSentHandler(uint8_t* packet, const MiLightRemoteConfig& config) {
+BulbId handlePacket(uint8_t* packet, const MiLightRemoteConfig& config) {
   StaticJsonDocument<200> buffer;
   JsonObject result = buffer.to<JsonObject>();
 
@@ -114,7 +114,7 @@ void onPacketSentHandler(uint8_t* packet, const MiLightRemoteConfig& config) {
 
   if (&bulbId == &DEFAULT_BULB_ID) {
     Serial.println(F("Skipping packet handler because packet was not decoded"));
-    return;
+    return bulbId;
   }
 
   const MiLightRemoteConfig& remoteConfig =
@@ -134,29 +134,47 @@ void onPacketSentHandler(uint8_t* packet, const MiLightRemoteConfig& config) {
 		  // pass in previous scratch state as well
   		const GroupState stateUpdates(groupState, result);
 
+  		bool stateChanged = false;
+
 	    if (groupState != NULL) {
-	      groupState->patch(stateUpdates);
+	      const GroupState previousState(*groupState);
 
-	      // Copy state before setting it to avoid group 0 re-initialization clobbering it
-    	  stateStore->set(bulbId, stateUpdates);
+	      // The store patches the state itself, so that it can record what changed
+    	  groupState = stateStore->set(bulbId, stateUpdates);
+    	  stateChanged = ! groupState->isEqualIgnoreDirty(previousState);
 	    }
 
   		if (mqttClient) {
 
   			// Sends the state delta derived from the raw packet
   			char output[200];
-  			serializeJson(result, output);
-  			mqttClient->sendUpdate(remoteConfig, bulbId.deviceId, bulbId.groupId, output);
+  			const size_t length = settings.mqttPayloadFormat == MqttPayloadFormat::MSGPACK
+  			  ? serializeMsgPack(result, output, sizeof(output))
+  			  : serializeJson(result, output, sizeof(output));
+  			mqttClient->sendUpdate(remoteConfig, bulbId.deviceId, bulbId.groupId, reinterpret_cast<const uint8_t*>(output), length);
 
   			// Sends the entire state
     		if (groupState != NULL) {
       		bulbStateUpdater->enqueueUpdate(bulbId, *groupState);
   		  }
+
+  			// Every change to a group this hub controls is announced, so the retained sync
+  			// message is never older than the state.  While a wall switch button is held,
+  			// WallSwitch announces the result once it's released instead.
+  			if (stateChanged && mqttClient->hasSyncTopic() && mqttClient->isReceiveEnabled()) {
+  			  mqttClient->sendSync(bulbId, *groupState);
+  			}
   	  }
     }
   }
 
   httpServer->handlePacketSent(packet, remoteConfig);
+
+  return bulbId;
+}
+
+void onPacketSentHandler(uint8_t* packet, const MiLightRemoteConfig& config) {
+  handlePacket(packet, config);
 }
 
 /**
@@ -193,7 +211,10 @@ void handleListen() {
       }
 
       // update state to reflect this packet
-      onPacketSentHandler(readPacket, *remoteConfig);
+      BulbId bulbId = handlePacket(readPacket, *remoteConfig);
+
+      // The remote may have used the sequence number we'd have sent next
+      PacketFormatter::sequenceNumbers.forget(bulbId.deviceId, bulbId.deviceType);
     }
   }
 }
@@ -226,13 +247,17 @@ void applySettings() {
     delete milightClient;
   }
   if (mqttClient) {
+    delete discoveryClient;
     delete mqttClient;
     delete bulbStateUpdater;
 
+    discoveryClient = NULL;
     mqttClient = NULL;
     bulbStateUpdater = NULL;
   }
   if (stateStore) {
+    // The new store preloads from flash, so don't lose anything still in the cache
+    stateStore->flush();
     delete stateStore;
   }
   if (packetSender) {
@@ -254,7 +279,20 @@ void applySettings() {
     Serial.println(F("ERROR: unable to construct radio factory"));
   }
 
-  stateStore = new GroupStateStore(MILIGHT_MAX_STATE_ITEMS, settings.stateFlushInterval);
+  // Commands are only accepted for the gateway device IDs, so keep their states resident
+  std::vector<uint16_t> gatewayDeviceIds;
+  for (size_t i = 0; i < settings.gatewayConfigs.size(); i++) {
+    gatewayDeviceIds.push_back(settings.gatewayConfigs[i]->deviceId);
+  }
+
+  stateStore = new GroupStateStore(MILIGHT_MAX_STATE_ITEMS, settings.stateFlushInterval, gatewayDeviceIds);
+  stateStore->preload();
+
+  Serial.print(F("Preloaded "));
+  Serial.print(stateStore->getPreloadedCount());
+  Serial.print(F(" group states in "));
+  Serial.print(stateStore->getPreloadMicros());
+  Serial.println(F("us"));
 
   radios = new RadioSwitchboard(radioFactory, stateStore, settings);
   packetSender = new PacketSender(*radios, settings, onPacketSentHandler);
@@ -270,18 +308,22 @@ void applySettings() {
   milightClient->onUpdateEnd(onUpdateEnd);
 
   if (settings.mqttServer().length() > 0) {
-    mqttClient = new MqttClient(settings, milightClient);
+    mqttClient = new MqttClient(settings, milightClient, stateStore);
     mqttClient->begin();
     mqttClient->onConnect([]() {
-      if (settings.homeAssistantDiscoveryPrefix.length() > 0) {
-        //HomeAssistantDiscoveryClient discoveryClient(settings, mqttClient);
-        //discoveryClient.sendDiscoverableDevices(settings.groupIdAliases);
-        //discoveryClient.removeOldDevices(settings.deletedGroupIdAliases);
+      if (discoveryClient) {
+        // Only queues the configs.  They're published from loop().
+        discoveryClient->sendDiscoverableDevices(settings.groupIdAliases);
+        discoveryClient->removeOldDevices(settings.deletedGroupIdAliases);
 
         settings.deletedGroupIdAliases.clear();
       }
     });
 
+    if (settings.homeAssistantDiscoveryPrefix.length() > 0) {
+      discoveryClient = new HomeAssistantDiscoveryClient(settings, mqttClient);
+    }
+
     bulbStateUpdater = new BulbStateUpdater(settings, *mqttClient, *stateStore);
   }
 
@@ -401,7 +443,7 @@ void setup() {
   // ledStatus = new LEDStatus(settings.ledPin);
   // ledStatus->continuous(settings.ledModeWifiConfig);
 
-  httpServer = new MiLightHttpServer(settings, milightClient, stateStore, packetSender, radios, transitions);
+  httpServer = new MiLightHttpServer(settings, milightClient, stateStore, packetSender, radios, transitions, mqttClient);
   httpServer->onSettingsSaved(applySettings);
   httpServer->onGroupDeleted(onGroupDeleted);
   httpServer->on("/description.xml", HTTP_GET, []() { SSDP.schema(httpServer->client()); });
@@ -429,6 +471,10 @@ void loop() {
   if (mqttClient) {
     mqttClient->handleClient();
     bulbStateUpdater->loop();
+
+    if (discoveryClient) {
+      discoveryClient->handleClient();
+    }
   }
 
   // for (size_t i = 0; i < udpServers.size(); i++) {
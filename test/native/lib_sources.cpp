@@ -0,0 +1,86 @@
+/**
+ * The native env doesn't run the library dependency finder (most of lib/ only
+ * builds for the ESP8266), so the hardware-independent sources under test are
+ * compiled here as a single unit, along with the host runtime declared by the
+ * headers in shim/.
+ */
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+FS SPIFFS;
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield() { }
+
+long random(long max) {
+  return max <= 0 ? 0 : rand() % max;
+}
+
+long random(long min, long max) {
+  return min >= max ? min : min + random(max - min);
+}
+
+void randomSeed(unsigned long seed) {
+  srand(seed);
+}
+
+#include "../../lib/Types/BulbId.cpp"
+#include "../../lib/Types/GroupStateField.cpp"
+#include "../../lib/Types/MiLightRemoteType.cpp"
+#include "../../lib/Types/MiLightStatus.cpp"
+#include "../../lib/Types/ParsedColor.cpp"
+
+#include "../../lib/Radio/RadioUtils.cpp"
+#include "../../lib/Radio/MiLightRadioConfig.cpp"
+
+#include "../../lib/MiLightState/GroupState.cpp"
+#include "../../lib/MiLightState/GroupStateWriter.cpp"
+#include "../../lib/MiLightState/GroupStateCache.cpp"
+#include "../../lib/MiLightState/GroupBroadcastLog.cpp"
+#include "../../lib/MiLightState/ResidentGroupStates.cpp"
+#include "../../lib/MiLightState/GroupStateChangeLog.cpp"
+#include "../../lib/MiLightState/GroupStatePersistence.cpp"
+#include "../../lib/MiLightState/GroupStateStore.cpp"
+
+#include "../../lib/MiLight/V2RFEncoding.cpp"
+#include "../../lib/MiLight/SequenceNumberTable.cpp"
+#include "../../lib/MiLight/PacketFormatter.cpp"
+#include "../../lib/MiLight/V2PacketFormatter.cpp"
+#include "../../lib/MiLight/RgbwPacketFormatter.cpp"
+#include "../../lib/MiLight/CctPacketFormatter.cpp"
+#include "../../lib/MiLight/RgbCctPacketFormatter.cpp"
+#include "../../lib/MiLight/FUT089PacketFormatter.cpp"
+#include "../../lib/MiLight/FUT091PacketFormatter.cpp"
+#include "../../lib/MiLight/RgbPacketFormatter.cpp"
+#include "../../lib/MiLight/FUT02xPacketFormatter.cpp"
+#include "../../lib/MiLight/FUT020PacketFormatter.cpp"
+#include "../../lib/MiLight/MiLightRemoteConfig.cpp"
+#include "../../lib/MiLight/GroupBatch.cpp"
+
+#include "../../lib/MQTT/MqttTopicTemplate.cpp"
+#include "../../lib/MQTT/MqttTopicMatcher.cpp"
+#include "../../lib/MQTT/GroupAliasIndex.cpp"
+#include "../../lib/MQTT/StaleGroupSet.cpp"
+#include "../../lib/MQTT/CommandDelta.cpp"
+#include "../../lib/MQTT/CommandRepeatQueue.cpp"
+#include "../../lib/MQTT/MqttOutbox.cpp"
+#include "../../lib/MQTT/DeferredCommandQueue.cpp"
+#include "../../lib/MQTT/HubSync.cpp"
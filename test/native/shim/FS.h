@@ -0,0 +1,160 @@
+#pragma once
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * In-memory stand-in for the ESP8266 SPIFFS API.
+ */
+
+enum SeekMode {
+  SeekSet = 0,
+  SeekCur = 1,
+  SeekEnd = 2
+};
+
+class FS;
+
+class File : public Stream {
+public:
+  File() : data(NULL), pos(0), writable(false), fs(NULL) { }
+  File(std::shared_ptr<std::vector<uint8_t>> data, size_t pos, bool writable, FS* fs)
+    : data(data), pos(pos), writable(writable), fs(fs) { }
+
+  operator bool() const { return data != NULL; }
+
+  virtual size_t write(uint8_t c) { return write(&c, 1); }
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+
+  virtual int available() { return data ? data->size() - pos : 0; }
+  virtual int read() { return available() > 0 ? (*data)[pos++] : -1; }
+  virtual int peek() { return available() > 0 ? (*data)[pos] : -1; }
+
+  size_t read(uint8_t* buffer, size_t size) { return readBytes(buffer, size); }
+
+  bool seek(uint32_t offset, SeekMode mode = SeekSet) {
+    if (!data) {
+      return false;
+    }
+    size_t base = mode == SeekSet ? 0 : (mode == SeekCur ? pos : data->size());
+    if (base + offset > data->size()) {
+      return false;
+    }
+    pos = base + offset;
+    return true;
+  }
+
+  size_t position() const { return pos; }
+  size_t size() const { return data ? data->size() : 0; }
+  void close() { data.reset(); }
+
+private:
+  std::shared_ptr<std::vector<uint8_t>> data;
+  size_t pos;
+  bool writable;
+  FS* fs;
+};
+
+// Snapshot of the file names matching a prefix
+class Dir {
+public:
+  Dir() : current(-1) { }
+  Dir(std::vector<std::string> names) : names(names), current(-1) { }
+
+  bool next() { return ++current < static_cast<int>(names.size()); }
+  String fileName() const { return names[current].c_str(); }
+
+private:
+  std::vector<std::string> names;
+  int current;
+};
+
+class FS {
+public:
+  FS() : capacity(0) { }
+
+  bool begin() { return true; }
+  void end() { }
+  bool format() { files.clear(); capacity = 0; return true; }
+
+  // Writes that would use more than this many bytes in total fail.  0 is unlimited.
+  void setCapacity(size_t bytes) { capacity = bytes; }
+
+  size_t usedBytes() const {
+    size_t used = 0;
+    for (auto& file : files) {
+      used += file.second->size();
+    }
+    return used;
+  }
+
+  bool canGrow(size_t bytes) const { return capacity == 0 || usedBytes() + bytes <= capacity; }
+
+  bool exists(const char* path) { return files.count(path) > 0; }
+  bool exists(const String& path) { return exists(path.c_str()); }
+
+  bool remove(const char* path) { return files.erase(path) > 0; }
+  bool remove(const String& path) { return remove(path.c_str()); }
+
+  bool rename(const char* from, const char* to) {
+    auto it = files.find(from);
+    if (it == files.end()) {
+      return false;
+    }
+    files[to] = it->second;
+    files.erase(it);
+    return true;
+  }
+
+  File open(const char* path, const char* mode) {
+    std::shared_ptr<std::vector<uint8_t>>& data = files[path];
+    const bool exists = data != NULL;
+
+    if (mode[0] == 'r' && !exists) {
+      files.erase(path);
+      return File();
+    }
+    if (!exists || mode[0] == 'w') {
+      data = std::make_shared<std::vector<uint8_t>>();
+    }
+
+    const bool writable = mode[0] != 'r' || mode[1] == '+';
+    return File(data, mode[0] == 'a' ? data->size() : 0, writable, this);
+  }
+  File open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+
+  Dir openDir(const char* prefix) {
+    std::vector<std::string> names;
+    for (auto& file : files) {
+      if (file.first.compare(0, strlen(prefix), prefix) == 0) {
+        names.push_back(file.first);
+      }
+    }
+    return Dir(names);
+  }
+
+private:
+  std::map<std::string, std::shared_ptr<std::vector<uint8_t>>> files;
+  size_t capacity;
+};
+
+inline size_t File::write(const uint8_t* buffer, size_t size) {
+  if (!data || !writable) {
+    return 0;
+  }
+  if (pos + size > data->size()) {
+    if (fs != NULL && !fs->canGrow(pos + size - data->size())) {
+      return 0;
+    }
+    data->resize(pos + size);
+  }
+  memcpy(data->data() + pos, buffer, size);
+  pos += size;
+  return size;
+}
+
+extern FS SPIFFS;
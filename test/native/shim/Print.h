@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <WString.h>
+
+class Print {
+public:
+  virtual ~Print() { }
+
+  virtual size_t write(uint8_t c) = 0;
+
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+      n += write(*buffer++);
+    }
+    return n;
+  }
+
+  size_t write(const char* str) { return write(reinterpret_cast<const uint8_t*>(str), strlen(str)); }
+  size_t write(const char* buffer, size_t size) { return write(reinterpret_cast<const uint8_t*>(buffer), size); }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return write(buffer, len < 0 ? 0 : (len < (int)sizeof(buffer) ? len : sizeof(buffer) - 1));
+  }
+  size_t printf_P(const char* format, ...) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return write(buffer, len < 0 ? 0 : (len < (int)sizeof(buffer) ? len : sizeof(buffer) - 1));
+  }
+
+  size_t print(const __FlashStringHelper* str) { return write(reinterpret_cast<const char*>(str)); }
+  size_t print(const String& str) { return write(str.c_str(), str.length()); }
+  size_t print(const char* str) { return write(str); }
+  size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+  size_t print(int v) { return printf("%d", v); }
+  size_t print(unsigned int v) { return printf("%u", v); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t print(unsigned long v) { return printf("%lu", v); }
+  size_t print(unsigned char v) { return printf("%u", v); }
+  size_t print(signed char v) { return printf("%d", v); }
+  size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(const T& v) { return print(v) + println(); }
+
+  virtual void flush() { }
+};
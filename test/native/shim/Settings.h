@@ -0,0 +1,51 @@
+#pragma once
+
+/**
+ * Host stand-in for lib/Settings/Settings.h.  The real header pulls in the web
+ * server's auth providers and the LED driver, neither of which builds off-device.
+ * Mirrors only the settings read by the sources compiled into the native tests.
+ */
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <GroupStateField.h>
+#include <MiLightRemoteType.h>
+#include <BulbId.h>
+#include <Size.h>
+
+#include <vector>
+#include <memory>
+#include <map>
+
+#ifndef MILIGHT_MAX_STATE_ITEMS
+#define MILIGHT_MAX_STATE_ITEMS 100
+#endif
+
+struct GatewayConfig {
+  GatewayConfig(uint16_t deviceId, uint16_t port, uint8_t protocolVersion)
+    : deviceId(deviceId), port(port), protocolVersion(protocolVersion) { }
+
+  const uint16_t deviceId;
+  const uint16_t port;
+  const uint8_t protocolVersion;
+};
+
+class Settings {
+public:
+  Settings()
+    : packetRepeats(50),
+      stateFlushInterval(10000),
+      mqttStateRateLimit(500),
+      mqttDebounceDelay(500),
+      mqttStateMaxStaleness(10000),
+      enableAutomaticModeSwitching(false)
+  { }
+
+  size_t packetRepeats;
+  size_t stateFlushInterval;
+  size_t mqttStateRateLimit;
+  size_t mqttDebounceDelay;
+  size_t mqttStateMaxStaleness;
+  bool enableAutomaticModeSwitching;
+  std::vector<std::shared_ptr<GatewayConfig>> gatewayConfigs;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * Host stand-in for TokenIterator from the PathVariableHandlers library, which
+ * can't be built off-device as a whole.  Splits a mutable buffer in place.
+ */
+class TokenIterator {
+public:
+  TokenIterator(char* data, size_t length, char sep = '/')
+    : data(data), current(data), length(length)
+  {
+    for (size_t i = 0; i < length; i++) {
+      if (data[i] == sep) {
+        data[i] = 0;
+      }
+    }
+  }
+
+  bool hasNext() const { return current < data + length; }
+
+  const char* nextToken() {
+    const char* token = current;
+    current += strlen(current) + 1;
+    return token;
+  }
+
+  void reset() { current = data; }
+
+private:
+  char* data;
+  char* current;
+  size_t length;
+};
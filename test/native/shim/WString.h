@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+
+class __FlashStringHelper;
+
+/**
+ * Host stand-in for the Arduino String class, backed by std::string.  Only the
+ * parts of the API used by the sources compiled into the native tests are here.
+ */
+class String {
+public:
+  String(const char* str = "") : value(str == NULL ? "" : str) { }
+  String(const __FlashStringHelper* str) : String(reinterpret_cast<const char*>(str)) { }
+  String(const std::string& str) : value(str) { }
+  String(char c) : value(1, c) { }
+  String(int v) : value(std::to_string(v)) { }
+  String(unsigned int v) : value(std::to_string(v)) { }
+  String(long v) : value(std::to_string(v)) { }
+  String(unsigned long v) : value(std::to_string(v)) { }
+  String(unsigned char v) : value(std::to_string(v)) { }
+
+  const char* c_str() const { return value.c_str(); }
+  unsigned int length() const { return value.length(); }
+  void reserve(unsigned int size) { value.reserve(size); }
+
+  char charAt(unsigned int ix) const { return ix < value.length() ? value[ix] : 0; }
+  char operator[](unsigned int ix) const { return charAt(ix); }
+  char& operator[](unsigned int ix) { return value[ix]; }
+
+  String& operator+=(const String& other) { value += other.value; return *this; }
+  String& operator+=(const char* other) { value += other; return *this; }
+  String& operator+=(char c) { value += c; return *this; }
+  bool concat(const String& other) { value += other.value; return true; }
+  bool concat(const char* other) { value += other; return true; }
+  bool concat(char c) { value += c; return true; }
+
+  bool equals(const String& other) const { return value == other.value; }
+  bool equals(const char* other) const { return value == other; }
+  bool equalsIgnoreCase(const String& other) const { return strcasecmp(c_str(), other.c_str()) == 0; }
+  bool startsWith(const String& prefix) const { return value.compare(0, prefix.value.length(), prefix.value) == 0; }
+  bool endsWith(const String& suffix) const {
+    return value.length() >= suffix.value.length()
+      && value.compare(value.length() - suffix.value.length(), suffix.value.length(), suffix.value) == 0;
+  }
+
+  bool operator==(const String& other) const { return value == other.value; }
+  bool operator==(const char* other) const { return value == other; }
+  bool operator!=(const String& other) const { return value != other.value; }
+  bool operator!=(const char* other) const { return value != other; }
+  bool operator<(const String& other) const { return value < other.value; }
+
+  int indexOf(char c, unsigned int from = 0) const { return toIndex(value.find(c, from)); }
+  int indexOf(const String& str, unsigned int from = 0) const { return toIndex(value.find(str.value, from)); }
+  int lastIndexOf(char c) const { return toIndex(value.rfind(c)); }
+
+  String substring(unsigned int from) const { return from < value.length() ? String(value.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    return from < to && from < value.length() ? String(value.substr(from, to - from)) : String();
+  }
+
+  void replace(const String& find, const String& replacement) {
+    if (find.value.empty()) {
+      return;
+    }
+
+    size_t pos = 0;
+    while ((pos = value.find(find.value, pos)) != std::string::npos) {
+      value.replace(pos, find.value.length(), replacement.value);
+      pos += replacement.value.length();
+    }
+  }
+
+  void toLowerCase() { for (char& c : value) c = tolower(c); }
+  void toUpperCase() { for (char& c : value) c = toupper(c); }
+  void trim() {
+    size_t start = value.find_first_not_of(" \t\r\n");
+    size_t end = value.find_last_not_of(" \t\r\n");
+    value = start == std::string::npos ? "" : value.substr(start, end - start + 1);
+  }
+
+  long toInt() const { return atol(c_str()); }
+  float toFloat() const { return atof(c_str()); }
+
+  friend String operator+(const String& lhs, const String& rhs) { return String(lhs.value + rhs.value); }
+
+private:
+  std::string value;
+
+  static int toIndex(size_t pos) { return pos == std::string::npos ? -1 : static_cast<int>(pos); }
+};
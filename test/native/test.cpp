@@ -0,0 +1,2894 @@
+#include <Arduino.h>
+
+#include <GroupStateStore.h>
+#include <MiLightRemoteConfig.h>
+#include <MiLightCommands.h>
+#include <GroupBatch.h>
+#include <Units.h>
+#include <ColorConversion.h>
+#include <RGBConverter.h>
+#include <MqttTopicTemplate.h>
+#include <MqttTopicMatcher.h>
+#include <GroupAliasIndex.h>
+#include <DeviceIdSet.h>
+#include <StaleGroupSet.h>
+#include <CommandRepeatQueue.h>
+#include <MqttOutbox.h>
+#include <DeferredCommandQueue.h>
+#include <HubSync.h>
+#include <TokenIterator.h>
+
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "unity.h"
+
+// Fixed seed so failures are reproducible
+#define ROUND_TRIP_SEED 0x4D694C74
+#define ROUND_TRIP_ITERATIONS 500
+#define BENCHMARK_PACKETS 20000
+#define BENCHMARK_COLOR_SWEEPS 20
+#define BENCHMARK_CACHE_OPERATIONS 200000
+#define BENCHMARK_STATE_WRITES 20000
+#define BENCHMARK_TOPICS 100000
+#define BENCHMARK_ALIASES 1000
+
+// Nudges RGBConverter's results past rounding boundaries that floating point error
+// leaves them just short of
+#define COLOR_REFERENCE_EPSILON 1e-9
+
+static GroupStateStore stateStore(MILIGHT_MAX_STATE_ITEMS, 0);
+static Settings settings;
+
+//================================================================================
+// Packet formatter round trips
+//================================================================================
+
+enum class RoundTripCommand {
+  STATUS,
+  BRIGHTNESS,
+  BRIGHTNESS_STEPS,
+  HUE,
+  TEMPERATURE,
+  TEMPERATURE_STEPS,
+  SATURATION,
+  MODE,
+  NIGHT_MODE
+};
+
+struct RoundTripSpec {
+  MiLightRemoteType type;
+  std::vector<RoundTripCommand> commands;
+
+  // Quantization error allowed when reading back brightness (0-255) and hue (degrees)
+  uint8_t brightnessTolerance;
+  uint8_t hueTolerance;
+};
+
+// Commands each remote can encode such that parsePacket recovers the original
+// value.  FUT020 on/off is a toggle and FUT089 saturation is indistinguishable
+// from temperature without state, so neither is round-trippable.
+static const RoundTripSpec ROUND_TRIP_SPECS[] = {
+  {
+    REMOTE_TYPE_RGBW,
+    { RoundTripCommand::STATUS, RoundTripCommand::BRIGHTNESS, RoundTripCommand::HUE, RoundTripCommand::MODE, RoundTripCommand::NIGHT_MODE },
+    6, 2
+  },
+  {
+    REMOTE_TYPE_CCT,
+    { RoundTripCommand::STATUS, RoundTripCommand::BRIGHTNESS_STEPS, RoundTripCommand::TEMPERATURE_STEPS, RoundTripCommand::NIGHT_MODE },
+    0, 0
+  },
+  {
+    REMOTE_TYPE_RGB_CCT,
+    { RoundTripCommand::STATUS, RoundTripCommand::BRIGHTNESS, RoundTripCommand::HUE, RoundTripCommand::TEMPERATURE, RoundTripCommand::SATURATION, RoundTripCommand::MODE, RoundTripCommand::NIGHT_MODE },
+    1, 1
+  },
+  {
+    REMOTE_TYPE_RGB,
+    { RoundTripCommand::STATUS, RoundTripCommand::BRIGHTNESS_STEPS, RoundTripCommand::HUE },
+    0, 2
+  },
+  {
+    REMOTE_TYPE_FUT089,
+    { RoundTripCommand::STATUS, RoundTripCommand::BRIGHTNESS, RoundTripCommand::HUE, RoundTripCommand::TEMPERATURE, RoundTripCommand::MODE, RoundTripCommand::NIGHT_MODE },
+    1, 1
+  },
+  {
+    REMOTE_TYPE_FUT091,
+    { RoundTripCommand::STATUS, RoundTripCommand::BRIGHTNESS, RoundTripCommand::TEMPERATURE, RoundTripCommand::NIGHT_MODE },
+    1, 0
+  },
+  {
+    REMOTE_TYPE_FUT020,
+    { RoundTripCommand::BRIGHTNESS_STEPS, RoundTripCommand::HUE },
+    0, 3
+  }
+};
+
+struct ParsedPacket {
+  BulbId bulbId;
+  StaticJsonDocument<200> result;
+};
+
+// The shortest packets are 6 bytes, so this covers everything the shared packet buffer can hold
+struct ParsedPackets {
+  ParsedPacket packets[PACKET_FORMATTER_BUFFER_SIZE / 6];
+  size_t count;
+
+  ParsedPacket& last() { return packets[count - 1]; }
+};
+
+static uint16_t randomValueFor(RoundTripCommand command) {
+  switch (command) {
+    case RoundTripCommand::STATUS:
+      return random(2);
+    case RoundTripCommand::HUE:
+      return random(360);
+    case RoundTripCommand::MODE:
+      return random(RGB_CCT_NUM_MODES);
+    default:
+      return random(101);
+  }
+}
+
+static PacketStream& encode(const MiLightRemoteConfig* remote, RoundTripCommand command, uint16_t deviceId, uint8_t groupId, uint16_t value) {
+  PacketFormatter* formatter = remote->packetFormatter;
+  formatter->prepare(deviceId, groupId);
+
+  switch (command) {
+    case RoundTripCommand::STATUS:
+      formatter->updateStatus(value ? ON : OFF, groupId);
+      break;
+    case RoundTripCommand::BRIGHTNESS:
+    case RoundTripCommand::BRIGHTNESS_STEPS:
+      formatter->updateBrightness(value);
+      break;
+    case RoundTripCommand::HUE:
+      formatter->updateHue(value);
+      break;
+    case RoundTripCommand::TEMPERATURE:
+    case RoundTripCommand::TEMPERATURE_STEPS:
+      formatter->updateTemperature(value);
+      break;
+    case RoundTripCommand::SATURATION:
+      formatter->updateSaturation(value);
+      break;
+    case RoundTripCommand::MODE:
+      formatter->updateMode(value);
+      break;
+    case RoundTripCommand::NIGHT_MODE:
+      formatter->enableNightMode();
+      break;
+  }
+
+  return formatter->buildPackets();
+}
+
+static void decode(const MiLightRemoteConfig* remote, PacketStream& stream, ParsedPackets& parsed) {
+  const size_t packetLength = remote->packetFormatter->getPacketLength();
+  parsed.count = 0;
+
+  while (stream.hasNext()) {
+    uint8_t* packet = stream.next();
+
+    TEST_ASSERT_TRUE_MESSAGE(
+      MiLightRemoteConfig::fromReceivedPacket(remote->radioConfig, packet, packetLength) == remote,
+      "Encoded packet should be attributed to the remote that encoded it"
+    );
+
+    ParsedPacket& result = parsed.packets[parsed.count++];
+    result.bulbId = remote->packetFormatter->parsePacket(packet, result.result.to<JsonObject>());
+  }
+}
+
+// Simulate a run of up/down step commands on a value clamped to [0, numSteps]
+static int8_t applySteps(ParsedPackets& parsed, const char* up, const char* down, int8_t start, int8_t numSteps) {
+  int8_t value = start;
+
+  for (size_t i = 0; i < parsed.count; i++) {
+    const char* command = parsed.packets[i].result[GroupStateFieldNames::COMMAND].as<const char*>();
+
+    if (command != NULL && strcmp(command, up) == 0) {
+      value = min<int8_t>(value + 1, numSteps);
+    } else if (command != NULL && strcmp(command, down) == 0) {
+      value = max<int8_t>(value - 1, 0);
+    }
+  }
+
+  return value;
+}
+
+static int16_t hueDistance(int16_t a, int16_t b) {
+  int16_t distance = abs(a - b) % 360;
+  return distance > 180 ? 360 - distance : distance;
+}
+
+static void check_round_trip(const RoundTripSpec& spec, RoundTripCommand command, uint16_t deviceId, uint8_t groupId, uint16_t value) {
+  const MiLightRemoteConfig* remote = MiLightRemoteConfig::fromType(spec.type);
+  const GroupState* state = stateStore.get(deviceId, groupId, spec.type);
+
+  // Known state before encoding, which the step-based remotes start from
+  const int8_t knownBrightness = state->isSetBrightness() ? state->getBrightness() / 10 : 10;
+  const int8_t knownKelvin = state->isSetKelvin() ? state->getKelvin() / 10 : 10;
+
+  static ParsedPackets parsed;
+  decode(remote, encode(remote, command, deviceId, groupId, value), parsed);
+
+  char message[100];
+  sprintf(message, "remote=%s command=%d device=0x%04X group=%d value=%d", remote->name, static_cast<int>(command), deviceId, groupId, value);
+
+  TEST_ASSERT_TRUE_MESSAGE(parsed.count > 0, message);
+
+  for (size_t i = 0; i < parsed.count; i++) {
+    TEST_ASSERT_EQUAL_INT_MESSAGE(deviceId, parsed.packets[i].bulbId.deviceId, message);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(groupId, parsed.packets[i].bulbId.groupId, message);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(spec.type, parsed.packets[i].bulbId.deviceType, message);
+  }
+
+  // Remotes which need to switch modes first send extra packets, so the value lives in the last one
+  JsonObject last = parsed.last().result.as<JsonObject>();
+
+  switch (command) {
+    case RoundTripCommand::STATUS:
+      TEST_ASSERT_EQUAL_STRING_MESSAGE(value ? "ON" : "OFF", last[GroupStateFieldNames::STATE].as<const char*>(), message);
+      break;
+    case RoundTripCommand::BRIGHTNESS:
+      TEST_ASSERT_TRUE_MESSAGE(last.containsKey(GroupStateFieldNames::BRIGHTNESS), message);
+      TEST_ASSERT_INT_WITHIN_MESSAGE(spec.brightnessTolerance, Units::rescale(value, 255, 100), last[GroupStateFieldNames::BRIGHTNESS].as<uint8_t>(), message);
+      break;
+    case RoundTripCommand::BRIGHTNESS_STEPS:
+      TEST_ASSERT_EQUAL_INT_MESSAGE(value / 10, applySteps(parsed, "brightness_up", "brightness_down", knownBrightness, 10), message);
+      break;
+    case RoundTripCommand::HUE:
+      TEST_ASSERT_TRUE_MESSAGE(last.containsKey(GroupStateFieldNames::HUE), message);
+      TEST_ASSERT_INT_WITHIN_MESSAGE(spec.hueTolerance, 0, hueDistance(value, last[GroupStateFieldNames::HUE].as<uint16_t>()), message);
+      break;
+    case RoundTripCommand::TEMPERATURE:
+      TEST_ASSERT_TRUE_MESSAGE(last.containsKey(GroupStateFieldNames::COLOR_TEMP), message);
+      TEST_ASSERT_INT_WITHIN_MESSAGE(1, Units::whiteValToMireds(value, 100), last[GroupStateFieldNames::COLOR_TEMP].as<uint16_t>(), message);
+      break;
+    case RoundTripCommand::TEMPERATURE_STEPS:
+      TEST_ASSERT_EQUAL_INT_MESSAGE(value / 10, applySteps(parsed, MiLightCommandNames::TEMPERATURE_UP, MiLightCommandNames::TEMPERATURE_DOWN, knownKelvin, 10), message);
+      break;
+    case RoundTripCommand::SATURATION:
+      TEST_ASSERT_EQUAL_INT_MESSAGE(value, last[GroupStateFieldNames::SATURATION].as<uint8_t>(), message);
+      break;
+    case RoundTripCommand::MODE:
+      TEST_ASSERT_TRUE_MESSAGE(last.containsKey(GroupStateFieldNames::MODE), message);
+      TEST_ASSERT_EQUAL_INT_MESSAGE(value, last[GroupStateFieldNames::MODE].as<uint8_t>(), message);
+      break;
+    case RoundTripCommand::NIGHT_MODE:
+      TEST_ASSERT_EQUAL_STRING_MESSAGE(MiLightCommandNames::NIGHT_MODE, last[GroupStateFieldNames::COMMAND].as<const char*>(), message);
+      break;
+  }
+}
+
+void test_all_remotes_have_round_trip_specs() {
+  TEST_ASSERT_EQUAL_INT(MiLightRemoteConfig::NUM_REMOTES, size(ROUND_TRIP_SPECS));
+
+  for (size_t i = 0; i < size(ROUND_TRIP_SPECS); i++) {
+    TEST_ASSERT_NOT_NULL(MiLightRemoteConfig::fromType(ROUND_TRIP_SPECS[i].type));
+  }
+}
+
+void test_packet_formatter_round_trips() {
+  randomSeed(ROUND_TRIP_SEED);
+
+  for (const RoundTripSpec& spec : ROUND_TRIP_SPECS) {
+    const MiLightRemoteConfig* remote = MiLightRemoteConfig::fromType(spec.type);
+
+    for (size_t i = 0; i < ROUND_TRIP_ITERATIONS; i++) {
+      const uint16_t deviceId = random(1, 0x10000);
+      const uint8_t groupId = remote->numGroups == 0 ? 0 : random(1, remote->numGroups + 1);
+      const RoundTripCommand command = spec.commands[random(spec.commands.size())];
+
+      check_round_trip(spec, command, deviceId, groupId, randomValueFor(command));
+    }
+  }
+}
+
+//================================================================================
+// Packet formatter throughput
+//================================================================================
+
+void test_packet_formatter_throughput() {
+  uint8_t packets[BENCHMARK_PACKETS][MILIGHT_MAX_PACKET_LENGTH];
+  StaticJsonDocument<200> result;
+
+  printf("\n%-10s %16s %16s\n", "remote", "encode pkt/s", "decode pkt/s");
+
+  for (size_t i = 0; i < MiLightRemoteConfig::NUM_REMOTES; i++) {
+    const MiLightRemoteConfig* remote = MiLightRemoteConfig::ALL_REMOTES[i];
+    PacketFormatter* formatter = remote->packetFormatter;
+    const size_t packetLength = formatter->getPacketLength();
+    const uint8_t groupId = remote->numGroups == 0 ? 0 : 1;
+
+    unsigned long start = micros();
+    for (size_t j = 0; j < BENCHMARK_PACKETS; j++) {
+      formatter->prepare(j, groupId);
+      formatter->updateStatus(j % 2 ? ON : OFF, groupId);
+      memcpy(packets[j], formatter->buildPackets().next(), packetLength);
+    }
+    const unsigned long encodeMicros = max(micros() - start, 1UL);
+
+    start = micros();
+    for (size_t j = 0; j < BENCHMARK_PACKETS; j++) {
+      const MiLightRemoteConfig* config = MiLightRemoteConfig::fromReceivedPacket(remote->radioConfig, packets[j], packetLength);
+      config->packetFormatter->parsePacket(packets[j], result.to<JsonObject>());
+    }
+    const unsigned long decodeMicros = max(micros() - start, 1UL);
+
+    printf(
+      "%-10s %16.0f %16.0f\n",
+      remote->name,
+      BENCHMARK_PACKETS * 1e6 / encodeMicros,
+      BENCHMARK_PACKETS * 1e6 / decodeMicros
+    );
+  }
+}
+
+//================================================================================
+// Sequence numbers
+//================================================================================
+
+void test_sequence_numbers_are_per_device() {
+  SequenceNumberTable table;
+  bool fresh;
+
+  const uint8_t first = table.next(0x1234, REMOTE_TYPE_RGBW, fresh);
+  TEST_ASSERT_FALSE(fresh);
+
+  // Neither another device ID nor another remote type advances 0x1234's sequence
+  table.next(0x4321, REMOTE_TYPE_RGBW, fresh);
+  table.next(0x1234, REMOTE_TYPE_CCT, fresh);
+
+  TEST_ASSERT_EQUAL_UINT8(uint8_t(first + 1), table.next(0x1234, REMOTE_TYPE_RGBW, fresh));
+  TEST_ASSERT_TRUE(fresh);
+  TEST_ASSERT_EQUAL_UINT8(uint8_t(first + 2), table.next(0x1234, REMOTE_TYPE_RGBW, fresh));
+  TEST_ASSERT_TRUE(fresh);
+  TEST_ASSERT_EQUAL_UINT(3, table.size());
+
+  table.forget(0x1234, REMOTE_TYPE_RGBW);
+  TEST_ASSERT_EQUAL_UINT(2, table.size());
+  table.next(0x1234, REMOTE_TYPE_RGBW, fresh);
+  TEST_ASSERT_FALSE(fresh);
+}
+
+void test_sequence_numbers_evict_least_recently_used() {
+  SequenceNumberTable table;
+  bool fresh;
+
+  for (uint16_t deviceId = 0; deviceId < MILIGHT_SEQUENCE_TABLE_SIZE; deviceId++) {
+    table.next(deviceId, REMOTE_TYPE_FUT089, fresh);
+  }
+  TEST_ASSERT_EQUAL_UINT(MILIGHT_SEQUENCE_TABLE_SIZE, table.size());
+
+  // Touch device 0 so that device 1 is the least recently used
+  table.next(0, REMOTE_TYPE_FUT089, fresh);
+  table.next(MILIGHT_SEQUENCE_TABLE_SIZE, REMOTE_TYPE_FUT089, fresh);
+  TEST_ASSERT_EQUAL_UINT(MILIGHT_SEQUENCE_TABLE_SIZE, table.size());
+
+  table.next(0, REMOTE_TYPE_FUT089, fresh);
+  TEST_ASSERT_TRUE(fresh);
+  table.next(1, REMOTE_TYPE_FUT089, fresh);
+  TEST_ASSERT_FALSE(fresh);
+}
+
+void test_formatter_sequence_numbers_with_interleaved_devices() {
+  const MiLightRemoteConfig* remote = MiLightRemoteConfig::fromType(REMOTE_TYPE_RGBW);
+  PacketFormatter* formatter = remote->packetFormatter;
+  PacketFormatter::sequenceNumbers.clear();
+
+  uint8_t sequenceNums[4];
+  bool fresh[4];
+
+  for (size_t i = 0; i < 4; i++) {
+    // Alternate between two devices
+    formatter->prepare(0x1000 + (i % 2), 1);
+    formatter->updateStatus(ON, 1);
+
+    PacketStream& stream = formatter->buildPackets();
+    sequenceNums[i] = stream.next()[6];
+    fresh[i] = stream.freshSequence;
+  }
+
+  TEST_ASSERT_FALSE(fresh[0]);
+  TEST_ASSERT_FALSE(fresh[1]);
+  TEST_ASSERT_TRUE(fresh[2]);
+  TEST_ASSERT_TRUE(fresh[3]);
+
+  TEST_ASSERT_EQUAL_UINT8(uint8_t(sequenceNums[0] + 1), sequenceNums[2]);
+  TEST_ASSERT_EQUAL_UINT8(uint8_t(sequenceNums[1] + 1), sequenceNums[3]);
+
+  // Every packet in a stream gets its own number
+  formatter->prepare(0x1000, 1);
+  formatter->updateBrightness(50);
+  formatter->updateHue(120);
+  PacketStream& stream = formatter->buildPackets();
+  TEST_ASSERT_EQUAL_UINT(2, stream.numPackets);
+  TEST_ASSERT_EQUAL_UINT8(uint8_t(sequenceNums[2] + 1), stream.next()[6]);
+  TEST_ASSERT_EQUAL_UINT8(uint8_t(sequenceNums[2] + 2), stream.next()[6]);
+}
+
+//================================================================================
+// Group batches
+//================================================================================
+
+struct BatchUpdate {
+  uint8_t groupId;
+  std::string state;
+};
+
+// Runs GroupBatch::split over targets given as (group ID, JSON state) pairs
+static std::vector<BatchUpdate> splitBatch(uint8_t numGroups, const std::vector<std::pair<uint8_t, const char*>>& targetJson) {
+  std::vector<std::unique_ptr<StaticJsonDocument<400>>> docs;
+  std::vector<GroupTarget> targets;
+
+  for (const auto& target : targetJson) {
+    docs.emplace_back(new StaticJsonDocument<400>());
+    deserializeJson(*docs.back(), target.second);
+    targets.push_back({ target.first, docs.back()->as<JsonObject>() });
+  }
+
+  std::vector<BatchUpdate> updates;
+  GroupBatch::split(numGroups, targets, [&updates](uint8_t groupId, JsonObject state) {
+    String json;
+    serializeJson(state, json);
+    updates.push_back({ groupId, json.c_str() });
+  });
+
+  return updates;
+}
+
+static void assert_batch_update(const BatchUpdate& update, uint8_t groupId, const char* state) {
+  TEST_ASSERT_EQUAL_UINT8(groupId, update.groupId);
+  TEST_ASSERT_EQUAL_STRING(state, update.state.c_str());
+}
+
+void test_group_batch_sends_identical_targets_to_group_0() {
+  const char* state = "{\"state\":\"ON\",\"level\":50,\"transition\":2}";
+  std::vector<BatchUpdate> updates = splitBatch(4, { {1, state}, {2, state}, {3, state}, {4, state} });
+
+  TEST_ASSERT_EQUAL_UINT(1, updates.size());
+  assert_batch_update(updates[0], 0, state);
+
+  // Group 0 would also reach groups outside of the batch
+  updates = splitBatch(4, { {1, state}, {2, state} });
+  TEST_ASSERT_EQUAL_UINT(2, updates.size());
+  assert_batch_update(updates[0], 1, state);
+  assert_batch_update(updates[1], 2, state);
+}
+
+void test_group_batch_splits_mixed_targets() {
+  std::vector<BatchUpdate> updates = splitBatch(4, {
+    {1, "{\"state\":\"ON\",\"hue\":10,\"level\":50}"},
+    {2, "{\"state\":\"ON\",\"hue\":20,\"level\":50}"},
+    {3, "{\"state\":\"ON\",\"hue\":30,\"level\":50}"},
+    {4, "{\"state\":\"ON\",\"level\":50}"}
+  });
+
+  // The common level is set after the hue changes
+  TEST_ASSERT_EQUAL_UINT(5, updates.size());
+  assert_batch_update(updates[0], 0, "{\"state\":\"ON\"}");
+  assert_batch_update(updates[1], 1, "{\"hue\":10}");
+  assert_batch_update(updates[2], 2, "{\"hue\":20}");
+  assert_batch_update(updates[3], 3, "{\"hue\":30}");
+  assert_batch_update(updates[4], 0, "{\"level\":50}");
+}
+
+void test_group_batch_sets_level_after_mode_changes() {
+  std::vector<BatchUpdate> updates = splitBatch(2, {
+    {1, "{\"brightness\":50,\"color\":\"red\",\"transition\":3}"},
+    {2, "{\"brightness\":50,\"color_temp\":300,\"transition\":3}"}
+  });
+
+  TEST_ASSERT_EQUAL_UINT(3, updates.size());
+  assert_batch_update(updates[0], 1, "{\"color\":\"red\",\"transition\":3}");
+  assert_batch_update(updates[1], 2, "{\"color_temp\":300,\"transition\":3}");
+  assert_batch_update(updates[2], 0, "{\"brightness\":50,\"transition\":3}");
+
+  // Nothing to wait for when the mode change is common too
+  updates = splitBatch(2, {
+    {1, "{\"brightness\":50,\"color_temp\":300,\"hue\":10}"},
+    {2, "{\"brightness\":50,\"color_temp\":300,\"hue\":10}"}
+  });
+
+  TEST_ASSERT_EQUAL_UINT(1, updates.size());
+  assert_batch_update(updates[0], 0, "{\"brightness\":50,\"color_temp\":300,\"hue\":10}");
+}
+
+void test_group_batch_turns_off_last() {
+  std::vector<BatchUpdate> updates = splitBatch(2, {
+    {1, "{\"state\":\"OFF\",\"level\":10,\"transition\":5}"},
+    {2, "{\"state\":\"OFF\",\"level\":20,\"transition\":5}"}
+  });
+
+  TEST_ASSERT_EQUAL_UINT(3, updates.size());
+  assert_batch_update(updates[0], 1, "{\"level\":10,\"transition\":5}");
+  assert_batch_update(updates[1], 2, "{\"level\":20,\"transition\":5}");
+  assert_batch_update(updates[2], 0, "{\"state\":\"OFF\",\"transition\":5}");
+}
+
+void test_group_batch_compares_long_values() {
+  // Only differ past the point where a fixed buffer would have cut them off
+  const std::string prefix(60, 'x');
+  const std::string a = "{\"effect\":\"" + prefix + "a\"}";
+  const std::string b = "{\"effect\":\"" + prefix + "b\"}";
+
+  std::vector<BatchUpdate> updates = splitBatch(2, { {1, a.c_str()}, {2, b.c_str()} });
+
+  TEST_ASSERT_EQUAL_UINT(2, updates.size());
+  assert_batch_update(updates[0], 1, a.c_str());
+  assert_batch_update(updates[1], 2, b.c_str());
+}
+
+//================================================================================
+// Group state cache
+//================================================================================
+
+static BulbId randomBulbId(uint16_t numDevices) {
+  static const MiLightRemoteType types[] = { REMOTE_TYPE_RGBW, REMOTE_TYPE_RGB_CCT, REMOTE_TYPE_FUT089 };
+
+  // Spread device IDs over the whole 16-bit range
+  return BulbId(random(numDevices) * 0x9E3B, random(9), types[random(size(types))]);
+}
+
+static GroupState stateWithBrightness(uint8_t brightness) {
+  GroupState state;
+  state.setBrightness(brightness);
+  return state;
+}
+
+// Straightforward 2Q, to check GroupStateCache against
+class TwoQueueModel {
+public:
+  typedef std::list<std::pair<BulbId, uint8_t>> Queue;
+
+  TwoQueueModel(size_t maxSize)
+    : maxSize(maxSize),
+      maxProbation(std::max<size_t>(1, maxSize * MILIGHT_STATE_CACHE_PROBATION_PERCENT / 100)),
+      maxGhosts(std::max<size_t>(1, maxSize * MILIGHT_STATE_CACHE_GHOST_PERCENT / 100))
+  { }
+
+  Queue probation;
+  Queue main;
+
+  bool get(const BulbId& id, uint8_t& brightness) {
+    Queue::iterator it;
+
+    if (find(main, id, it)) {
+      main.splice(main.begin(), main, it);
+      brightness = main.front().second;
+      return true;
+    } else if (find(probation, id, it)) {
+      brightness = it->second;
+      return true;
+    }
+
+    return false;
+  }
+
+  void set(const BulbId& id, uint8_t brightness) {
+    Queue::iterator it;
+
+    if (find(main, id, it)) {
+      it->second = brightness;
+      main.splice(main.begin(), main, it);
+      return;
+    } else if (find(probation, id, it)) {
+      it->second = brightness;
+      return;
+    }
+
+    // A removed ghost keeps its place in the ring until it's the oldest
+    auto ghost = std::find(ghosts.begin(), ghosts.end(), std::make_pair(id.getCompactId(), true));
+    const bool seenRecently = ghost != ghosts.end();
+    if (seenRecently) {
+      ghost->second = false;
+    }
+
+    if (size() == maxSize) {
+      Queue& victims = victimQueue();
+      if (&victims == &probation) {
+        if (ghosts.size() == maxGhosts) {
+          ghosts.pop_front();
+        }
+        ghosts.emplace_back(probation.back().first.getCompactId(), true);
+      }
+      victims.pop_back();
+    }
+
+    (seenRecently ? main : probation).emplace_front(id, brightness);
+  }
+
+  size_t size() const {
+    return probation.size() + main.size();
+  }
+
+  const BulbId* victim() {
+    return size() < maxSize ? NULL : &victimQueue().back().first;
+  }
+
+private:
+  const size_t maxSize;
+  const size_t maxProbation;
+  const size_t maxGhosts;
+  std::list<std::pair<uint32_t, bool>> ghosts;
+
+  Queue& victimQueue() {
+    return main.empty() || (! probation.empty() && probation.size() > maxProbation) ? probation : main;
+  }
+
+  static bool find(Queue& queue, const BulbId& id, Queue::iterator& it) {
+    for (it = queue.begin(); it != queue.end(); ++it) {
+      if (it->first == id) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+// Compares against the model over a random mix of gets and sets, enough to
+// evict and reuse nodes many times over
+void test_group_state_cache_matches_2q_model() {
+  const size_t cacheSizes[] = { 1, 7, 100 };
+  randomSeed(ROUND_TRIP_SEED);
+
+  for (size_t cacheSize : cacheSizes) {
+    GroupStateCache cache(cacheSize);
+    TwoQueueModel model(cacheSize);
+
+    for (size_t i = 0; i < 20000; i++) {
+      BulbId id = randomBulbId(cacheSize * 2);
+
+      if (random(2)) {
+        const uint8_t brightness = random(101);
+        GroupState* state = cache.set(id, stateWithBrightness(brightness));
+        TEST_ASSERT_EQUAL_UINT8(brightness, state->getBrightness());
+        model.set(id, brightness);
+      } else {
+        GroupState* state = cache.get(id);
+        uint8_t expected;
+
+        if (! model.get(id, expected)) {
+          TEST_ASSERT_NULL(state);
+        } else {
+          TEST_ASSERT_NOT_NULL(state);
+          TEST_ASSERT_EQUAL_UINT8(expected, state->getBrightness());
+        }
+      }
+
+      TEST_ASSERT_EQUAL_UINT(model.size(), cache.size());
+      TEST_ASSERT_EQUAL_UINT(model.main.size(), cache.mainSize());
+
+      const BulbId* victim = model.victim();
+      if (victim == NULL) {
+        TEST_ASSERT_NULL(cache.getVictim());
+      } else {
+        TEST_ASSERT_TRUE(cache.getVictim()->id == *victim);
+      }
+    }
+  }
+}
+
+void test_group_state_cache_throughput() {
+  const size_t cacheSizes[] = { 100, 500, 2000 };
+
+  printf("\n%-8s %14s %14s %14s\n", "entries", "get hit ns", "get miss ns", "evict ns");
+
+  for (size_t cacheSize : cacheSizes) {
+    GroupStateCache cache(cacheSize);
+    std::vector<BulbId> ids;
+    const GroupState state = stateWithBrightness(50);
+
+    for (size_t i = 0; ids.size() < cacheSize * 2; i++) {
+      ids.push_back(BulbId(i * 0x9E3B, 1 + i % 4, REMOTE_TYPE_RGB_CCT));
+    }
+    for (size_t i = 0; i < cacheSize; i++) {
+      cache.set(ids[i], state);
+    }
+
+    volatile uint32_t sink = 0;
+    randomSeed(ROUND_TRIP_SEED);
+
+    // Resident IDs, in random order so promotions move nodes around the list
+    std::vector<size_t> order(BENCHMARK_CACHE_OPERATIONS);
+    for (size_t& ix : order) {
+      ix = random(cacheSize);
+    }
+
+    unsigned long start = micros();
+    for (size_t ix : order) {
+      sink += cache.get(ids[ix])->getBrightness();
+    }
+    const unsigned long hitMicros = micros() - start;
+
+    start = micros();
+    for (size_t i = 0; i < BENCHMARK_CACHE_OPERATIONS; i++) {
+      sink += cache.get(ids[cacheSize + order[i]]) == NULL;
+    }
+    const unsigned long missMicros = micros() - start;
+
+    // Cycle through twice as many IDs as fit, so every set evicts
+    start = micros();
+    for (size_t i = 0; i < BENCHMARK_CACHE_OPERATIONS; i++) {
+      sink += cache.set(ids[i % ids.size()], state)->getBrightness();
+    }
+    const unsigned long evictMicros = micros() - start;
+
+    printf(
+      "%-8zu %14.1f %14.1f %14.1f\n",
+      cacheSize,
+      hitMicros * 1000.0 / BENCHMARK_CACHE_OPERATIONS,
+      missMicros * 1000.0 / BENCHMARK_CACHE_OPERATIONS,
+      evictMicros * 1000.0 / BENCHMARK_CACHE_OPERATIONS
+    );
+    (void)sink;
+  }
+}
+
+//================================================================================
+// Group state persistence
+//================================================================================
+
+static void assert_persisted_brightness(GroupStatePersistence& persistence, const BulbId& id, int16_t expected) {
+  GroupState state = GroupState::defaultState(id.deviceType);
+  state.clearBrightness();
+  persistence.get(id, state);
+
+  if (expected < 0) {
+    TEST_ASSERT_FALSE(state.isSetBrightness());
+  } else {
+    TEST_ASSERT_TRUE(state.isSetBrightness());
+    TEST_ASSERT_EQUAL_UINT8(expected, state.getBrightness());
+  }
+}
+
+void test_state_journal_survives_reload() {
+  SPIFFS.format();
+
+  {
+    GroupStatePersistence persistence;
+    for (uint16_t deviceId = 0; deviceId < 50; deviceId++) {
+      persistence.set(BulbId(deviceId << 8, 1, REMOTE_TYPE_RGB_CCT), stateWithBrightness(deviceId));
+    }
+    // Superseded and deleted states
+    persistence.set(BulbId(0x100, 1, REMOTE_TYPE_RGB_CCT), stateWithBrightness(99));
+    persistence.clear(BulbId(0x200, 1, REMOTE_TYPE_RGB_CCT));
+    persistence.commit();
+
+    TEST_ASSERT_EQUAL_UINT(49, persistence.size());
+  }
+
+  GroupStatePersistence persistence;
+  TEST_ASSERT_EQUAL_UINT(49, persistence.size());
+  TEST_ASSERT_EQUAL_UINT(52, persistence.journalRecords());
+
+  assert_persisted_brightness(persistence, BulbId(0x000, 1, REMOTE_TYPE_RGB_CCT), 0);
+  assert_persisted_brightness(persistence, BulbId(0x100, 1, REMOTE_TYPE_RGB_CCT), 99);
+  assert_persisted_brightness(persistence, BulbId(0x200, 1, REMOTE_TYPE_RGB_CCT), -1);
+  assert_persisted_brightness(persistence, BulbId(0x3100, 1, REMOTE_TYPE_RGB_CCT), 49);
+
+  // Same device ID, different group and type
+  assert_persisted_brightness(persistence, BulbId(0x3100, 2, REMOTE_TYPE_RGB_CCT), -1);
+  assert_persisted_brightness(persistence, BulbId(0x3100, 1, REMOTE_TYPE_FUT089), -1);
+
+  // Each state is one 12 byte record
+  File f = SPIFFS.open("group_states.log", "r");
+  TEST_ASSERT_EQUAL_UINT(4 + 52 * GroupStatePersistence::RECORD_SIZE, f.size());
+}
+
+void test_state_journal_compaction() {
+  SPIFFS.format();
+  GroupStatePersistence persistence;
+  const BulbId ids[] = {
+    BulbId(0x1111, 1, REMOTE_TYPE_RGBW),
+    BulbId(0x2222, 2, REMOTE_TYPE_CCT),
+    BulbId(0x3333, 3, REMOTE_TYPE_FUT089)
+  };
+
+  for (size_t i = 0; i < 100; i++) {
+    for (size_t j = 0; j < size(ids); j++) {
+      persistence.set(ids[j], stateWithBrightness(i));
+    }
+    persistence.commit();
+
+    TEST_ASSERT_TRUE(persistence.journalRecords() <= size(ids) + MILIGHT_STATE_JOURNAL_SLACK);
+  }
+
+  GroupStatePersistence reloaded;
+  TEST_ASSERT_EQUAL_UINT(persistence.journalRecords(), reloaded.journalRecords());
+  for (const BulbId& id : ids) {
+    assert_persisted_brightness(reloaded, id, 99);
+  }
+  TEST_ASSERT_FALSE(SPIFFS.exists("group_states.tmp"));
+}
+
+void test_state_journal_recovery() {
+  const BulbId id(0x1234, 1, REMOTE_TYPE_RGB_CCT);
+  const BulbId other(0x4321, 1, REMOTE_TYPE_RGB_CCT);
+
+  // Torn write at the end of the journal
+  SPIFFS.format();
+  {
+    GroupStatePersistence persistence;
+    persistence.set(id, stateWithBrightness(10));
+    persistence.commit();
+  }
+  File f = SPIFFS.open("group_states.log", "a");
+  f.write(reinterpret_cast<const uint8_t*>("\x21\x43\x01"), 3);
+  f.close();
+  {
+    GroupStatePersistence persistence;
+    assert_persisted_brightness(persistence, id, 10);
+
+    // New records land on a record boundary
+    persistence.set(other, stateWithBrightness(20));
+    persistence.commit();
+  }
+  {
+    GroupStatePersistence persistence;
+    assert_persisted_brightness(persistence, id, 10);
+    assert_persisted_brightness(persistence, other, 20);
+  }
+
+  // Compaction interrupted after the old journal was removed
+  SPIFFS.rename("group_states.log", "group_states.tmp");
+  {
+    GroupStatePersistence persistence;
+    assert_persisted_brightness(persistence, other, 20);
+    TEST_ASSERT_FALSE(SPIFFS.exists("group_states.tmp"));
+  }
+
+  // Journal from some other version is kept rather than overwritten
+  f = SPIFFS.open("group_states.log", "w");
+  f.write(reinterpret_cast<const uint8_t*>("GSJ\x09"), 4);
+  f.close();
+  {
+    GroupStatePersistence persistence;
+    TEST_ASSERT_EQUAL_UINT(0, persistence.size());
+  }
+  f = SPIFFS.open("group_states.bad", "r");
+  TEST_ASSERT_EQUAL_UINT(4, f.size());
+
+  // Per-bulb files from before the journal are imported, then cleaned up
+  SPIFFS.format();
+  const BulbId legacyId(0x1234, 1, REMOTE_TYPE_RGB_CCT);
+  char legacyPath[30];
+  sprintf(legacyPath, "group_states/%x", legacyId.getCompactId());
+  f = SPIFFS.open(legacyPath, "w");
+  stateWithBrightness(30).dump(f);
+  f.close();
+  SPIFFS.open("group_states/4bd00", "w").close();
+  SPIFFS.open("settings.json", "w").close();
+  {
+    GroupStatePersistence persistence;
+    TEST_ASSERT_EQUAL_UINT(1, persistence.size());
+    assert_persisted_brightness(persistence, legacyId, 30);
+  }
+  TEST_ASSERT_FALSE(SPIFFS.exists(legacyPath));
+  TEST_ASSERT_FALSE(SPIFFS.exists("group_states/4bd00"));
+  TEST_ASSERT_TRUE(SPIFFS.exists("settings.json"));
+  {
+    GroupStatePersistence persistence;
+    assert_persisted_brightness(persistence, legacyId, 30);
+  }
+}
+
+void test_state_journal_kept_when_compaction_fails() {
+  SPIFFS.format();
+  const BulbId id(0x1234, 1, REMOTE_TYPE_RGB_CCT);
+  const BulbId other(0x4321, 1, REMOTE_TYPE_RGB_CCT);
+
+  GroupStatePersistence persistence;
+  persistence.set(other, stateWithBrightness(5));
+  // Enough superseded records to compact on commit
+  const uint8_t last = MILIGHT_STATE_JOURNAL_SLACK + 1;
+  for (uint8_t i = 0; i <= last; i++) {
+    persistence.set(id, stateWithBrightness(i));
+  }
+  const size_t records = persistence.journalRecords();
+
+  // No room for the compacted copy
+  SPIFFS.setCapacity(SPIFFS.usedBytes());
+  persistence.commit();
+
+  TEST_ASSERT_FALSE(SPIFFS.exists("group_states.tmp"));
+  TEST_ASSERT_EQUAL_UINT(records, persistence.journalRecords());
+  assert_persisted_brightness(persistence, id, last);
+  assert_persisted_brightness(persistence, other, 5);
+  {
+    GroupStatePersistence reloaded;
+    TEST_ASSERT_EQUAL_UINT(records, reloaded.journalRecords());
+    assert_persisted_brightness(reloaded, id, last);
+  }
+
+  // Tries again on the next commit
+  SPIFFS.setCapacity(0);
+  persistence.commit();
+
+  TEST_ASSERT_EQUAL_UINT(2, persistence.journalRecords());
+  assert_persisted_brightness(persistence, id, last);
+  assert_persisted_brightness(persistence, other, 5);
+}
+
+//================================================================================
+// Group state flushing
+//================================================================================
+
+void test_state_store_flushes_dirty_states_together() {
+  SPIFFS.format();
+  const unsigned long flushInterval = 50;
+  GroupStateStore store(20, flushInterval);
+
+  TEST_ASSERT_EQUAL_UINT(0, store.getDirtyCount());
+  TEST_ASSERT_EQUAL_UINT(0, store.getOldestDirtyAge());
+
+  // Individual groups pick up the group 0 change when they're read or flushed
+  store.set(BulbId(0x1234, 0, REMOTE_TYPE_RGB_CCT), stateWithBrightness(30));
+  TEST_ASSERT_EQUAL_UINT(1, store.getDirtyCount());
+
+  // Group 0 is already dirty, so its age isn't reset
+  delay(10);
+  store.set(BulbId(0x1234, 1, REMOTE_TYPE_RGB_CCT), stateWithBrightness(40));
+  TEST_ASSERT_EQUAL_UINT(2, store.getDirtyCount());
+  TEST_ASSERT_TRUE(store.getOldestDirtyAge() >= 10);
+
+  // Reading doesn't dirty anything
+  store.get(BulbId(0x4321, 1, REMOTE_TYPE_FUT089));
+  TEST_ASSERT_EQUAL_UINT(2, store.getDirtyCount());
+
+  store.limitedFlush();
+  TEST_ASSERT_EQUAL_UINT(2, store.getDirtyCount());
+
+  delay(flushInterval);
+  store.limitedFlush();
+  TEST_ASSERT_EQUAL_UINT(0, store.getDirtyCount());
+  TEST_ASSERT_EQUAL_UINT(0, store.getOldestDirtyAge());
+
+  // Everything was written, not just the most recently used state
+  GroupStatePersistence persistence;
+  TEST_ASSERT_EQUAL_UINT(5, persistence.size());
+  assert_persisted_brightness(persistence, BulbId(0x1234, 1, REMOTE_TYPE_RGB_CCT), 40);
+  assert_persisted_brightness(persistence, BulbId(0x1234, 4, REMOTE_TYPE_RGB_CCT), 30);
+
+  TEST_ASSERT_FALSE(store.flush());
+}
+
+void test_state_store_evicted_states_leave_dirty_set() {
+  SPIFFS.format();
+  GroupStateStore store(2, 0);
+
+  store.set(BulbId(0x0001, 1, REMOTE_TYPE_FUT091), stateWithBrightness(10));
+  const size_t dirtyCount = store.getDirtyCount();
+  TEST_ASSERT_TRUE(dirtyCount > 0);
+
+  // Evicts 0x0001's states, which must not stay on the dirty list
+  store.set(BulbId(0x0002, 1, REMOTE_TYPE_FUT091), stateWithBrightness(20));
+  TEST_ASSERT_EQUAL_UINT(dirtyCount, store.getDirtyCount());
+
+  store.limitedFlush();
+  TEST_ASSERT_EQUAL_UINT(0, store.getDirtyCount());
+}
+
+void test_state_store_set_returns_state_after_group_0_evicts_it() {
+  SPIFFS.format();
+  GroupStateStore store(1, 0);
+  const BulbId id(0x0001, 1, REMOTE_TYPE_FUT091);
+
+  // Clearing group 0 pushes id's state out of the single slot
+  GroupState* state = store.set(id, stateWithBrightness(42));
+
+  TEST_ASSERT_TRUE(state->isSetBrightness());
+  TEST_ASSERT_EQUAL_UINT8(42, state->getBrightness());
+}
+
+void test_state_store_writes_back_evicted_states() {
+  SPIFFS.format();
+  GroupStateStore store(4, 60000);
+  const BulbId changed(0x0001, 1, REMOTE_TYPE_FUT091);
+
+  store.set(changed, stateWithBrightness(42));
+  store.flush();
+  store.set(changed, stateWithBrightness(43));
+
+  GroupStatePersistence persistence;
+  const size_t records = persistence.journalRecords();
+
+  // Push everything else out.  Only the dirty state should be written back.
+  for (uint16_t i = 2; i < 20; i++) {
+    store.get(BulbId(i, 1, REMOTE_TYPE_FUT091));
+  }
+  TEST_ASSERT_TRUE(store.flush());
+
+  GroupStatePersistence reloaded;
+  TEST_ASSERT_EQUAL_UINT(records + 1, reloaded.journalRecords());
+  assert_persisted_brightness(reloaded, changed, 43);
+
+  // Loads the written back state rather than the default
+  TEST_ASSERT_EQUAL_UINT8(43, store.get(changed)->getBrightness());
+}
+
+void test_state_store_keeps_frequent_states_through_scans() {
+  SPIFFS.format();
+  const size_t cacheSize = 20;
+  GroupStateStore store(cacheSize, 0);
+
+  // Controlled often enough to make it into the main queue: other states in
+  // between push them out of probation, and they come back while remembered
+  std::vector<BulbId> frequent;
+  for (uint16_t i = 0; i < 4; i++) {
+    frequent.push_back(BulbId(0x1000 + i, 1, REMOTE_TYPE_RGB_CCT));
+  }
+  for (size_t pass = 0; pass < 10; pass++) {
+    for (size_t i = 0; i < frequent.size(); i++) {
+      store.set(frequent[i], stateWithBrightness(i));
+      store.get(BulbId(0x2000 + pass * 0x100 + i, 1, REMOTE_TYPE_FUT091));
+    }
+  }
+
+  store.flush();
+  SPIFFS.remove("group_states.log");
+
+  // A burst of one-off IDs much larger than the cache
+  for (uint16_t i = 0; i < cacheSize * 10; i++) {
+    store.get(BulbId(0x3000 + i, 1, REMOTE_TYPE_FUT091));
+  }
+
+  // Still cached, since flash is gone
+  for (size_t i = 0; i < frequent.size(); i++) {
+    TEST_ASSERT_EQUAL_UINT8(i, store.get(frequent[i])->getBrightness());
+  }
+}
+
+void test_state_store_preloads_recent_states() {
+  SPIFFS.format();
+  const size_t numStates = 6;
+  const size_t cacheSize = 4;
+
+  {
+    GroupStatePersistence persistence;
+    for (size_t i = 1; i <= numStates; i++) {
+      persistence.set(BulbId(i, 1, REMOTE_TYPE_FUT089), stateWithBrightness(i * 10));
+    }
+    // Rewriting the first bulb makes it one of the most recent
+    persistence.set(BulbId(1, 1, REMOTE_TYPE_FUT089), stateWithBrightness(99));
+    persistence.commit();
+  }
+
+  GroupStateStore store(cacheSize, 0);
+  TEST_ASSERT_EQUAL_UINT(cacheSize, store.preload());
+  TEST_ASSERT_EQUAL_UINT(cacheSize, store.getPreloadedCount());
+  TEST_ASSERT_EQUAL_UINT(0, store.getDirtyCount());
+
+  // Preloaded states must come from the cache, not flash
+  SPIFFS.remove("group_states.log");
+
+  TEST_ASSERT_EQUAL_UINT8(99, store.get(BulbId(1, 1, REMOTE_TYPE_FUT089))->getBrightness());
+  for (size_t i = numStates - cacheSize + 2; i <= numStates; i++) {
+    TEST_ASSERT_EQUAL_UINT8(i * 10, store.get(BulbId(i, 1, REMOTE_TYPE_FUT089))->getBrightness());
+  }
+}
+
+void test_state_store_preloads_recent_states_after_compaction() {
+  SPIFFS.format();
+  const size_t cacheSize = 4;
+
+  {
+    GroupStatePersistence persistence;
+    // Written in the opposite order of their IDs, which the index is sorted by
+    for (uint16_t deviceId = 6; deviceId >= 1; deviceId--) {
+      persistence.set(BulbId(deviceId, 1, REMOTE_TYPE_FUT089), stateWithBrightness(deviceId * 10));
+    }
+    // Enough rewrites of one bulb to compact the journal
+    for (size_t i = 0; i <= MILIGHT_STATE_JOURNAL_SLACK; i++) {
+      persistence.set(BulbId(3, 1, REMOTE_TYPE_FUT089), stateWithBrightness(99));
+    }
+    persistence.commit();
+
+    TEST_ASSERT_EQUAL_UINT(6, persistence.journalRecords());
+  }
+
+  GroupStateStore store(cacheSize, 0);
+  TEST_ASSERT_EQUAL_UINT(cacheSize, store.preload());
+  SPIFFS.remove("group_states.log");
+
+  // Most recently written first: 3, then 1, 2 and 4
+  TEST_ASSERT_EQUAL_UINT8(99, store.get(BulbId(3, 1, REMOTE_TYPE_FUT089))->getBrightness());
+  const uint16_t recent[] = { 1, 2, 4 };
+  for (uint16_t deviceId : recent) {
+    TEST_ASSERT_EQUAL_UINT8(deviceId * 10, store.get(BulbId(deviceId, 1, REMOTE_TYPE_FUT089))->getBrightness());
+  }
+}
+
+// Reference for GroupStateStore::set: group 0 changes applied to every group
+// straight away
+static void applyEagerly(GroupState* states, size_t numGroups, uint8_t groupId, const GroupState& change) {
+  states[groupId].patch(change);
+
+  if (groupId == 0) {
+    for (size_t i = 1; i <= numGroups; i++) {
+      states[i].patch(change);
+    }
+  } else {
+    states[0].clearNonMatchingFields(change);
+  }
+}
+
+void test_state_store_group_0_matches_eager_fan_out() {
+  SPIFFS.format();
+  const MiLightRemoteType type = REMOTE_TYPE_FUT089;
+  const size_t numGroups = MiLightRemoteConfig::fromType(type)->numGroups;
+  GroupStateStore store(40, 0);
+
+  GroupState expected[MILIGHT_MAX_GROUPS_PER_DEVICE + 1];
+  for (GroupState& state : expected) {
+    state = GroupState::defaultState(type);
+  }
+
+  randomSeed(ROUND_TRIP_SEED);
+
+  for (size_t i = 0; i < 2000; i++) {
+    // Mostly group 0, in runs long enough to fill the broadcast log
+    const uint8_t groupId = random(3) == 0 ? random(1, numGroups + 1) : 0;
+    GroupState change;
+
+    switch (random(3)) {
+      case 0:
+        change.setState(random(4) == 0 ? OFF : ON);
+        break;
+      case 1:
+        change.setBrightness(random(101));
+        break;
+      default:
+        change.setHue(random(360));
+        change.setBulbMode(BULB_MODE_COLOR);
+        break;
+    }
+
+    store.set(BulbId(0x1111, groupId, type), change);
+    applyEagerly(expected, numGroups, groupId, change);
+
+    // Read a random group now and then, leaving the others to fall behind
+    if (random(4) == 0) {
+      const uint8_t readId = random(numGroups + 1);
+      GroupState* actual = store.get(BulbId(0x1111, readId, type));
+      TEST_ASSERT_TRUE(actual->isEqualIgnoreDirty(expected[readId]));
+    }
+  }
+
+  // Catches every group up before writing
+  store.flush();
+
+  GroupStatePersistence persistence;
+  for (size_t i = 0; i <= numGroups; i++) {
+    GroupState persisted;
+    persistence.get(BulbId(0x1111, i, type), persisted);
+    TEST_ASSERT_TRUE(persisted.isEqualIgnoreDirty(expected[i]));
+  }
+}
+
+void test_state_store_group_0_doesnt_touch_groups() {
+  SPIFFS.format();
+  GroupStateStore store(4, 0);
+
+  // 8 groups wouldn't fit, and used to evict each other
+  for (size_t i = 0; i < MILIGHT_BROADCAST_LOG_DEPTH; i++) {
+    store.set(BulbId(0x2222, 0, REMOTE_TYPE_FUT089), stateWithBrightness(10 + i));
+    TEST_ASSERT_EQUAL_UINT(1, store.getDirtyCount());
+  }
+
+  TEST_ASSERT_EQUAL_UINT8(10 + MILIGHT_BROADCAST_LOG_DEPTH - 1, store.get(BulbId(0x2222, 8, REMOTE_TYPE_FUT089))->getBrightness());
+}
+
+void test_state_store_keeps_gateway_states_resident() {
+  SPIFFS.format();
+  const uint16_t gatewayId = 0xABCD;
+  GroupStateStore store(2, 0, { gatewayId });
+
+  store.set(BulbId(gatewayId, 1, REMOTE_TYPE_FUT089), stateWithBrightness(25));
+  store.set(BulbId(gatewayId, 2, REMOTE_TYPE_RGB_CCT), stateWithBrightness(35));
+
+  // Sniffed foreign IDs churn through the cache...
+  for (uint16_t i = 1; i <= 10; i++) {
+    store.get(BulbId(i, 1, REMOTE_TYPE_FUT091));
+  }
+
+  // ...without pushing gateway states out, even before they've been flushed
+  TEST_ASSERT_EQUAL_UINT8(25, store.get(BulbId(gatewayId, 1, REMOTE_TYPE_FUT089))->getBrightness());
+  TEST_ASSERT_EQUAL_UINT8(35, store.get(BulbId(gatewayId, 2, REMOTE_TYPE_RGB_CCT))->getBrightness());
+
+  // Resident states are persisted like any other
+  TEST_ASSERT_TRUE(store.flush());
+  GroupStatePersistence persistence;
+  assert_persisted_brightness(persistence, BulbId(gatewayId, 1, REMOTE_TYPE_FUT089), 25);
+
+  // And preloaded on the next boot
+  GroupStateStore rebooted(2, 0, { gatewayId });
+  rebooted.preload();
+  SPIFFS.remove("group_states.log");
+  TEST_ASSERT_EQUAL_UINT8(25, rebooted.get(BulbId(gatewayId, 1, REMOTE_TYPE_FUT089))->getBrightness());
+  TEST_ASSERT_EQUAL_UINT8(35, rebooted.get(BulbId(gatewayId, 2, REMOTE_TYPE_RGB_CCT))->getBrightness());
+}
+
+void test_resident_states_only_cover_existing_groups() {
+  ResidentGroupStates resident({ 0x1111, 0x2222 });
+  size_t nodesPerDevice = 0;
+
+  for (size_t i = 0; i < MiLightRemoteConfig::NUM_REMOTES; i++) {
+    nodesPerDevice += MiLightRemoteConfig::ALL_REMOTES[i]->numGroups + 1;
+  }
+  TEST_ASSERT_EQUAL_UINT(2 * nodesPerDevice, resident.size());
+
+  for (uint16_t deviceId : { 0x1111, 0x2222 }) {
+    for (size_t i = 0; i < MiLightRemoteConfig::NUM_REMOTES; i++) {
+      const MiLightRemoteConfig* remote = MiLightRemoteConfig::ALL_REMOTES[i];
+
+      for (uint8_t groupId = 0; groupId <= remote->numGroups; groupId++) {
+        GroupStateNode* node = resident.find(BulbId(deviceId, groupId, remote->type));
+        TEST_ASSERT_NOT_NULL(node);
+        TEST_ASSERT_TRUE(BulbId(deviceId, groupId, remote->type) == node->id);
+      }
+
+      TEST_ASSERT_NULL(resident.find(BulbId(deviceId, remote->numGroups + 1, remote->type)));
+    }
+  }
+
+  TEST_ASSERT_NULL(resident.find(BulbId(0x3333, 1, REMOTE_TYPE_RGB_CCT)));
+}
+
+//================================================================================
+// State changes
+//================================================================================
+
+static std::vector<uint32_t> changesSince(const GroupStateChangeLog& log, uint32_t sequence, bool& complete) {
+  std::vector<uint32_t> sequences;
+  complete = log.since(sequence, [&sequences](const GroupStateChangeLog::Change& change) {
+    sequences.push_back(change.sequence);
+  });
+  return sequences;
+}
+
+void test_state_change_log_since() {
+  GroupStateChangeLog log;
+  bool complete;
+
+  TEST_ASSERT_EQUAL_UINT32(0, log.getSequence());
+  TEST_ASSERT_TRUE(changesSince(log, 0, complete).empty());
+  TEST_ASSERT_TRUE(complete);
+
+  for (uint32_t i = 1; i <= MILIGHT_STATE_CHANGE_LOG_SIZE + 10; i++) {
+    TEST_ASSERT_EQUAL_UINT32(i, log.record(BulbId(i, 1, REMOTE_TYPE_FUT089), 1));
+  }
+  const uint32_t latest = log.getSequence();
+
+  std::vector<uint32_t> sequences = changesSince(log, latest - 3, complete);
+  TEST_ASSERT_TRUE(complete);
+  TEST_ASSERT_EQUAL_UINT(3, sequences.size());
+  TEST_ASSERT_EQUAL_UINT32(latest - 2, sequences[0]);
+  TEST_ASSERT_EQUAL_UINT32(latest, sequences[2]);
+
+  // Oldest cursor that can still be caught up from
+  sequences = changesSince(log, latest - MILIGHT_STATE_CHANGE_LOG_SIZE, complete);
+  TEST_ASSERT_TRUE(complete);
+  TEST_ASSERT_EQUAL_UINT(MILIGHT_STATE_CHANGE_LOG_SIZE, sequences.size());
+
+  changesSince(log, latest - MILIGHT_STATE_CHANGE_LOG_SIZE - 1, complete);
+  TEST_ASSERT_FALSE(complete);
+
+  // From before a restart
+  changesSince(log, latest + 1, complete);
+  TEST_ASSERT_FALSE(complete);
+
+  TEST_ASSERT_TRUE(changesSince(log, latest, complete).empty());
+  TEST_ASSERT_TRUE(complete);
+}
+
+void test_state_store_records_changed_fields() {
+  SPIFFS.format();
+  GroupStateStore store(20, 0);
+  const GroupStateChangeLog& changes = store.getChanges();
+  const BulbId bulb(0x5555, 2, REMOTE_TYPE_FUT089);
+  const uint32_t brightnessBit = 1UL << static_cast<unsigned>(GroupStateField::BRIGHTNESS);
+
+  store.set(bulb, stateWithBrightness(50));
+  const uint32_t sequence = changes.getSequence();
+  TEST_ASSERT_TRUE(sequence > 0);
+
+  // No-op writes aren't changes
+  store.set(bulb, stateWithBrightness(50));
+  TEST_ASSERT_EQUAL_UINT32(sequence, changes.getSequence());
+
+  store.set(bulb, stateWithBrightness(60));
+  std::vector<GroupStateChangeLog::Change> recorded;
+  TEST_ASSERT_TRUE(changes.since(sequence, [&recorded](const GroupStateChangeLog::Change& change) {
+    recorded.push_back(change);
+  }));
+  TEST_ASSERT_EQUAL_UINT(1, recorded.size());
+  TEST_ASSERT_TRUE(recorded[0].getBulbId() == bulb);
+  TEST_ASSERT_EQUAL_UINT32(brightnessBit, recorded[0].fields);
+
+  // A group 0 change is one record for the whole device
+  store.set(BulbId(0x5555, 0, REMOTE_TYPE_FUT089), stateWithBrightness(70));
+  TEST_ASSERT_EQUAL_UINT32(recorded[0].sequence + 1, changes.getSequence());
+
+  store.clear(bulb);
+  TEST_ASSERT_EQUAL_UINT32(recorded[0].sequence + 2, changes.getSequence());
+}
+
+void test_state_store_snapshot_includes_unflushed_states() {
+  SPIFFS.format();
+  GroupStateStore store(20, 60000);
+
+  store.set(BulbId(0x0001, 1, REMOTE_TYPE_FUT091), stateWithBrightness(10));
+  store.set(BulbId(0x0002, 0, REMOTE_TYPE_RGB_CCT), stateWithBrightness(20));
+
+  size_t numStates = 0;
+  uint8_t brightness = 0;
+  store.forEachState([&](const BulbId& id, const GroupState& state) {
+    numStates++;
+    if (BulbId(0x0002, 3, REMOTE_TYPE_RGB_CCT) == id) {
+      brightness = state.getBrightness();
+    }
+  });
+
+  // 0x0002's group 0 change reaches all 4 of its groups
+  TEST_ASSERT_EQUAL_UINT(1 + 1 + 4, numStates);
+  TEST_ASSERT_EQUAL_UINT8(20, brightness);
+}
+
+//================================================================================
+// Group state serialization
+//================================================================================
+
+class StringPrint : public Print {
+public:
+  std::string str;
+
+  virtual size_t write(uint8_t c) {
+    str += static_cast<char>(c);
+    return 1;
+  }
+  using Print::write;
+};
+
+static GroupState randomGroupState() {
+  GroupState state;
+
+  if (random(4)) state.setState(random(2) ? ON : OFF);
+  if (random(4)) state.setBulbMode(static_cast<BulbMode>(random(3)));
+  if (random(2)) state.setBrightness(random(101));
+  if (random(2)) state.setHue(random(360));
+  if (random(2)) state.setSaturation(random(101));
+  if (random(2)) state.setMode(random(9));
+  if (random(2)) state.setKelvin(random(101));
+  if (random(8) == 0) state.setNightMode(true);
+
+  return state;
+}
+
+static std::string applyStateJson(const GroupState& state, const BulbId& bulbId, std::vector<GroupStateField>& fields) {
+  StaticJsonDocument<400> json;
+  char buffer[400];
+
+  state.applyState(json.to<JsonObject>(), bulbId, fields);
+  serializeJson(json, buffer);
+
+  return buffer;
+}
+
+void test_group_state_writer_matches_apply_state() {
+  randomSeed(ROUND_TRIP_SEED);
+
+  for (size_t i = 0; i < ROUND_TRIP_ITERATIONS * 4; i++) {
+    const GroupState state = randomGroupState();
+    const BulbId bulbId = randomBulbId(10);
+
+    // Any fields in any order, including repeats and several that share "color"
+    std::vector<GroupStateField> fields;
+    for (long j = random(20); j > 0; j--) {
+      fields.push_back(static_cast<GroupStateField>(1 + random(static_cast<long>(GroupStateField::HEX_COLOR))));
+    }
+
+    const std::string expected = applyStateJson(state, bulbId, fields);
+
+    char buffer[400];
+    GroupStateWriter writer(buffer, sizeof(buffer));
+    writer.beginObject();
+    state.writeState(writer, bulbId, fields);
+    writer.endObject();
+
+    TEST_ASSERT_EQUAL_UINT(expected.size(), writer.finish());
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), buffer);
+
+    // Longer than a chunk, so some of it goes straight through
+    StringPrint out;
+    GroupStateWriter printWriter(out);
+    printWriter.beginObject();
+    state.writeState(printWriter, bulbId, fields);
+    printWriter.endObject();
+
+    TEST_ASSERT_EQUAL_UINT(expected.size(), printWriter.finish());
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), out.str.c_str());
+  }
+}
+
+void test_group_state_writer_overflow() {
+  char buffer[16];
+  GroupStateWriter writer(buffer, sizeof(buffer));
+
+  writer.beginObject();
+  writer.writeKey(GroupStateField::STATE);
+  writer.writeValue("ON");
+  writer.writeKey(GroupStateField::BRIGHTNESS);
+  writer.writeValue(100);
+  writer.endObject();
+
+  TEST_ASSERT_EQUAL_UINT(0, writer.finish());
+  TEST_ASSERT_EQUAL_STRING("", buffer);
+}
+
+void test_group_state_writer_throughput() {
+  std::vector<GroupState> states;
+  for (size_t i = 0; i < 64; i++) {
+    states.push_back(randomGroupState());
+  }
+
+  // The default fields, plus the ones identifying the group
+  std::vector<GroupStateField> fields({
+    GroupStateField::STATE,
+    GroupStateField::BRIGHTNESS,
+    GroupStateField::COMPUTED_COLOR,
+    GroupStateField::MODE,
+    GroupStateField::COLOR_TEMP,
+    GroupStateField::BULB_MODE,
+    GroupStateField::DEVICE_ID,
+    GroupStateField::GROUP_ID,
+    GroupStateField::DEVICE_TYPE
+  });
+
+  const BulbId bulbId(0x1234, 1, REMOTE_TYPE_RGB_CCT);
+  char buffer[400];
+  size_t jsonBytes = 0, writerBytes = 0;
+
+  unsigned long start = micros();
+  for (size_t i = 0; i < BENCHMARK_STATE_WRITES; i++) {
+    StaticJsonDocument<400> json;
+    states[i % states.size()].applyState(json.to<JsonObject>(), bulbId, fields);
+    jsonBytes += serializeJson(json, buffer);
+  }
+  const unsigned long jsonMicros = max(micros() - start, 1UL);
+
+  start = micros();
+  for (size_t i = 0; i < BENCHMARK_STATE_WRITES; i++) {
+    GroupStateWriter writer(buffer, sizeof(buffer));
+    writer.beginObject();
+    states[i % states.size()].writeState(writer, bulbId, fields);
+    writer.endObject();
+    writerBytes += writer.finish();
+  }
+  const unsigned long writerMicros = max(micros() - start, 1UL);
+
+  TEST_ASSERT_EQUAL_UINT(jsonBytes, writerBytes);
+
+  printf("\n%-26s %12s\n", "", "bytes/us");
+  printf("%-26s %12.1f\n", "applyState+serializeJson", double(jsonBytes) / jsonMicros);
+  printf("%-26s %12.1f\n", "GroupStateWriter", double(writerBytes) / writerMicros);
+}
+
+// Just enough MessagePack to read what GroupStateWriter writes, as compact JSON
+static void msgPackToJson(const uint8_t*& in, std::string& out) {
+  const uint8_t type = *in++;
+
+  if (type < 0x80) {
+    out += std::to_string(type);
+  } else if (type == 0xCC) {
+    out += std::to_string(*in++);
+  } else if (type == 0xCD) {
+    out += std::to_string(in[0] << 8 | in[1]);
+    in += 2;
+  } else if ((type & 0xF0) == 0x80 || type == 0xDE) {
+    size_t size = type & 0x0F;
+    if (type == 0xDE) {
+      size = in[0] << 8 | in[1];
+      in += 2;
+    }
+
+    out += '{';
+    for (size_t i = 0; i < size; i++) {
+      if (i > 0) {
+        out += ',';
+      }
+      msgPackToJson(in, out);
+      out += ':';
+      msgPackToJson(in, out);
+    }
+    out += '}';
+  } else if ((type & 0xF0) == 0x90 || type == 0xDC) {
+    size_t size = type & 0x0F;
+    if (type == 0xDC) {
+      size = in[0] << 8 | in[1];
+      in += 2;
+    }
+
+    out += '[';
+    for (size_t i = 0; i < size; i++) {
+      if (i > 0) {
+        out += ',';
+      }
+      msgPackToJson(in, out);
+    }
+    out += ']';
+  } else if ((type & 0xE0) == 0xA0 || type == 0xD9) {
+    const size_t size = type == 0xD9 ? *in++ : type & 0x1F;
+    out += '"';
+    out.append(reinterpret_cast<const char*>(in), size);
+    out += '"';
+    in += size;
+  } else {
+    TEST_FAIL_MESSAGE("unexpected MessagePack type");
+  }
+}
+
+void test_group_state_writer_msgpack_matches_json() {
+  randomSeed(ROUND_TRIP_SEED);
+
+  for (size_t i = 0; i < ROUND_TRIP_ITERATIONS * 4; i++) {
+    const GroupState state = randomGroupState();
+    const BulbId bulbId = randomBulbId(10);
+
+    std::vector<GroupStateField> fields;
+    for (long j = random(20); j > 0; j--) {
+      fields.push_back(static_cast<GroupStateField>(1 + random(static_cast<long>(GroupStateField::HEX_COLOR))));
+    }
+
+    char json[400];
+    GroupStateWriter jsonWriter(json, sizeof(json));
+    jsonWriter.beginObject();
+    state.writeState(jsonWriter, bulbId, fields);
+    jsonWriter.endObject();
+    jsonWriter.finish();
+
+    char msgPack[400];
+    GroupStateWriter msgPackWriter(msgPack, sizeof(msgPack), GroupStateWriter::MSGPACK);
+    msgPackWriter.beginObject();
+    state.writeState(msgPackWriter, bulbId, fields);
+    msgPackWriter.endObject();
+    const size_t length = msgPackWriter.finish();
+
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(msgPack);
+    std::string decoded;
+    msgPackToJson(in, decoded);
+
+    TEST_ASSERT_EQUAL_UINT(length, in - reinterpret_cast<const uint8_t*>(msgPack));
+    TEST_ASSERT_EQUAL_STRING(json, decoded.c_str());
+  }
+}
+
+void test_group_state_writer_msgpack_encoding() {
+  char buffer[400];
+  GroupStateWriter writer(buffer, sizeof(buffer), GroupStateWriter::MSGPACK);
+
+  // 16 members needs a map16 header, and the nested object a fixmap
+  writer.beginObject();
+  for (uint16_t i = 0; i < 15; i++) {
+    writer.writeKey(std::string(1, 'a' + i).c_str());
+    writer.writeValue(i == 0 ? 0x7F : i == 1 ? 0xFF : 0x1234);
+  }
+  writer.writeKey(GroupStateField::COLOR);
+  writer.beginObject();
+  writer.writeKey("r");
+  writer.writeValue(std::string(40, 'x').c_str());
+  writer.endObject();
+  writer.endObject();
+
+  const size_t length = writer.finish();
+  const uint8_t* out = reinterpret_cast<const uint8_t*>(buffer);
+
+  const uint8_t header[] = { 0xDE, 0x00, 0x10, 0xA1, 'a', 0x7F, 0xA1, 'b', 0xCC, 0xFF, 0xA1, 'c', 0xCD, 0x12, 0x34 };
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(header, out, sizeof(header));
+
+  const uint8_t color[] = { 0xA5, 'c', 'o', 'l', 'o', 'r', 0x81, 0xA1, 'r', 0xD9, 40 };
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(color, out + length - 40 - sizeof(color), sizeof(color));
+
+  // Too deep to keep track of
+  GroupStateWriter deep(buffer, sizeof(buffer), GroupStateWriter::MSGPACK);
+  for (size_t i = 0; i <= MILIGHT_STATE_WRITER_MAX_DEPTH; i++) {
+    deep.beginObject();
+    deep.writeKey("a");
+  }
+  TEST_ASSERT_EQUAL_UINT(0, deep.finish());
+}
+
+void test_group_state_writer_arrays() {
+  const GroupStateWriter::Format formats[] = { GroupStateWriter::JSON, GroupStateWriter::MSGPACK };
+
+  for (size_t f = 0; f < size(formats); f++) {
+    char buffer[400];
+    GroupStateWriter writer(buffer, sizeof(buffer), formats[f]);
+
+    writer.beginObject();
+    writer.writeKey(GroupStateField::DEVICE_ID);
+    writer.writeValue(0x1234);
+    writer.writeKey("groups");
+    writer.beginArray();
+    for (uint8_t groupId = 1; groupId <= 2; groupId++) {
+      writer.beginObject();
+      writer.writeKey(GroupStateField::GROUP_ID);
+      writer.writeValue(groupId);
+      writer.writeKey(GroupStateField::STATE);
+      writer.writeValue("ON");
+      writer.endObject();
+    }
+    writer.endArray();
+    writer.writeKey("values");
+    writer.beginArray();
+    for (uint16_t i = 0; i < 20; i++) {
+      writer.writeValue(i);
+    }
+    writer.endArray();
+    writer.writeKey("empty");
+    writer.beginArray();
+    writer.endArray();
+    writer.endObject();
+
+    const size_t length = writer.finish();
+    std::string json(buffer, length);
+
+    if (formats[f] == GroupStateWriter::MSGPACK) {
+      const uint8_t* in = reinterpret_cast<const uint8_t*>(buffer);
+      json.clear();
+      msgPackToJson(in, json);
+      TEST_ASSERT_EQUAL_UINT(length, in - reinterpret_cast<const uint8_t*>(buffer));
+    }
+
+    TEST_ASSERT_EQUAL_STRING(
+      "{\"device_id\":4660,\"groups\":[{\"group_id\":1,\"state\":\"ON\"},{\"group_id\":2,\"state\":\"ON\"}],"
+      "\"values\":[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19],\"empty\":[]}",
+      json.c_str()
+    );
+  }
+}
+
+void test_group_state_writer_msgpack_throughput() {
+  std::vector<GroupState> states;
+  for (size_t i = 0; i < 64; i++) {
+    states.push_back(randomGroupState());
+  }
+
+  std::vector<GroupStateField> fields({
+    GroupStateField::STATE,
+    GroupStateField::BRIGHTNESS,
+    GroupStateField::COMPUTED_COLOR,
+    GroupStateField::MODE,
+    GroupStateField::COLOR_TEMP,
+    GroupStateField::BULB_MODE,
+    GroupStateField::DEVICE_ID,
+    GroupStateField::GROUP_ID,
+    GroupStateField::DEVICE_TYPE
+  });
+
+  const BulbId bulbId(0x1234, 1, REMOTE_TYPE_RGB_CCT);
+  char buffer[400];
+
+  printf("\n%-12s %14s %14s\n", "format", "bytes/state", "ns/state");
+
+  const GroupStateWriter::Format formats[] = { GroupStateWriter::JSON, GroupStateWriter::MSGPACK };
+  const char* names[] = { "JSON", "MessagePack" };
+
+  for (size_t f = 0; f < size(formats); f++) {
+    size_t bytes = 0;
+    const unsigned long start = micros();
+
+    for (size_t i = 0; i < BENCHMARK_STATE_WRITES; i++) {
+      GroupStateWriter writer(buffer, sizeof(buffer), formats[f]);
+      writer.beginObject();
+      states[i % states.size()].writeState(writer, bulbId, fields);
+      writer.endObject();
+      bytes += writer.finish();
+    }
+    const unsigned long elapsed = max(micros() - start, 1UL);
+
+    TEST_ASSERT_TRUE(bytes > 0);
+    printf("%-12s %14.1f %14.1f\n", names[f], double(bytes) / BENCHMARK_STATE_WRITES, elapsed * 1000.0 / BENCHMARK_STATE_WRITES);
+  }
+}
+
+//================================================================================
+// MQTT topic templates
+//================================================================================
+
+// How MqttClient used to bind topics, one String::replace per placeholder
+static String replaceTopicPlaceholders(const String& topicPattern, const BulbId& bulbId, const char* alias) {
+  String boundTopic = topicPattern;
+  String deviceIdHex = bulbId.getHexDeviceId();
+
+  boundTopic.replace(":device_id", deviceIdHex);
+  boundTopic.replace(":hex_device_id", deviceIdHex);
+  boundTopic.replace(":dec_device_id", String(bulbId.deviceId));
+  boundTopic.replace(":group_id", String(bulbId.groupId));
+  boundTopic.replace(":device_type", MiLightRemoteTypeHelpers::remoteTypeToString(bulbId.deviceType));
+  boundTopic.replace(":device_alias", alias != NULL ? alias : "__unnamed_group");
+
+  return boundTopic;
+}
+
+void test_mqtt_topic_template_matches_replace() {
+  static const char* patterns[] = {
+    "",
+    "milight/:device_id/:device_type/:group_id",
+    "milight/states/:hex_device_id/:device_type/:group_id",
+    "milight/:dec_device_id/:group_id/:dec_device_id",
+    "milight/:device_alias",
+    ":device_type:group_id",
+    "milight/:unknown/:device_/:group_id:",
+    "no placeholders at all"
+  };
+
+  randomSeed(ROUND_TRIP_SEED);
+
+  for (size_t i = 0; i < size(patterns); i++) {
+    MqttTopicTemplate topicTemplate(patterns[i]);
+
+    TEST_ASSERT_EQUAL(i == 0, topicTemplate.isEmpty());
+    TEST_ASSERT_EQUAL(strstr(patterns[i], ":device_alias") != NULL, topicTemplate.usesAlias());
+
+    for (size_t j = 0; j < 100; j++) {
+      const BulbId bulbId = randomBulbId(0x10000 / 0x9E3B);
+      const char* alias = j % 2 ? "living_room" : NULL;
+      char topic[MQTT_MAX_TOPIC_LENGTH];
+
+      const String expected = replaceTopicPlaceholders(patterns[i], bulbId, alias);
+      TEST_ASSERT_EQUAL_UINT(expected.length(), topicTemplate.render(topic, sizeof(topic), bulbId, alias));
+      TEST_ASSERT_EQUAL_STRING(expected.c_str(), topic);
+    }
+  }
+
+  // Literals longer than one op holds
+  String longPattern;
+  for (size_t i = 0; i < 40; i++) {
+    longPattern += "abcdefgh";
+  }
+  longPattern += "/:group_id";
+
+  const BulbId bulbId(0x1234, 3, REMOTE_TYPE_RGB_CCT);
+  char topic[400];
+  const String expected = replaceTopicPlaceholders(longPattern, bulbId, NULL);
+  MqttTopicTemplate(longPattern).render(topic, sizeof(topic), bulbId, NULL);
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), topic);
+}
+
+void test_mqtt_topic_template_overflow() {
+  MqttTopicTemplate topicTemplate("milight/:device_id/:device_type/:group_id");
+  const BulbId bulbId(0xABCD, 1, REMOTE_TYPE_FUT089);
+  char topic[32];
+
+  // "milight/0xABCD/fut089/1" is 23 characters
+  TEST_ASSERT_EQUAL_UINT(23, topicTemplate.render(topic, 24, bulbId, NULL));
+  TEST_ASSERT_EQUAL_UINT(0, topicTemplate.render(topic, 23, bulbId, NULL));
+  TEST_ASSERT_EQUAL_STRING("", topic);
+}
+
+void test_mqtt_topic_template_throughput() {
+  const String pattern = "milight/states/:device_id/:device_type/:group_id";
+  MqttTopicTemplate topicTemplate(pattern);
+  char topic[MQTT_MAX_TOPIC_LENGTH];
+  size_t replaceLength = 0, templateLength = 0;
+
+  unsigned long start = micros();
+  for (size_t i = 0; i < BENCHMARK_TOPICS; i++) {
+    const BulbId bulbId(i, i % 9, REMOTE_TYPE_RGB_CCT);
+    replaceLength += replaceTopicPlaceholders(pattern, bulbId, NULL).length();
+  }
+  const unsigned long replaceMicros = max(micros() - start, 1UL);
+
+  start = micros();
+  for (size_t i = 0; i < BENCHMARK_TOPICS; i++) {
+    const BulbId bulbId(i, i % 9, REMOTE_TYPE_RGB_CCT);
+    templateLength += topicTemplate.render(topic, sizeof(topic), bulbId, NULL);
+  }
+  const unsigned long templateMicros = max(micros() - start, 1UL);
+
+  TEST_ASSERT_EQUAL_UINT(replaceLength, templateLength);
+
+  printf("\n%-18s %12s\n", "state topic", "ns/topic");
+  printf("%-18s %12.1f\n", "String::replace", replaceMicros * 1000.0 / BENCHMARK_TOPICS);
+  printf("%-18s %12.1f\n", "MqttTopicTemplate", templateMicros * 1000.0 / BENCHMARK_TOPICS);
+}
+
+// How MqttClient used to bind inbound topics (UrlTokenBindings): placeholders
+// bind whole levels by position, as far as both pattern and topic go
+static const char* bindTopicLevel(const char* pattern, const char* topic, const char* name, std::string& value) {
+  std::string patternCopy(pattern), topicCopy(topic);
+  TokenIterator patternTokens(&patternCopy[0], patternCopy.size());
+  TokenIterator topicTokens(&topicCopy[0], topicCopy.size());
+
+  while (patternTokens.hasNext() && topicTokens.hasNext()) {
+    const char* token = patternTokens.nextToken();
+    const char* binding = topicTokens.nextToken();
+
+    if (token[0] == ':' && 0 == strcmp(token + 1, name)) {
+      value = binding;
+      return value.c_str();
+    }
+  }
+
+  return NULL;
+}
+
+void test_mqtt_topic_matcher_matches_token_bindings() {
+  static const char* patterns[] = {
+    "milight/:device_id/:device_type/:group_id",
+    "milight/commands/:hex_device_id/:group_id",
+    "milight/:dec_device_id/:device_type/:group_id/:dec_device_id",
+    "milight/:device_alias",
+    ":device_type/literal/:group_id",
+    "milight/:device_idx/:device_type"
+  };
+  static const char* topics[] = {
+    "milight/0x1234/rgb_cct/2",
+    "milight/commands/0xABCD/0",
+    "milight/4660/fut089/7/12",
+    "milight/living_room",
+    "rgbw/anything/3",
+    "milight/0x1",
+    "milight//rgb_cct/",
+    "milight/0x1/rgbw/1/extra/levels",
+    ""
+  };
+  static const char* names[] = {
+    "device_id", "hex_device_id", "dec_device_id", "group_id", "device_type", "device_alias"
+  };
+
+  for (size_t i = 0; i < size(patterns); i++) {
+    MqttTopicMatcher matcher(patterns[i]);
+
+    for (size_t j = 0; j < size(topics); j++) {
+      char topic[64];
+      strcpy(topic, topics[j]);
+
+      MqttTopicMatcher::Bindings bindings;
+      matcher.match(topic, bindings);
+
+      for (size_t k = 0; k < MqttTopicMatcher::NUM_BINDINGS; k++) {
+        const MqttTopicMatcher::Binding binding = static_cast<MqttTopicMatcher::Binding>(k);
+        std::string value;
+        const char* expected = bindTopicLevel(patterns[i], topics[j], names[k], value);
+
+        char message[160];
+        sprintf(message, "pattern=%s topic=%s binding=%s", patterns[i], topics[j], names[k]);
+
+        // Binding against the pattern itself binds every placeholder it has
+        std::string placeholder;
+        TEST_ASSERT_EQUAL_MESSAGE(bindTopicLevel(patterns[i], patterns[i], names[k], placeholder) != NULL, matcher.hasBinding(binding), message);
+
+        if (expected == NULL) {
+          TEST_ASSERT_NULL_MESSAGE(bindings.get(binding), message);
+        } else {
+          TEST_ASSERT_NOT_NULL_MESSAGE(bindings.get(binding), message);
+          TEST_ASSERT_EQUAL_STRING_MESSAGE(expected, bindings.get(binding), message);
+        }
+      }
+    }
+  }
+}
+
+static std::map<String, BulbId> randomAliases(size_t numAliases) {
+  std::map<String, BulbId> aliases;
+
+  for (size_t i = 0; i < numAliases; i++) {
+    char alias[20];
+    sprintf(alias, "group_%u", static_cast<unsigned>(random(numAliases * 4)));
+    // Few enough devices that some groups have several aliases
+    aliases[alias] = randomBulbId(numAliases / 4 + 1);
+  }
+
+  return aliases;
+}
+
+void test_group_alias_index() {
+  randomSeed(ROUND_TRIP_SEED);
+
+  const std::map<String, BulbId> aliases = randomAliases(200);
+  GroupAliasIndex index(aliases);
+
+  TEST_ASSERT_EQUAL_UINT(aliases.size(), index.size());
+
+  for (size_t i = 0; i < 800; i++) {
+    char alias[20];
+    sprintf(alias, "group_%u", static_cast<unsigned>(i));
+
+    auto itr = aliases.find(alias);
+    const BulbId* bulbId = index.find(alias);
+
+    if (itr == aliases.end()) {
+      TEST_ASSERT_NULL(bulbId);
+    } else {
+      TEST_ASSERT_NOT_NULL(bulbId);
+      TEST_ASSERT_EQUAL_UINT32(itr->second.getCompactId(), bulbId->getCompactId());
+    }
+  }
+
+  for (size_t i = 0; i < 2000; i++) {
+    const BulbId bulbId = randomBulbId(200 / 4 + 1);
+
+    // What a scan of the map in order finds first
+    const char* expected = NULL;
+    for (auto itr = aliases.begin(); itr != aliases.end() && expected == NULL; ++itr) {
+      if (itr->second.getCompactId() == bulbId.getCompactId()) {
+        expected = itr->first.c_str();
+      }
+    }
+
+    const char* alias = index.findAlias(bulbId);
+    if (expected == NULL) {
+      TEST_ASSERT_NULL(alias);
+    } else {
+      TEST_ASSERT_EQUAL_STRING(expected, alias);
+    }
+  }
+
+  GroupAliasIndex empty((std::map<String, BulbId>()));
+  TEST_ASSERT_NULL(empty.find("group_1"));
+  TEST_ASSERT_NULL(empty.findAlias(BulbId(1, 1, REMOTE_TYPE_RGBW)));
+}
+
+void test_device_id_set() {
+  const std::vector<uint16_t> ids({ 0x1234, 0xFFFF, 0, 0x1234, 0xABCD, 7 });
+  DeviceIdSet set(ids.begin(), ids.end(), [](uint16_t id) { return id; });
+
+  TEST_ASSERT_EQUAL_UINT(5, set.size());
+
+  for (uint32_t id = 0; id <= 0xFFFF; id++) {
+    const bool expected = std::find(ids.begin(), ids.end(), id) != ids.end();
+    TEST_ASSERT_EQUAL(expected, set.contains(id));
+  }
+
+  const std::vector<uint16_t> none;
+  DeviceIdSet empty(none.begin(), none.end(), [](uint16_t id) { return id; });
+  TEST_ASSERT_FALSE(empty.contains(0));
+}
+
+void test_mqtt_topic_matcher_throughput() {
+  MqttTopicMatcher matcher("milight/:device_alias");
+
+  printf("\n%-10s %16s\n", "aliases", "ns/message");
+
+  for (size_t numAliases = 10; numAliases <= BENCHMARK_ALIASES; numAliases *= 10) {
+    const std::map<String, BulbId> aliases = randomAliases(numAliases);
+    GroupAliasIndex index(aliases);
+    std::vector<String> topics;
+
+    for (auto itr = aliases.begin(); itr != aliases.end(); ++itr) {
+      topics.push_back(String("milight/") + itr->first);
+    }
+
+    size_t found = 0;
+    const unsigned long start = micros();
+    for (size_t i = 0; i < BENCHMARK_TOPICS; i++) {
+      const String& topic = topics[i % topics.size()];
+      char buffer[64];
+      memcpy(buffer, topic.c_str(), topic.length() + 1);
+
+      MqttTopicMatcher::Bindings bindings;
+      matcher.match(buffer, bindings);
+      found += index.find(bindings.get(MqttTopicMatcher::DEVICE_ALIAS)) != NULL;
+    }
+    const unsigned long elapsed = max(micros() - start, 1UL);
+
+    TEST_ASSERT_EQUAL_UINT(BENCHMARK_TOPICS, found);
+    printf("%-10zu %16.1f\n", numAliases, elapsed * 1000.0 / BENCHMARK_TOPICS);
+  }
+}
+
+void test_stale_group_set_dedups_groups() {
+  StaleGroupSet set;
+  BulbId bulbId;
+
+  TEST_ASSERT_TRUE(set.add(BulbId(1, 1, REMOTE_TYPE_RGB_CCT), 0));
+  TEST_ASSERT_TRUE(set.add(BulbId(1, 2, REMOTE_TYPE_RGB_CCT), 0));
+  TEST_ASSERT_TRUE(set.add(BulbId(1, 1, REMOTE_TYPE_RGB_CCT), 0));
+  TEST_ASSERT_TRUE(set.add(BulbId(1, 1, REMOTE_TYPE_FUT089), 0));
+  TEST_ASSERT_EQUAL_UINT(3, set.size());
+
+  TEST_ASSERT_TRUE(set.popReady(100, 100, 0, bulbId));
+  TEST_ASSERT_TRUE(BulbId(1, 1, REMOTE_TYPE_RGB_CCT) == bulbId);
+  TEST_ASSERT_EQUAL_UINT(2, set.size());
+}
+
+void test_stale_group_set_debounces_groups_separately() {
+  StaleGroupSet set;
+  BulbId bulbId;
+
+  set.add(BulbId(1, 1, REMOTE_TYPE_RGB_CCT), 0);
+  set.add(BulbId(1, 2, REMOTE_TYPE_RGB_CCT), 0);
+
+  // Group 1 keeps changing, which shouldn't hold back group 2
+  for (unsigned long now = 50; now < 500; now += 50) {
+    set.add(BulbId(1, 1, REMOTE_TYPE_RGB_CCT), now);
+  }
+
+  TEST_ASSERT_TRUE(set.popReady(450, 100, 0, bulbId));
+  TEST_ASSERT_TRUE(BulbId(1, 2, REMOTE_TYPE_RGB_CCT) == bulbId);
+
+  TEST_ASSERT_FALSE(set.popReady(450, 100, 0, bulbId));
+  TEST_ASSERT_FALSE(set.popReady(500, 100, 0, bulbId));
+  TEST_ASSERT_TRUE(set.popReady(550, 100, 0, bulbId));
+  TEST_ASSERT_TRUE(BulbId(1, 1, REMOTE_TYPE_RGB_CCT) == bulbId);
+  TEST_ASSERT_EQUAL_UINT(0, set.size());
+}
+
+void test_stale_group_set_bounds_staleness() {
+  StaleGroupSet set;
+  BulbId bulbId;
+
+  unsigned long now = 0;
+  for (; now < 1000; now += 50) {
+    set.add(BulbId(1, 1, REMOTE_TYPE_RGB_CCT), now);
+    TEST_ASSERT_FALSE(set.popReady(now, 100, 1000, bulbId));
+  }
+
+  TEST_ASSERT_TRUE(set.popReady(now, 100, 1000, bulbId));
+  TEST_ASSERT_TRUE(BulbId(1, 1, REMOTE_TYPE_RGB_CCT) == bulbId);
+
+  // Without a maximum, only the debounce delay counts
+  set.add(BulbId(1, 1, REMOTE_TYPE_RGB_CCT), 0);
+  set.add(BulbId(1, 1, REMOTE_TYPE_RGB_CCT), 5000);
+  TEST_ASSERT_FALSE(set.popReady(5050, 100, 0, bulbId));
+
+  // Time wrapping around doesn't confuse it
+  StaleGroupSet wrapped;
+  wrapped.add(BulbId(1, 1, REMOTE_TYPE_RGB_CCT), static_cast<unsigned long>(-50));
+  TEST_ASSERT_FALSE(wrapped.popReady(0, 100, 0, bulbId));
+  TEST_ASSERT_TRUE(wrapped.popReady(50, 100, 0, bulbId));
+}
+
+void test_stale_group_set_pops_ready_siblings() {
+  StaleGroupSet set;
+  BulbId bulbId;
+
+  set.add(BulbId(1, 1, REMOTE_TYPE_RGB_CCT), 0);
+  set.add(BulbId(2, 1, REMOTE_TYPE_RGB_CCT), 0);
+  set.add(BulbId(1, 1, REMOTE_TYPE_FUT089), 0);
+  set.add(BulbId(1, 2, REMOTE_TYPE_RGB_CCT), 0);
+  set.add(BulbId(1, 3, REMOTE_TYPE_RGB_CCT), 90);
+
+  const BulbId device(1, 0, REMOTE_TYPE_RGB_CCT);
+
+  TEST_ASSERT_TRUE(set.popReadySibling(device, 100, 100, 0, bulbId));
+  TEST_ASSERT_TRUE(BulbId(1, 1, REMOTE_TYPE_RGB_CCT) == bulbId);
+  TEST_ASSERT_TRUE(set.popReadySibling(device, 100, 100, 0, bulbId));
+  TEST_ASSERT_TRUE(BulbId(1, 2, REMOTE_TYPE_RGB_CCT) == bulbId);
+
+  // Group 3 isn't ready yet, and the rest belong to other devices
+  TEST_ASSERT_FALSE(set.popReadySibling(device, 100, 100, 0, bulbId));
+  TEST_ASSERT_EQUAL_UINT(3, set.size());
+}
+
+void test_stale_group_set_full() {
+  StaleGroupSet set;
+  BulbId bulbId;
+
+  for (uint8_t i = 0; i < MILIGHT_MAX_STALE_MQTT_GROUPS; i++) {
+    TEST_ASSERT_TRUE(set.add(BulbId(i, 1, REMOTE_TYPE_RGB_CCT), i));
+  }
+
+  TEST_ASSERT_TRUE(set.isFull());
+  TEST_ASSERT_FALSE(set.add(BulbId(0xFFFF, 1, REMOTE_TYPE_RGB_CCT), 100));
+  // Groups already in the set can still be updated
+  TEST_ASSERT_TRUE(set.add(BulbId(0, 1, REMOTE_TYPE_RGB_CCT), 100));
+
+  TEST_ASSERT_TRUE(set.popOldest(bulbId));
+  TEST_ASSERT_TRUE(BulbId(0, 1, REMOTE_TYPE_RGB_CCT) == bulbId);
+  TEST_ASSERT_FALSE(set.isFull());
+  TEST_ASSERT_TRUE(set.add(BulbId(0xFFFF, 1, REMOTE_TYPE_RGB_CCT), 100));
+
+  // Overflow grows the set, and its groups are popped like any other
+  set.addOverflow(BulbId(0xFFFE, 1, REMOTE_TYPE_RGB_CCT), 200);
+  set.addOverflow(BulbId(0xFFFE, 1, REMOTE_TYPE_RGB_CCT), 201);
+  TEST_ASSERT_EQUAL_UINT(MILIGHT_MAX_STALE_MQTT_GROUPS + 1, set.size());
+
+  while (set.popReady(1000, 10, 0, bulbId)) { }
+  TEST_ASSERT_TRUE(BulbId(0xFFFE, 1, REMOTE_TYPE_RGB_CCT) == bulbId);
+  TEST_ASSERT_EQUAL_UINT(0, set.size());
+}
+
+static CommandDelta parseCommandDelta(const char* json) {
+  StaticJsonDocument<400> command;
+  deserializeJson(command, json);
+  return CommandDelta::fromJson(command.as<JsonObject>());
+}
+
+void test_command_delta_from_json() {
+  CommandDelta delta = parseCommandDelta("{\"state\":\"ON\",\"hue\":120,\"saturation\":50,\"brightness\":255}");
+  TEST_ASSERT_EQUAL_UINT(CommandDelta::STATUS | CommandDelta::HUE | CommandDelta::SATURATION | CommandDelta::LEVEL, delta.fields);
+  TEST_ASSERT_EQUAL(ON, delta.status);
+  TEST_ASSERT_EQUAL_UINT(120, delta.hue);
+  TEST_ASSERT_EQUAL_UINT(50, delta.saturation);
+  TEST_ASSERT_EQUAL_UINT(100, delta.level);
+
+  // status wins over state, and brightness over level
+  delta = parseCommandDelta("{\"status\":\"OFF\",\"state\":\"ON\",\"level\":20,\"brightness\":0}");
+  TEST_ASSERT_EQUAL(OFF, delta.status);
+  TEST_ASSERT_EQUAL_UINT(0, delta.level);
+
+  delta = parseCommandDelta("{\"color_temp\":153,\"mode\":3}");
+  TEST_ASSERT_EQUAL_UINT(CommandDelta::TEMPERATURE | CommandDelta::MODE, delta.fields);
+  TEST_ASSERT_EQUAL_UINT(Units::miredsToWhiteVal(153, 100), delta.temperature);
+  TEST_ASSERT_EQUAL_UINT(3, delta.mode);
+
+  delta = parseCommandDelta("{\"color\":{\"r\":255,\"g\":255,\"b\":250}}");
+  TEST_ASSERT_EQUAL_UINT(CommandDelta::WHITE, delta.fields);
+
+  delta = parseCommandDelta("{\"color\":{\"r\":255,\"g\":0,\"b\":0}}");
+  TEST_ASSERT_EQUAL_UINT(CommandDelta::HUE | CommandDelta::SATURATION, delta.fields);
+  TEST_ASSERT_EQUAL_UINT(0, delta.hue);
+  TEST_ASSERT_EQUAL_UINT(100, delta.saturation);
+
+  delta = parseCommandDelta("{\"effect\":\"night_mode\",\"commands\":[\"set_white\",\"level_up\"]}");
+  TEST_ASSERT_EQUAL_UINT(CommandDelta::NIGHT_MODE | CommandDelta::WHITE, delta.fields);
+}
+
+void test_command_delta_skips_unrepeatable_commands() {
+  TEST_ASSERT_TRUE(parseCommandDelta("{\"command\":\"pair\"}").isEmpty());
+  TEST_ASSERT_TRUE(parseCommandDelta("{\"commands\":[\"level_up\",\"next_mode\"]}").isEmpty());
+  TEST_ASSERT_TRUE(parseCommandDelta("{\"state\":\"ON\",\"repeats\":\"NO\"}").isEmpty());
+  TEST_ASSERT_TRUE(parseCommandDelta("{\"brightness\":10,\"transition\":5}").isEmpty());
+  TEST_ASSERT_TRUE(parseCommandDelta("{}").isEmpty());
+}
+
+static std::vector<std::string> packetsFor(std::function<void(PacketFormatter&)> commands) {
+  PacketFormatter& formatter = *MiLightRemoteConfig::fromType(REMOTE_TYPE_RGB_CCT)->packetFormatter;
+  // Start from the same sequence number each time
+  PacketFormatter::sequenceNumbers = SequenceNumberTable();
+  formatter.prepare(0x1234, 1);
+  commands(formatter);
+
+  std::vector<std::string> packets;
+  PacketStream& stream = formatter.buildPackets();
+  while (stream.hasNext()) {
+    packets.push_back(std::string(reinterpret_cast<const char*>(stream.next()), stream.packetLength));
+  }
+
+  return packets;
+}
+
+// Checks that repeating `json` sends the same packets as `original`, which makes
+// the setter calls MiLightClient::update does for it
+static void assert_repeat_matches(const char* json, std::function<void(PacketFormatter&)> original) {
+  CommandDelta delta = parseCommandDelta(json);
+  std::vector<std::string> expected = packetsFor(original);
+  std::vector<std::string> actual = packetsFor([&delta](PacketFormatter& formatter) { delta.apply(formatter); });
+
+  TEST_ASSERT_EQUAL_UINT_MESSAGE(expected.size(), actual.size(), json);
+  for (size_t i = 0; i < expected.size(); i++) {
+    TEST_ASSERT_TRUE_MESSAGE(expected[i] == actual[i], json);
+  }
+}
+
+void test_command_delta_repeats_in_update_order() {
+  // Color is applied after temperature
+  assert_repeat_matches(
+    "{\"state\":\"ON\",\"color\":{\"r\":255,\"g\":0,\"b\":0},\"color_temp\":200,\"brightness\":128}",
+    [](PacketFormatter& formatter) {
+      formatter.updateStatus(ON);
+      formatter.updateTemperature(Units::miredsToWhiteVal(200, 100));
+      formatter.updateHue(0);
+      formatter.updateSaturation(100);
+      formatter.updateBrightness(Units::rescale<uint16_t, uint16_t>(128, 100, 255));
+    }
+  );
+
+  // An effect with a temperature switches to white before anything else
+  assert_repeat_matches(
+    "{\"state\":\"ON\",\"effect\":\"white_mode\",\"color_temp\":300,\"level\":40}",
+    [](PacketFormatter& formatter) {
+      formatter.updateColorWhite();
+      formatter.updateStatus(ON);
+      formatter.updateTemperature(Units::miredsToWhiteVal(300, 100));
+      formatter.updateBrightness(40);
+    }
+  );
+
+  // Commands come after level, and off is last
+  assert_repeat_matches(
+    "{\"state\":\"OFF\",\"commands\":[\"set_white\"],\"level\":20}",
+    [](PacketFormatter& formatter) {
+      formatter.updateBrightness(20);
+      formatter.updateColorWhite();
+      formatter.updateStatus(OFF);
+    }
+  );
+
+  // Night mode ignores the status
+  assert_repeat_matches(
+    "{\"state\":\"ON\",\"effect\":\"night_mode\"}",
+    [](PacketFormatter& formatter) {
+      formatter.enableNightMode();
+    }
+  );
+}
+
+void test_command_repeat_queue() {
+  CommandRepeatQueue queue;
+  CommandDelta on = parseCommandDelta("{\"state\":\"ON\"}");
+  CommandDelta off = parseCommandDelta("{\"state\":\"OFF\"}");
+  BulbId bulbId;
+  CommandDelta delta;
+
+  queue.put(BulbId(1, 1, REMOTE_TYPE_RGB_CCT), on);
+  queue.put(BulbId(1, 2, REMOTE_TYPE_RGB_CCT), on);
+  // Latest wins, keeping its place
+  queue.put(BulbId(1, 1, REMOTE_TYPE_RGB_CCT), off);
+  TEST_ASSERT_EQUAL_UINT(2, queue.size());
+
+  TEST_ASSERT_TRUE(queue.pop(bulbId, delta));
+  TEST_ASSERT_TRUE(BulbId(1, 1, REMOTE_TYPE_RGB_CCT) == bulbId);
+  TEST_ASSERT_EQUAL(OFF, delta.status);
+
+  queue.remove(BulbId(1, 2, REMOTE_TYPE_RGB_CCT));
+  TEST_ASSERT_FALSE(queue.pop(bulbId, delta));
+
+  // Drops the oldest when full
+  for (uint16_t i = 0; i <= MILIGHT_MAX_REPEATED_MQTT_COMMANDS; i++) {
+    queue.put(BulbId(i, 1, REMOTE_TYPE_RGB_CCT), on);
+  }
+  TEST_ASSERT_EQUAL_UINT(MILIGHT_MAX_REPEATED_MQTT_COMMANDS, queue.size());
+  TEST_ASSERT_TRUE(queue.pop(bulbId, delta));
+  TEST_ASSERT_EQUAL_UINT(1, bulbId.deviceId);
+}
+
+static void pushString(MqttOutbox& outbox, const char* topic, const char* message, bool retain) {
+  outbox.push(topic, reinterpret_cast<const uint8_t*>(message), strlen(message), retain);
+}
+
+void test_mqtt_outbox_coalesces_retained_messages() {
+  MqttOutbox outbox;
+
+  pushString(outbox, "state/1", "{\"state\":\"ON\"}", true);
+  pushString(outbox, "updates/1", "{\"button\":1}", false);
+  pushString(outbox, "updates/1", "{\"button\":2}", false);
+  pushString(outbox, "state/1", "{\"state\":\"OFF\"}", true);
+
+  TEST_ASSERT_EQUAL_UINT(3, outbox.size());
+  TEST_ASSERT_EQUAL_UINT(1, outbox.coalescedMessages());
+  TEST_ASSERT_EQUAL_UINT(0, outbox.droppedMessages());
+
+  const char* expected[][2] = {
+    { "updates/1", "{\"button\":1}" },
+    { "updates/1", "{\"button\":2}" },
+    { "state/1", "{\"state\":\"OFF\"}" }
+  };
+  for (size_t i = 0; i < size(expected); i++) {
+    TEST_ASSERT_EQUAL_STRING(expected[i][0], outbox.front().topic.c_str());
+    const std::vector<uint8_t>& payload = outbox.front().payload;
+    const std::string message(payload.begin(), payload.end());
+    TEST_ASSERT_EQUAL_STRING(expected[i][1], message.c_str());
+    outbox.pop();
+  }
+
+  TEST_ASSERT_TRUE(outbox.isEmpty());
+  TEST_ASSERT_EQUAL_UINT(0, outbox.bytes());
+}
+
+void test_mqtt_outbox_bounds() {
+  MqttOutbox outbox;
+  char topic[20];
+
+  for (size_t i = 0; i < MILIGHT_MQTT_OUTBOX_SIZE + 3; i++) {
+    sprintf(topic, "state/%zu", i);
+    pushString(outbox, topic, "{}", true);
+  }
+
+  TEST_ASSERT_EQUAL_UINT(MILIGHT_MQTT_OUTBOX_SIZE, outbox.size());
+  TEST_ASSERT_EQUAL_UINT(3, outbox.droppedMessages());
+  TEST_ASSERT_EQUAL_STRING("state/3", outbox.front().topic.c_str());
+
+  // Big messages push out as many old ones as it takes to stay under the byte limit
+  const std::string big(MILIGHT_MQTT_OUTBOX_BYTES / 2, 'x');
+  pushString(outbox, "big/1", big.c_str(), false);
+  pushString(outbox, "big/2", big.c_str(), false);
+
+  TEST_ASSERT_TRUE(outbox.bytes() <= MILIGHT_MQTT_OUTBOX_BYTES);
+  TEST_ASSERT_EQUAL_UINT(1, outbox.size());
+  TEST_ASSERT_EQUAL_STRING("big/2", outbox.front().topic.c_str());
+
+  // Messages that could never fit are dropped outright
+  const std::string huge(MILIGHT_MQTT_OUTBOX_BYTES, 'x');
+  pushString(outbox, "huge", huge.c_str(), false);
+  TEST_ASSERT_EQUAL_STRING("big/2", outbox.front().topic.c_str());
+}
+
+static void putString(DeferredCommandQueue& queue, const BulbId& bulbId, const char* payload) {
+  queue.put(bulbId, reinterpret_cast<const uint8_t*>(payload), strlen(payload));
+}
+
+static std::string payloadString(const DeferredCommandQueue::Command& command) {
+  return std::string(command.payload.begin(), command.payload.end());
+}
+
+void test_deferred_command_queue_latest_wins() {
+  DeferredCommandQueue queue;
+  BulbId group1(1, 1, REMOTE_TYPE_RGB_CCT);
+  BulbId group2(1, 2, REMOTE_TYPE_RGB_CCT);
+  BulbId group3(1, 3, REMOTE_TYPE_RGB_CCT);
+
+  putString(queue, group1, "{\"state\":\"ON\"}");
+  putString(queue, group2, "{\"state\":\"ON\"}");
+  putString(queue, group3, "{\"state\":\"ON\"}");
+  putString(queue, group1, "{\"level\":20}");
+
+  TEST_ASSERT_EQUAL_UINT(3, queue.size());
+  TEST_ASSERT_EQUAL_UINT(4, queue.deferredCommands());
+  TEST_ASSERT_EQUAL_UINT(1, queue.mergedCommands());
+
+  // A button press on the same group wins over a command that arrived while it was held
+  queue.supersede(group2);
+  queue.supersede(group2);
+  TEST_ASSERT_EQUAL_UINT(1, queue.droppedCommands());
+
+  // The newest command for a group keeps the group's place in line
+  DeferredCommandQueue::Command command;
+  TEST_ASSERT_TRUE(queue.pop(command));
+  TEST_ASSERT_TRUE(group1 == command.bulbId);
+  std::string payload = payloadString(command);
+  TEST_ASSERT_EQUAL_STRING("{\"level\":20}", payload.c_str());
+
+  TEST_ASSERT_TRUE(queue.pop(command));
+  TEST_ASSERT_TRUE(group3 == command.bulbId);
+  TEST_ASSERT_FALSE(queue.pop(command));
+}
+
+void test_deferred_command_queue_bounds() {
+  DeferredCommandQueue queue;
+
+  for (uint8_t i = 0; i < MILIGHT_MAX_DEFERRED_MQTT_COMMANDS + 2; i++) {
+    putString(queue, BulbId(i, 1, REMOTE_TYPE_RGB_CCT), "{}");
+  }
+
+  TEST_ASSERT_EQUAL_UINT(MILIGHT_MAX_DEFERRED_MQTT_COMMANDS, queue.size());
+  TEST_ASSERT_EQUAL_UINT(2, queue.droppedCommands());
+
+  DeferredCommandQueue::Command command;
+  TEST_ASSERT_TRUE(queue.pop(command));
+  TEST_ASSERT_EQUAL_UINT(2, command.bulbId.deviceId);
+}
+
+//================================================================================
+// Hub sync
+//================================================================================
+
+// One hub, as far as syncing is concerned.  Commands it would send to bulbs are
+// counted rather than sent.
+struct SyncTestHub {
+  SyncTestHub(uint32_t hubId, const std::vector<uint16_t>& deviceIds)
+    : hubId(hubId),
+      gatewayDeviceIds(deviceIds.begin(), deviceIds.end(), [](uint16_t id) { return id; }),
+      stateStore(10, 60000),
+      sync(new HubSync(hubId, gatewayDeviceIds)),
+      transmits(0)
+  { }
+
+  // Loses the versions it's seen, like a reboot does
+  void restart() {
+    sync.reset(new HubSync(hubId, gatewayDeviceIds));
+  }
+
+  size_t count(HubSync::Result result) const {
+    std::map<HubSync::Result, size_t>::const_iterator itr = results.find(result);
+    return itr == results.end() ? 0 : itr->second;
+  }
+
+  const uint32_t hubId;
+  DeviceIdSet gatewayDeviceIds;
+  GroupStateStore stateStore;
+  std::unique_ptr<HubSync> sync;
+  size_t transmits;
+  std::map<HubSync::Result, size_t> results;
+};
+
+// Stand-in for the MQTT broker.  Messages wait until deliver() is called, so
+// tests can choose the order hubs see them in.  Like a real broker, it sends
+// messages back to the hub that published them, and sends the last retained
+// message for each group to hubs when they connect.
+class SyncTestBroker {
+public:
+  void connect(SyncTestHub& hub) {
+    if (std::find(hubs.begin(), hubs.end(), &hub) == hubs.end()) {
+      hubs.push_back(&hub);
+    }
+
+    for (std::map<uint32_t, std::string>::iterator itr = retained.begin(); itr != retained.end(); ++itr) {
+      deliverTo(hub, itr->second);
+    }
+  }
+
+  // A change made at hub, which it announces to the others
+  void change(SyncTestHub& hub, const BulbId& bulbId, const GroupState& state) {
+    hub.stateStore.set(bulbId, state);
+
+    char buffer[MILIGHT_STATE_JSON_SIZE];
+    GroupStateWriter writer(buffer, sizeof(buffer));
+    hub.sync->writeMessage(writer, bulbId, state);
+    TEST_ASSERT_TRUE(writer.finish() > 0);
+
+    retained[bulbId.getCompactId()] = buffer;
+    pending.push_back(buffer);
+  }
+
+  // Sends hub the retained message for bulbId again
+  void replay(SyncTestHub& hub, const BulbId& bulbId) {
+    deliverTo(hub, retained[bulbId.getCompactId()]);
+  }
+
+  void deliver(bool reversed = false) {
+    if (reversed) {
+      std::reverse(pending.begin(), pending.end());
+    }
+
+    for (size_t i = 0; i < pending.size(); i++) {
+      for (size_t j = 0; j < hubs.size(); j++) {
+        deliverTo(*hubs[j], pending[i]);
+      }
+    }
+
+    pending.clear();
+  }
+
+private:
+  std::vector<SyncTestHub*> hubs;
+  std::map<uint32_t, std::string> retained;
+  std::vector<std::string> pending;
+
+  static void deliverTo(SyncTestHub& hub, const std::string& payload) {
+    StaticJsonDocument<400> message;
+    TEST_ASSERT_FALSE(deserializeJson(message, payload.c_str()));
+
+    BulbId bulbId;
+    JsonObject state;
+    const HubSync::Result result = hub.sync->handleMessage(message.as<JsonObject>(), hub.stateStore, bulbId, state);
+
+    if (result == HubSync::TRANSMIT) {
+      hub.transmits++;
+    }
+    hub.results[result]++;
+  }
+};
+
+static GroupState onWithBrightness(uint8_t brightness) {
+  GroupState state = GroupState::defaultState(REMOTE_TYPE_RGB_CCT);
+  state.setState(ON);
+  state.setBrightness(brightness);
+  return state;
+}
+
+static void assert_synced_brightness(uint8_t expected, SyncTestHub& hub, const BulbId& bulbId) {
+  GroupState* state = hub.stateStore.get(bulbId);
+  TEST_ASSERT_NOT_NULL(state);
+  TEST_ASSERT_TRUE(state->isOn());
+  TEST_ASSERT_EQUAL_UINT8(expected, state->getBrightness());
+}
+
+void test_hub_sync_transmits_only_owned_changes() {
+  SPIFFS.format();
+  SyncTestBroker broker;
+  SyncTestHub a(1, { 0x1111 });
+  SyncTestHub b(2, { 0x1111 });
+  SyncTestHub c(3, { 0x2222 });
+  broker.connect(a);
+  broker.connect(b);
+  broker.connect(c);
+
+  const BulbId bulbId(0x1111, 1, REMOTE_TYPE_RGB_CCT);
+
+  // No version to compare the first message with, so it's only stored
+  broker.change(a, bulbId, onWithBrightness(40));
+  broker.deliver();
+
+  TEST_ASSERT_EQUAL_UINT(1, b.count(HubSync::STORED));
+  TEST_ASSERT_EQUAL_UINT(0, b.transmits);
+  assert_synced_brightness(40, b, bulbId);
+
+  broker.change(a, bulbId, onWithBrightness(50));
+  broker.deliver();
+
+  TEST_ASSERT_EQUAL_UINT(2, a.count(HubSync::OWN_MESSAGE));
+  TEST_ASSERT_EQUAL_UINT(0, a.transmits);
+  TEST_ASSERT_EQUAL_UINT(1, b.transmits);
+  TEST_ASSERT_EQUAL_UINT(2, c.count(HubSync::STORED));
+  TEST_ASSERT_EQUAL_UINT(0, c.transmits);
+  assert_synced_brightness(50, b, bulbId);
+  assert_synced_brightness(50, c, bulbId);
+
+  // Nothing to send if the state already matches, e.g. b's radio heard a's packets
+  broker.change(a, bulbId, onWithBrightness(50));
+  broker.deliver();
+
+  TEST_ASSERT_EQUAL_UINT(1, b.count(HubSync::UNCHANGED));
+  TEST_ASSERT_EQUAL_UINT(1, b.transmits);
+}
+
+void test_hub_sync_last_writer_wins() {
+  const BulbId bulbId(0x1111, 1, REMOTE_TYPE_RGB_CCT);
+
+  // Same result whichever order the concurrent changes arrive in
+  for (int reversed = 0; reversed <= 1; reversed++) {
+    SPIFFS.format();
+    SyncTestBroker broker;
+    SyncTestHub a(1, { 0x1111 });
+    SyncTestHub b(2, { 0x1111 });
+    SyncTestHub c(3, { 0x2222 });
+    broker.connect(a);
+    broker.connect(b);
+    broker.connect(c);
+
+    // Same version, so the higher hub ID wins
+    broker.change(a, bulbId, onWithBrightness(20));
+    broker.change(b, bulbId, onWithBrightness(80));
+    broker.deliver(reversed);
+
+    assert_synced_brightness(80, a, bulbId);
+    assert_synced_brightness(80, b, bulbId);
+    assert_synced_brightness(80, c, bulbId);
+    TEST_ASSERT_EQUAL_UINT(1, b.count(HubSync::STALE));
+
+    // a has seen b's version, so its next change is newer
+    broker.change(a, bulbId, onWithBrightness(30));
+    broker.deliver(reversed);
+
+    assert_synced_brightness(30, a, bulbId);
+    assert_synced_brightness(30, b, bulbId);
+    assert_synced_brightness(30, c, bulbId);
+  }
+}
+
+void test_hub_sync_catches_up_after_restart() {
+  SPIFFS.format();
+  SyncTestBroker broker;
+  SyncTestHub a(1, { 0x1111 });
+  SyncTestHub b(2, { 0x1111 });
+  broker.connect(a);
+  broker.connect(b);
+
+  const BulbId bulbId(0x1111, 1, REMOTE_TYPE_RGB_CCT);
+  for (uint8_t brightness = 10; brightness <= 30; brightness += 10) {
+    broker.change(a, bulbId, onWithBrightness(brightness));
+    broker.deliver();
+  }
+
+  // Retained messages bring b's clock back up to date when it reconnects
+  b.restart();
+  broker.connect(b);
+  broker.change(b, bulbId, onWithBrightness(60));
+  broker.deliver();
+
+  TEST_ASSERT_EQUAL_UINT(0, a.count(HubSync::STALE));
+  assert_synced_brightness(60, a, bulbId);
+}
+
+void test_hub_sync_ignores_stale_retained_message_after_restart() {
+  SPIFFS.format();
+  SyncTestBroker broker;
+  SyncTestHub a(1, { 0x1111 });
+  SyncTestHub b(2, { 0x1111 });
+  broker.connect(a);
+  broker.connect(b);
+
+  const BulbId bulbId(0x1111, 1, REMOTE_TYPE_RGB_CCT);
+  for (uint8_t brightness = 10; brightness <= 20; brightness += 10) {
+    broker.change(a, bulbId, onWithBrightness(brightness));
+    broker.deliver();
+  }
+  const size_t transmits = b.transmits;
+
+  // Changed at b without a sync message, e.g. with a remote b's radio heard
+  // before announcing every change.  The retained message is now stale.
+  b.stateStore.set(bulbId, onWithBrightness(70));
+  b.restart();
+  broker.connect(b);
+
+  // Nothing is resent over RF, since b can't tell that the message is stale
+  TEST_ASSERT_EQUAL_UINT(transmits, b.transmits);
+  assert_synced_brightness(20, b, bulbId);
+
+  // Changes that are announced are what gets replayed
+  broker.change(b, bulbId, onWithBrightness(70));
+  broker.deliver();
+  b.restart();
+  broker.connect(b);
+
+  TEST_ASSERT_EQUAL_UINT(transmits, b.transmits);
+  TEST_ASSERT_EQUAL_UINT(2, b.count(HubSync::OWN_MESSAGE));
+  assert_synced_brightness(70, a, bulbId);
+  assert_synced_brightness(70, b, bulbId);
+}
+
+void test_hub_sync_bounds_remembered_versions() {
+  SPIFFS.format();
+  const size_t numBulbs = MILIGHT_HUB_SYNC_TABLE_SIZE + 5;
+  std::vector<uint16_t> deviceIds;
+  for (size_t i = 0; i < numBulbs; i++) {
+    deviceIds.push_back(0x2000 + i);
+  }
+
+  SyncTestBroker broker;
+  SyncTestHub a(1, deviceIds);
+  SyncTestHub b(2, deviceIds);
+  broker.connect(a);
+  broker.connect(b);
+
+  for (size_t i = 0; i < numBulbs; i++) {
+    broker.change(a, BulbId(0x2000 + i, 1, REMOTE_TYPE_RGB_CCT), onWithBrightness(i));
+  }
+  broker.deliver();
+
+  TEST_ASSERT_EQUAL_UINT(MILIGHT_HUB_SYNC_TABLE_SIZE, a.sync->size());
+  TEST_ASSERT_EQUAL_UINT(MILIGHT_HUB_SYNC_TABLE_SIZE, b.sync->size());
+
+  // Replays of versions that are still remembered are recognized as stale.
+  // Forgotten ones can't be told apart from new messages, so they're applied
+  // to the state again (here, without changing it), but never resent over RF.
+  const size_t stale = b.count(HubSync::STALE);
+  broker.replay(b, BulbId(0x2000 + numBulbs - 1, 1, REMOTE_TYPE_RGB_CCT));
+  TEST_ASSERT_EQUAL_UINT(stale + 1, b.count(HubSync::STALE));
+
+  broker.replay(b, BulbId(0x2000, 1, REMOTE_TYPE_RGB_CCT));
+  TEST_ASSERT_EQUAL_UINT(stale + 1, b.count(HubSync::STALE));
+  TEST_ASSERT_EQUAL_UINT(0, b.transmits);
+}
+
+//================================================================================
+// Color conversion
+//================================================================================
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CYCLE_UNIT "cycles"
+static inline uint64_t cycleCount() { return __rdtsc(); }
+#else
+#define CYCLE_UNIT "ns"
+static inline uint64_t cycleCount() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+static void assert_rgb_equal(const uint8_t expected[3], const uint8_t actual[3], uint16_t hue, uint8_t saturation) {
+  char message[40];
+  sprintf(message, "hue=%u saturation=%u", hue, saturation);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(expected, actual, 3, message);
+}
+
+void test_hsv_to_rgb_matches_rgb_converter() {
+  RGBConverter converter;
+  size_t boundaryCases = 0;
+
+  for (uint16_t hue = 0; hue <= 360; hue++) {
+    for (uint8_t saturation = 0; saturation <= 100; saturation++) {
+      uint8_t expected[3], nudged[3], actual[3];
+      converter.hsvToRgb(hue / 360.0, saturation / 100.0, 1, expected);
+      converter.hsvToRgb(hue / 360.0, saturation / 100.0, 1 + COLOR_REFERENCE_EPSILON, nudged);
+      ColorConversion::hsvToRgb(hue, saturation, 255, actual);
+
+      // Exact everywhere once RGBConverter's error is accounted for, and never
+      // more than one step away from what it produced
+      assert_rgb_equal(nudged, actual, hue, saturation);
+      for (size_t i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE(actual[i] == expected[i] || actual[i] == expected[i] + 1);
+      }
+
+      boundaryCases += memcmp(expected, actual, 3) != 0;
+    }
+  }
+
+  printf("\nhsv->rgb: %zu of %d differ from RGBConverter on rounding boundaries\n", boundaryCases, 361 * 101);
+}
+
+void test_rgb_to_hsv_matches_rgb_converter() {
+  RGBConverter converter;
+  size_t boundaryCases = 0;
+
+  for (uint32_t color = 0; color < 0x1000000; color++) {
+    const uint8_t r = color >> 16, g = color >> 8, b = color;
+    double hsv[3];
+    uint16_t hue;
+    uint8_t saturation;
+
+    converter.rgbToHsv(r, g, b, hsv);
+    ColorConversion::rgbToHsv(r, g, b, hue, saturation);
+
+    const uint16_t expectedHue = round(hsv[0]*360);
+    const uint8_t expectedSaturation = round(hsv[1]*100);
+
+    if (hue != round(hsv[0]*360 + COLOR_REFERENCE_EPSILON) || saturation != round(hsv[1]*100 + COLOR_REFERENCE_EPSILON)) {
+      char message[40];
+      sprintf(message, "rgb=%06X", color);
+      TEST_FAIL_MESSAGE(message);
+    }
+    TEST_ASSERT_TRUE(hue == expectedHue || hue == expectedHue + 1);
+    TEST_ASSERT_TRUE(saturation == expectedSaturation || saturation == expectedSaturation + 1);
+
+    boundaryCases += hue != expectedHue || saturation != expectedSaturation;
+  }
+
+  printf("\nrgb->hsv: %zu of %d differ from RGBConverter on rounding boundaries\n", boundaryCases, 0x1000000);
+}
+
+void test_color_conversion_rounding() {
+  uint8_t rgb[3];
+  uint16_t hue;
+  uint8_t saturation;
+
+  // 0.2 * 255 = 51 exactly, which RGBConverter truncates to 50
+  ColorConversion::hsvToRgb(0, 80, 255, rgb);
+  const uint8_t expectedRgb[] = { 255, 51, 51 };
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expectedRgb, rgb, 3);
+
+  // Hue 360 is red, same as 0
+  ColorConversion::hsvToRgb(360, 100, 255, rgb);
+  const uint8_t red[] = { 255, 0, 0 };
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(red, rgb, 3);
+
+  // Saturation of 49/56 = 87.5%: halves round up
+  ColorConversion::rgbToHsv(7, 7, 56, hue, saturation);
+  TEST_ASSERT_EQUAL_UINT16(240, hue);
+  TEST_ASSERT_EQUAL_UINT8(88, saturation);
+
+  // Just below red rounds up to 360 rather than wrapping
+  ColorConversion::rgbToHsv(255, 0, 1, hue, saturation);
+  TEST_ASSERT_EQUAL_UINT16(360, hue);
+
+  ColorConversion::rgbToHsv(0, 0, 0, hue, saturation);
+  TEST_ASSERT_EQUAL_UINT16(0, hue);
+  TEST_ASSERT_EQUAL_UINT8(0, saturation);
+}
+
+void test_color_conversion_cycles() {
+  // Every hue/saturation GroupState can hold, and the colors they map to
+  const size_t numColors = 361 * 101;
+  std::vector<uint8_t> colors(numColors * 3);
+  for (uint16_t hue = 0; hue <= 360; hue++) {
+    for (uint8_t saturation = 0; saturation <= 100; saturation++) {
+      ColorConversion::hsvToRgb(hue, saturation, 255, &colors[(hue * 101 + saturation) * 3]);
+    }
+  }
+
+  RGBConverter converter;
+  volatile uint32_t sink = 0;
+  uint8_t rgb[3];
+  double hsv[3];
+  uint16_t hue;
+  uint8_t saturation;
+
+  uint64_t start = cycleCount();
+  for (size_t i = 0; i < BENCHMARK_COLOR_SWEEPS; i++) {
+    for (uint16_t h = 0; h <= 360; h++) {
+      for (uint8_t s = 0; s <= 100; s++) {
+        converter.hsvToRgb(h / 360.0, s / 100.0, 1, rgb);
+        sink += rgb[1];
+      }
+    }
+  }
+  const uint64_t doubleHsvToRgb = cycleCount() - start;
+
+  start = cycleCount();
+  for (size_t i = 0; i < BENCHMARK_COLOR_SWEEPS; i++) {
+    for (uint16_t h = 0; h <= 360; h++) {
+      for (uint8_t s = 0; s <= 100; s++) {
+        ColorConversion::hsvToRgb(h, s, 255, rgb);
+        sink += rgb[1];
+      }
+    }
+  }
+  const uint64_t fixedHsvToRgb = cycleCount() - start;
+
+  start = cycleCount();
+  for (size_t i = 0; i < BENCHMARK_COLOR_SWEEPS; i++) {
+    for (size_t j = 0; j < numColors * 3; j += 3) {
+      converter.rgbToHsv(colors[j], colors[j+1], colors[j+2], hsv);
+      sink += round(hsv[0]*360) + round(hsv[1]*100);
+    }
+  }
+  const uint64_t doubleRgbToHsv = cycleCount() - start;
+
+  start = cycleCount();
+  for (size_t i = 0; i < BENCHMARK_COLOR_SWEEPS; i++) {
+    for (size_t j = 0; j < numColors * 3; j += 3) {
+      ColorConversion::rgbToHsv(colors[j], colors[j+1], colors[j+2], hue, saturation);
+      sink += hue + saturation;
+    }
+  }
+  const uint64_t fixedRgbToHsv = cycleCount() - start;
+
+  const double conversions = double(BENCHMARK_COLOR_SWEEPS) * numColors;
+  printf("\n%-10s %18s %18s\n", "", "RGBConverter", "ColorConversion");
+  printf("%-10s %11.1f %-6s %11.1f %-6s\n", "hsv->rgb", doubleHsvToRgb / conversions, CYCLE_UNIT, fixedHsvToRgb / conversions, CYCLE_UNIT);
+  printf("%-10s %11.1f %-6s %11.1f %-6s\n", "rgb->hsv", doubleRgbToHsv / conversions, CYCLE_UNIT, fixedRgbToHsv / conversions, CYCLE_UNIT);
+  (void)sink;
+}
+
+int main() {
+  for (size_t i = 0; i < MiLightRemoteConfig::NUM_REMOTES; i++) {
+    MiLightRemoteConfig::ALL_REMOTES[i]->packetFormatter->initialize(&stateStore, &settings);
+  }
+
+  UNITY_BEGIN();
+
+  RUN_TEST(test_all_remotes_have_round_trip_specs);
+  RUN_TEST(test_packet_formatter_round_trips);
+  RUN_TEST(test_packet_formatter_throughput);
+  RUN_TEST(test_sequence_numbers_are_per_device);
+  RUN_TEST(test_sequence_numbers_evict_least_recently_used);
+  RUN_TEST(test_formatter_sequence_numbers_with_interleaved_devices);
+  RUN_TEST(test_group_batch_sends_identical_targets_to_group_0);
+  RUN_TEST(test_group_batch_splits_mixed_targets);
+  RUN_TEST(test_group_batch_sets_level_after_mode_changes);
+  RUN_TEST(test_group_batch_turns_off_last);
+  RUN_TEST(test_group_batch_compares_long_values);
+  RUN_TEST(test_group_state_cache_matches_2q_model);
+  RUN_TEST(test_group_state_cache_throughput);
+  RUN_TEST(test_state_journal_survives_reload);
+  RUN_TEST(test_state_journal_compaction);
+  RUN_TEST(test_state_journal_recovery);
+  RUN_TEST(test_state_journal_kept_when_compaction_fails);
+  RUN_TEST(test_state_store_flushes_dirty_states_together);
+  RUN_TEST(test_state_store_evicted_states_leave_dirty_set);
+  RUN_TEST(test_state_store_set_returns_state_after_group_0_evicts_it);
+  RUN_TEST(test_state_store_writes_back_evicted_states);
+  RUN_TEST(test_state_store_keeps_frequent_states_through_scans);
+  RUN_TEST(test_state_store_preloads_recent_states);
+  RUN_TEST(test_state_store_preloads_recent_states_after_compaction);
+  RUN_TEST(test_state_store_group_0_matches_eager_fan_out);
+  RUN_TEST(test_state_store_group_0_doesnt_touch_groups);
+  RUN_TEST(test_state_store_keeps_gateway_states_resident);
+  RUN_TEST(test_resident_states_only_cover_existing_groups);
+  RUN_TEST(test_state_change_log_since);
+  RUN_TEST(test_state_store_records_changed_fields);
+  RUN_TEST(test_state_store_snapshot_includes_unflushed_states);
+  RUN_TEST(test_group_state_writer_matches_apply_state);
+  RUN_TEST(test_group_state_writer_overflow);
+  RUN_TEST(test_group_state_writer_throughput);
+  RUN_TEST(test_group_state_writer_msgpack_matches_json);
+  RUN_TEST(test_group_state_writer_msgpack_encoding);
+  RUN_TEST(test_group_state_writer_arrays);
+  RUN_TEST(test_group_state_writer_msgpack_throughput);
+  RUN_TEST(test_mqtt_topic_template_matches_replace);
+  RUN_TEST(test_mqtt_topic_template_overflow);
+  RUN_TEST(test_mqtt_topic_template_throughput);
+  RUN_TEST(test_mqtt_topic_matcher_matches_token_bindings);
+  RUN_TEST(test_group_alias_index);
+  RUN_TEST(test_device_id_set);
+  RUN_TEST(test_mqtt_topic_matcher_throughput);
+  RUN_TEST(test_stale_group_set_dedups_groups);
+  RUN_TEST(test_stale_group_set_debounces_groups_separately);
+  RUN_TEST(test_stale_group_set_bounds_staleness);
+  RUN_TEST(test_stale_group_set_pops_ready_siblings);
+  RUN_TEST(test_stale_group_set_full);
+  RUN_TEST(test_command_delta_from_json);
+  RUN_TEST(test_command_delta_skips_unrepeatable_commands);
+  RUN_TEST(test_command_delta_repeats_in_update_order);
+  RUN_TEST(test_command_repeat_queue);
+  RUN_TEST(test_mqtt_outbox_coalesces_retained_messages);
+  RUN_TEST(test_mqtt_outbox_bounds);
+  RUN_TEST(test_deferred_command_queue_latest_wins);
+  RUN_TEST(test_deferred_command_queue_bounds);
+  RUN_TEST(test_hub_sync_transmits_only_owned_changes);
+  RUN_TEST(test_hub_sync_last_writer_wins);
+  RUN_TEST(test_hub_sync_catches_up_after_restart);
+  RUN_TEST(test_hub_sync_ignores_stale_retained_message_after_restart);
+  RUN_TEST(test_hub_sync_bounds_remembered_versions);
+  RUN_TEST(test_hsv_to_rgb_matches_rgb_converter);
+  RUN_TEST(test_rgb_to_hsv_matches_rgb_converter);
+  RUN_TEST(test_color_conversion_rounding);
+  RUN_TEST(test_color_conversion_cycles);
+
+  return UNITY_END();
+}
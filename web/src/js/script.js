@@ -172,6 +172,18 @@ var UI_FIELDS = [ {
     help: "Pattern for MQTT topic to publish state to. When a group changes state, the full known state of the group will be published to this topic pattern",
     type: "string",
     tab: "tab-mqtt"
+  }, {
+    tag:   "mqtt_device_state_topic_pattern",
+    friendly: "MQTT device state topic pattern",
+    help: "Pattern for MQTT topic to publish device states to. When several groups of the same device change state together, their states are published to this topic in a single message. Leave blank to disable",
+    type: "string",
+    tab: "tab-mqtt"
+  }, {
+    tag:   "mqtt_sync_topic_prefix",
+    friendly: "MQTT hub sync topic prefix",
+    help: "Topic prefix used to keep the states of several hubs that share bulbs in sync. Use the same prefix on every hub. Leave blank to disable",
+    type: "string",
+    tab: "tab-mqtt"
   }, {
     tag:   "mqtt_username",
     friendly: "MQTT user name",
@@ -273,8 +285,9 @@ var UI_FIELDS = [ {
   }, {
     tag:   "state_flush_interval",
     friendly: "State flush interval",
-    help: "Minimum number of milliseconds between flushing state to flash. " +
-    "Set to 0 to disable delay and immediately persist state to flash",
+    help: "Maximum number of milliseconds a changed state waits before being flushed " +
+    "to flash.  All changed states are written together, so longer intervals batch more " +
+    "changes into each write.  Set to 0 to disable delay and immediately persist state to flash",
     type: "string",
     tab: "tab-setup"
   }, {
@@ -289,6 +302,22 @@ var UI_FIELDS = [ {
     help: "Minimum number of milliseconds delay for MQTT state updates after change (defaults to 500)",
     type: "string",
     tab: "tab-mqtt"
+  }, {
+    tag:   "mqtt_state_max_staleness",
+    friendly: "MQTT state max staleness",
+    help: "Maximum number of milliseconds a changed bulb state waits to be sent over MQTT, even if it keeps changing. 0 to disable (defaults to 10000)",
+    type: "string",
+    tab: "tab-mqtt"
+  }, {
+    tag: "mqtt_payload_format",
+    friendly: "MQTT payload format",
+    help: "Format of state and update messages.  MessagePack is smaller, but Home Assistant and most other integrations only understand JSON.  Commands are accepted in either format.",
+    type: "option_buttons",
+    options: {
+      'json': 'JSON',
+      'msgpack': 'MessagePack'
+    },
+    tab: "tab-mqtt"
   }, {
     tag:   "packet_repeat_throttle_threshold",
     friendly: "Packet repeat throttle threshold",
@@ -313,6 +342,14 @@ var UI_FIELDS = [ {
     "of repeated packets (defaults to 3)",
     type: "string",
     tab: "tab-radio"
+  }, {
+    tag:   "fresh_sequence_packet_repeats",
+    friendly: "Fresh sequence packet repeats",
+    help: "Number of repeats used for packets whose sequence number is known to be " +
+    "new to the bulb.  Bulbs ignore repeats they've already seen, so this can be much " +
+    "lower than the normal repeat count.  (defaults to 0, 0 disables)",
+    type: "string",
+    tab: "tab-radio"
   }, {
     tag:   "group_state_fields",
     friendly: "Group state fields",